@@ -0,0 +1,433 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <redisasync.h>
+
+#define REDIS_ASYNC_BUF_MIN  (64 * 1024)
+#define REDIS_ASYNC_ARGS_MAX (3)
+
+/*
+ * Parse one reply for req out of bp[0..avail). Returns the bytes it used,
+ * 0 if the reply is not complete yet, -1 on a protocol error.
+ */
+static int redis_async_parse(redis_areq_t *req, char *bp, int avail)
+{
+  int            len;
+  int            hlen;
+  redis_parse_t  p;
+
+  redis_parse_init(&p);
+
+  if ((hlen = redis_parse(&p, bp, avail)) < 0)
+    return -1;
+
+  if (p.state != REDIS_PARSE_DONE)
+    return 0;
+
+  switch (p.type)
+  {
+    case '+':                                            /* status (SET) */
+    case ':':                                           /* integer (DEL) */
+      req->ret = 0;
+      return hlen;
+
+    case '-':                                                   /* error */
+      req->ret = -1;
+      return hlen;
+
+    case '_':                                              /* RESP3 null */
+      req->vlen = -1;
+      req->ret  = -1;
+      return hlen;
+
+    case '$':                                              /* bulk (GET) */
+    {
+      len = p.num;
+
+      if (len < 0)                                      /* nil, no such key */
+      {
+        req->vlen = -1;
+        req->ret  = -1;
+        return hlen;
+      }
+
+      if (avail < hlen + len + 2)
+        return 0;
+
+      if (len < req->vlen)
+        req->vlen = len;
+
+      memcpy(req->val, &bp[hlen], req->vlen);
+
+      req->ret = 0;
+      return hlen + len + 2;
+    }
+  }
+
+  return -1;
+}
+
+static void redis_async_complete(redis_actx_t *actx, redis_areq_t *req)
+{
+  if (req->cb)
+    req->cb(req, req->arg);
+
+  pthread_mutex_lock(&actx->qlock);
+
+  req->done = 1;                      /* caller owns req again after this */
+
+  pthread_cond_broadcast(&actx->cond);
+  pthread_mutex_unlock(&actx->qlock);
+}
+
+/*
+ * Connection is unusable, fail everything that is still outstanding.
+ */
+static void redis_async_fail(redis_actx_t *actx)
+{
+  redis_areq_t *req;
+  redis_areq_t *next;
+
+  pthread_mutex_lock(&actx->qlock);
+
+  actx->broken = 1;
+
+  req        = actx->head;
+  actx->head = NULL;
+  actx->tail = NULL;
+
+  pthread_mutex_unlock(&actx->qlock);
+
+  for (; req; req = next)
+  {
+    next     = req->next;
+    req->ret = -1;
+
+    redis_async_complete(actx, req);
+  }
+}
+
+static int redis_async_read(redis_actx_t *actx)
+{
+  int           rc;
+  int           pos = 0;
+  redis_areq_t *req;
+
+  if (actx->rcap - actx->rlen < REDIS_ASYNC_BUF_MIN / 4)       /* grow */
+  {
+    char *nbuf = realloc(actx->rbuf, actx->rcap * 2);
+
+    if (nbuf == NULL)
+      return -1;
+
+    actx->rbuf  = nbuf;
+    actx->rcap *= 2;
+  }
+
+  rc = read(actx->ctx.sfd, &actx->rbuf[actx->rlen], actx->rcap - actx->rlen);
+
+  if (rc <= 0)
+    return (rc < 0 && errno == EINTR) ? 0 : -1;
+
+  actx->rlen += rc;
+
+  while (pos < actx->rlen)
+  {
+    pthread_mutex_lock(&actx->qlock);
+    req = actx->head;
+    pthread_mutex_unlock(&actx->qlock);
+
+    if (req == NULL)                             /* reply nobody asked for */
+      return -1;
+
+    if ((rc = redis_async_parse(req, &actx->rbuf[pos], 
+                                actx->rlen - pos)) < 0)
+      return -1;
+
+    if (rc == 0)
+      break;
+
+    pos += rc;
+
+    pthread_mutex_lock(&actx->qlock);
+
+    actx->head = req->next;
+
+    if (actx->head == NULL)
+      actx->tail = NULL;
+
+    pthread_mutex_unlock(&actx->qlock);
+
+    redis_async_complete(actx, req);
+  }
+
+  if (pos)
+  {
+    memmove(actx->rbuf, &actx->rbuf[pos], actx->rlen - pos);
+    actx->rlen -= pos;
+  }
+
+  return 0;
+}
+
+static void *redis_async_loop(void *arg)
+{
+  int                 ind;
+  int                 nev;
+  redis_actx_t       *actx = (redis_actx_t *)arg;
+  struct epoll_event  events[2];
+
+  while (!actx->stop)
+  {
+    nev = epoll_wait(actx->efd, events, 2, -1);
+
+    if (nev < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    for (ind = 0; ind < nev; ind++)
+    {
+      if (events[ind].data.fd != actx->ctx.sfd)         /* stop request */
+        continue;
+
+      if (redis_async_read(actx) < 0)
+      {
+        epoll_ctl(actx->efd, EPOLL_CTL_DEL, actx->ctx.sfd, NULL);
+        redis_async_fail(actx);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int redis_async_connect(redis_actx_t *actx, char *ip, int port)
+{
+  struct epoll_event ev;
+
+  memset(actx, 0, sizeof(*actx));
+
+  actx->efd = -1;
+  actx->wfd = -1;
+
+  if (redis_connect(&actx->ctx, ip, port) < 0)
+    return -1;
+
+  pthread_mutex_init(&actx->wlock, NULL);
+  pthread_mutex_init(&actx->qlock, NULL);
+  pthread_cond_init(&actx->cond, NULL);
+
+  actx->rcap = REDIS_ASYNC_BUF_MIN;
+  actx->rbuf = malloc(actx->rcap);
+  actx->efd  = epoll_create1(0);
+  actx->wfd  = eventfd(0, 0);
+
+  if (actx->rbuf == NULL || actx->efd < 0 || actx->wfd < 0)
+    goto error;
+
+  ev.events  = EPOLLIN;
+  ev.data.fd = actx->ctx.sfd;
+
+  if (epoll_ctl(actx->efd, EPOLL_CTL_ADD, actx->ctx.sfd, &ev) < 0)
+    goto error;
+
+  ev.events  = EPOLLIN;
+  ev.data.fd = actx->wfd;
+
+  if (epoll_ctl(actx->efd, EPOLL_CTL_ADD, actx->wfd, &ev) < 0)
+    goto error;
+
+  if (pthread_create(&actx->thread, NULL, redis_async_loop, actx) != 0)
+    goto error;
+
+  return 0;
+
+error:
+  printf("redis async setup failed : %d\n", errno);
+
+  if (actx->efd >= 0)
+    close(actx->efd);
+
+  if (actx->wfd >= 0)
+    close(actx->wfd);
+
+  free(actx->rbuf);
+  redis_close(&actx->ctx);
+
+  return -1;
+}
+
+void redis_areq_init(redis_areq_t *req, redis_acb_t cb, void *arg)
+{
+  memset(req, 0, sizeof(*req));
+
+  req->cb  = cb;
+  req->arg = arg;
+}
+
+static int redis_async_submit(redis_actx_t *actx, redis_areq_t *req, 
+                              int argc, char *argv[], int argl[])
+{
+  int          ind;
+  int          niov = 0;
+  char         ahdr[16];
+  char         hdr[REDIS_ASYNC_ARGS_MAX][16];
+  struct iovec iovec[1 + REDIS_ASYNC_ARGS_MAX * 3];
+
+  sprintf(ahdr, "*%d\r\n", argc);
+  iovec[niov].iov_base = ahdr;
+  iovec[niov].iov_len  = strlen(ahdr);
+  niov++;
+
+  for (ind = 0; ind < argc; ind++)
+  {
+    sprintf(hdr[ind], "$%d\r\n", argl[ind]);
+    iovec[niov].iov_base = hdr[ind];
+    iovec[niov].iov_len  = strlen(hdr[ind]);
+    niov++;
+
+    iovec[niov].iov_base = argv[ind];
+    iovec[niov].iov_len  = argl[ind];
+    niov++;
+
+    iovec[niov].iov_base = "\r\n";
+    iovec[niov].iov_len  = 2;
+    niov++;
+  }
+
+  req->done = 0;
+  req->ret  = -1;
+  req->next = NULL;
+
+  pthread_mutex_lock(&actx->wlock);
+
+  pthread_mutex_lock(&actx->qlock);
+
+  if (actx->broken)
+  {
+    req->done = 1;                          /* not queued, waits return -1 */
+
+    pthread_mutex_unlock(&actx->qlock);
+    pthread_mutex_unlock(&actx->wlock);
+    return -1;
+  }
+
+  /* Queue before writing, the reply may arrive before writev returns */
+  if (actx->tail)
+    actx->tail->next = req;
+  else
+    actx->head = req;
+
+  actx->tail = req;
+
+  pthread_mutex_unlock(&actx->qlock);
+
+  /* 
+   * Once queued req belongs to the io thread: on a failed write it is 
+   * completed with -1 when the shutdown fails what is outstanding.
+   */
+  if (redis_writev(&actx->ctx, iovec, niov) < 0)
+    shutdown(actx->ctx.sfd, SHUT_RDWR);
+
+  pthread_mutex_unlock(&actx->wlock);
+
+  return 0;
+}
+
+int redis_async_get(redis_actx_t *actx, redis_areq_t *req, 
+                    char *key, int klen, void *val, int vlen)
+{
+  char *argv[2] = { "GET", key };
+  int   argl[2] = { 3, klen };
+
+  req->val  = val;
+  req->vlen = vlen;
+
+  return redis_async_submit(actx, req, 2, argv, argl);
+}
+
+int redis_async_set(redis_actx_t *actx, redis_areq_t *req, 
+                    char *key, int klen, void *val, int vlen)
+{
+  char *argv[3] = { "SET", key, (char *)val };
+  int   argl[3] = { 3, klen, vlen };
+
+  req->val  = NULL;
+  req->vlen = 0;
+
+  return redis_async_submit(actx, req, 3, argv, argl);
+}
+
+int redis_async_del(redis_actx_t *actx, redis_areq_t *req, 
+                    char *key, int klen)
+{
+  char *argv[2] = { "DEL", key };
+  int   argl[2] = { 3, klen };
+
+  req->val  = NULL;
+  req->vlen = 0;
+
+  return redis_async_submit(actx, req, 2, argv, argl);
+}
+
+int redis_async_wait(redis_actx_t *actx, redis_areq_t *req)
+{
+  pthread_mutex_lock(&actx->qlock);
+
+  while (!req->done)
+    pthread_cond_wait(&actx->cond, &actx->qlock);
+
+  pthread_mutex_unlock(&actx->qlock);
+
+  return req->ret;
+}
+
+void redis_async_close(redis_actx_t *actx)
+{
+  uint64_t one = 1;
+
+  actx->stop = 1;
+
+  if (write(actx->wfd, &one, sizeof(one)) == sizeof(one))
+    pthread_join(actx->thread, NULL);
+
+  redis_close(&actx->ctx);
+  redis_async_fail(actx);
+
+  close(actx->efd);
+  close(actx->wfd);
+
+  free(actx->rbuf);
+
+  actx->rbuf = NULL;
+}
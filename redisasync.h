@@ -0,0 +1,82 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _REDISASYNC_H
+
+#include <pthread.h>
+#include <redislib.h>
+
+#define _REDISASYNC_H
+
+/*
+ * Asynchronous redis client. Commands are written to the connection as
+ * they are submitted and any number of them may be outstanding; an epoll
+ * driven thread reads the replies and completes the requests in order.
+ */
+
+typedef struct redis_areq_t redis_areq_t;
+
+typedef void (*redis_acb_t)(redis_areq_t *req, void *arg);
+
+/* Request handle, owned by the caller until it completes */
+struct redis_areq_t
+{
+  void          *val;                                   /* GET destination */
+  int            vlen;         /* in: val size, out: copied or -1 for nil */
+  int            ret;                        /* 0 or -1, valid once done */
+  int            done;
+  redis_acb_t    cb;                        /* called from the io thread */
+  void          *arg;
+  redis_areq_t  *next;
+};
+
+struct redis_actx_t
+{
+  redis_ctx_t      ctx;                                     /* connection */
+  int              efd;                                          /* epoll */
+  int              wfd;                             /* eventfd, wakes io */
+  int              stop;
+  int              broken;
+  pthread_t        thread;
+  pthread_mutex_t  wlock;                      /* serializes submissions */
+  pthread_mutex_t  qlock;                          /* outstanding queue */
+  pthread_cond_t   cond;                      /* signalled on completion */
+  redis_areq_t    *head;                            /* in reply order */
+  redis_areq_t    *tail;
+  char            *rbuf;                        /* unparsed reply bytes */
+  int              rcap;
+  int              rlen;
+};
+typedef struct redis_actx_t redis_actx_t;
+
+int  redis_async_connect(redis_actx_t *actx, char *ip, int port);
+void redis_areq_init(redis_areq_t *req, redis_acb_t cb, void *arg);
+
+/* 
+ * Submissions return -1 for a request that was not queued, it is done at
+ * once. After 0 the request completes, with ret -1 if the connection fails.
+ */
+int  redis_async_get(redis_actx_t *actx, redis_areq_t *req, 
+                     char *key, int klen, void *val, int vlen);
+int  redis_async_set(redis_actx_t *actx, redis_areq_t *req, 
+                     char *key, int klen, void *val, int vlen);
+int  redis_async_del(redis_actx_t *actx, redis_areq_t *req, 
+                     char *key, int klen);
+int  redis_async_wait(redis_actx_t *actx, redis_areq_t *req);
+void redis_async_close(redis_actx_t *actx);
+
+#endif /* redisasync.h */
@@ -21,10 +21,18 @@
 #include <errno.h>
 #include <string.h>
 #include <strings.h>
+#include <stdlib.h>
 #include <sys/types.h>   
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <redislib.h>
 
@@ -37,72 +45,992 @@
 #define TRUE 1
 #define FALSE 0
 
+static int redis_io_error(redis_ctx_t *ctx)
+{
+  ctx->err  = TRUE;
+  ctx->rcur = 0;                    /* what is buffered can't be trusted */
+  ctx->rlen = 0;
+
+  return -1;
+}
+
+redis_tune_t redis_tune = { TRUE, REDIS_KEEPALIVE_DEFAULT, 0, 0 };
+
+/* Socket options from redis_tune, set before connect so they apply early */
+static void redis_sock_tune(int sfd, int tcp)
+{
+  int on = 1;
+
+  if (redis_tune.sndbuf > 0)
+    setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, 
+               &redis_tune.sndbuf, sizeof(redis_tune.sndbuf));
+
+  if (redis_tune.rcvbuf > 0)
+    setsockopt(sfd, SOL_SOCKET, SO_RCVBUF, 
+               &redis_tune.rcvbuf, sizeof(redis_tune.rcvbuf));
+
+  if (!tcp)
+    return;
+
+  if (redis_tune.nodelay)             /* commands go out whole, in writev */
+    setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  if (redis_tune.keepalive > 0)            /* notice a dead server/peer */
+  {
+    setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(sfd, IPPROTO_TCP, TCP_KEEPIDLE, 
+               &redis_tune.keepalive, sizeof(redis_tune.keepalive));
+  }
+}
+
+/*
+ * Connect to ctx->ip, a unix domain socket if it is a path, else an IPv4
+ * address or host name with ctx->port.
+ */
+static int redis_sock_connect(redis_ctx_t *ctx)
+{
+  int                 rc;
+  int                 tcp = ctx->ip[0] != '/';
+  struct sockaddr_in  serv_addr;
+  struct sockaddr_un  unix_addr;
+  struct addrinfo     hints;
+  struct addrinfo    *res;
+
+  ctx->rcur = 0;
+  ctx->rlen = 0;
+
+  bzero((char *) &serv_addr, sizeof(serv_addr));
+  bzero((char *) &unix_addr, sizeof(unix_addr));
+
+  if (tcp)
+  {
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port   = htons(ctx->port);
+
+    if (inet_pton(AF_INET, ctx->ip, &serv_addr.sin_addr) != 1)
+    {
+      bzero((char *) &hints, sizeof(hints));
+
+      hints.ai_family   = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+
+      if ((rc = getaddrinfo(ctx->ip, NULL, &hints, &res)) != 0)
+      {
+        printf("resolving %s failed : %s\n", ctx->ip, gai_strerror(rc)); 
+        return -1;
+      }
+
+      serv_addr.sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+
+      freeaddrinfo(res);
+    }
+  }
+  else
+  {
+    unix_addr.sun_family = AF_UNIX;
+    snprintf(unix_addr.sun_path, sizeof(unix_addr.sun_path), "%s", ctx->ip);
+  }
+
+  ctx->sfd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+
+  if (ctx->sfd < 0)
+  {
+    printf("socket creation failed : %d\n", errno); 
+    return -1;
+  }
+
+  redis_sock_tune(ctx->sfd, tcp);
+
+  if ((tcp && connect(ctx->sfd, (struct sockaddr *) &serv_addr,
+                      sizeof(serv_addr)) < 0) ||
+      (!tcp && connect(ctx->sfd, (struct sockaddr *) &unix_addr, 
+                       sizeof(unix_addr)) < 0))
+  {
+    printf("connect failed : %d\n", errno); 
+    close(ctx->sfd);
+    ctx->sfd = -1;
+
+    return -1;
+  }
+
+ // printf("connected to ip = %s port = %d, fd = %d\n", ip, port, ctx->sfd);
+
+  return 0;
+}
+
+static void redis_ctx_init(redis_ctx_t *ctx, char *ip, int port)
+{
+  if (ip == NULL)
+    ip = REDIS_SERVER_DEFAULT_IP;
+
+  if (port == 0)
+    port = REDIS_SERVER_DEFAULT_PORT;
+
+  snprintf(ctx->ip, sizeof(ctx->ip), "%s", ip);
+
+  ctx->port = port;
+  ctx->sfd  = -1;
+  ctx->err  = FALSE;
+  ctx->rcur = 0;
+  ctx->rlen = 0;
+
+  pthread_mutex_init(&ctx->lock, NULL);
+}
+
 int redis_connect(redis_ctx_t *ctx, char *ip, int port)
 {
-  char   buffer[256];
-  struct sockaddr_in serv_addr;
+  redis_ctx_init(ctx, ip, port);
+
+  return redis_sock_connect(ctx);
+}
+
+/* Run the context over an already connected socket */
+int redis_attach(redis_ctx_t *ctx, int sfd)
+{
+  redis_ctx_init(ctx, NULL, 0);
+
+  ctx->sfd = sfd;
+
+  return 0;
+}
+
+/*
+ * Every command runs with the context locked, so a context may be shared
+ * by several threads. A context whose connection is down is (re)connected
+ * on entry; one that hit an I/O error is closed on exit since the reply 
+ * stream can no longer be trusted.
+ */
+static int redis_enter(redis_ctx_t *ctx)
+{
+  pthread_mutex_lock(&ctx->lock);
+
+  if (ctx->sfd < 0 && redis_sock_connect(ctx) < 0)
+  {
+    pthread_mutex_unlock(&ctx->lock);
+    return -1;
+  }
+
+  ctx->err  = FALSE;
+  ctx->sent = FALSE;
+
+  return 0;
+}
+
+static int redis_leave(redis_ctx_t *ctx)
+{
+  int err;
+
+  if (ctx->rcur < ctx->rlen)         /* bytes no command asked for, desync */
+    redis_io_error(ctx);
+
+  err = ctx->err;
+
+  if (err)
+  {
+    close(ctx->sfd);
+    ctx->sfd = -1;
+  }
+
+  pthread_mutex_unlock(&ctx->lock);
+
+  return err;
+}
+
+#define REDIS_RETRY_MAX (2)
+
+/*
+ * Run a command, retrying on a fresh connection if the current one broke.
+ * A command the server may have run already is only sent again if running
+ * it twice is harmless (replay), APPEND, RPUSH or INCRBY are not.
+ */
+#define redis_call_if(ctx, call, replay) \
+        do \
+        { \
+          int _rc; \
+          int _try; \
+          int _sent; \
+          for (_try = 0; _try < REDIS_RETRY_MAX; _try++) \
+          { \
+            if (redis_enter(ctx) < 0) \
+              return -1; \
+            _rc   = (call); \
+            _sent = (ctx)->sent; \
+            if (redis_leave(ctx) == 0) \
+              return _rc; \
+            if (_sent && !(replay)) \
+              return -1; \
+          } \
+          return -1; \
+        } \
+        while (0)
+
+#define redis_call(ctx, call)       redis_call_if(ctx, call, TRUE)
+#define redis_call_once(ctx, call)  redis_call_if(ctx, call, FALSE)
+
+/*
+ * Reply reading. Each context keeps the reply bytes it read ahead in 
+ * ctx->rbuf; headers are parsed from there by redis_parse, bulk payloads
+ * are copied straight to the caller, with readv when they are not all 
+ * buffered yet so that the bytes after a payload still land in rbuf.
+ */
+
+#define REDIS_PARSE_NUM(t)  (strchr(":$*=!%~>|(", (t)) != NULL)
+#define REDIS_PARSE_BULK(t) ((t) == '$' || (t) == '=' || (t) == '!')
+#define REDIS_PARSE_AGGR(t) (strchr("*%~>|", (t)) != NULL)
+
+void redis_parse_init(redis_parse_t *p)
+{
+  p->state = REDIS_PARSE_TYPE;
+  p->type  = 0;
+  p->neg   = FALSE;
+  p->num   = 0;
+  p->len   = 0;
+}
+
+/*
+ * Feed avail bytes at bp to the header parser. Returns the bytes used, 
+ * all of them unless the header ends inside bp (p->state is then 
+ * REDIS_PARSE_DONE), or -1 if the stream is not RESP.
+ */
+int redis_parse(redis_parse_t *p, char *bp, int avail)
+{
+  char *sp = bp;
+  char *ep = bp + avail;
+  char  c;
+
+  while (sp < ep && p->state != REDIS_PARSE_DONE)
+  {
+    c = *sp++;
+
+    switch (p->state)
+    {
+      case REDIS_PARSE_TYPE:
+      {
+        if (c == 0 || strchr("+-:$*_,#(=!%~>|", c) == NULL)
+          return -1;
+
+        p->type  = c;
+        p->state = REDIS_PARSE_LINE;
+        break;
+      }
+      case REDIS_PARSE_LINE:
+      {
+        if (c == '\r')
+        {
+          p->state = REDIS_PARSE_LF;
+          break;
+        }
+
+        if (c == '\n')                                  /* tolerate bare LF */
+        {
+          p->state = REDIS_PARSE_DONE;
+          break;
+        }
+
+        if (p->len < sizeof(p->line) - 1)
+          p->line[p->len++] = c;
+
+        if (!REDIS_PARSE_NUM(p->type))
+          break;
+
+        if (c >= '0' && c <= '9')
+          p->num = p->num * 10 + (c - '0');
+        else if (c == '-' && p->len == 1)
+          p->neg = TRUE;
+        else if (p->type != '(')                   /* big numbers may be any */
+          return -1;
+
+        break;
+      }
+      case REDIS_PARSE_LF:
+      {
+        if (c != '\n')
+          return -1;
+
+        p->state = REDIS_PARSE_DONE;
+        break;
+      }
+    }
+  }
+
+  if (p->state == REDIS_PARSE_DONE)
+  {
+    p->line[p->len] = 0;
+
+    if (p->neg)
+      p->num = -p->num;
+  }
+
+  return sp - bp;
+}
+
+static int redis_fill(redis_ctx_t *ctx)
+{
+  int rc;
+
+  if (ctx->rcur < ctx->rlen)
+    return 0;
+
+  do
+  {
+    rc = read(ctx->sfd, ctx->rbuf, sizeof(ctx->rbuf));
+  }
+  while (rc < 0 && errno == EINTR);
+
+  if (rc <= 0)
+    return redis_io_error(ctx);
+
+  ctx->rcur = 0;
+  ctx->rlen = rc;
+
+  return 0;
+}
+
+/* Drop n bytes of the reply stream */
+static int redis_discard(redis_ctx_t *ctx, long long n)
+{
+  int rc;
+
+  while (n)
+  {
+    if (redis_fill(ctx) < 0)
+      return -1;
+
+    rc = ctx->rlen - ctx->rcur < n ? ctx->rlen - ctx->rcur : n;
+
+    ctx->rcur += rc;
+    n         -= rc;
+  }
+
+  return 0;
+}
+
+static int redis_skip(redis_ctx_t *ctx, long long n);
+
+/*
+ * Read the next reply header. RESP3 attributes and out of band pushes in
+ * front of it are skipped.
+ */
+static int redis_read_hdr(redis_ctx_t *ctx, redis_parse_t *p)
+{
+  int rc;
+
+  while (TRUE)
+  {
+    redis_parse_init(p);
+
+    while (p->state != REDIS_PARSE_DONE)
+    {
+      if (redis_fill(ctx) < 0)
+        return -1;
+
+      rc = redis_parse(p, &ctx->rbuf[ctx->rcur], ctx->rlen - ctx->rcur);
+
+      if (rc < 0)
+        return redis_io_error(ctx);                   /* lost the stream */
+
+      ctx->rcur += rc;
+    }
+
+    if (p->type == '|' && p->num > 0)
+    {
+      if (redis_skip(ctx, p->num * 2) < 0)
+        return -1;
+    }
+    else if (p->type == '>' && p->num > 0)
+    {
+      if (redis_skip(ctx, p->num) < 0)
+        return -1;
+    }
+    else if (p->type != '|' && p->type != '>')
+      return 0;
+  }
+}
+
+/* Skip n complete replies, aggregates with all their elements */
+static int redis_skip(redis_ctx_t *ctx, long long n)
+{
+  redis_parse_t p;
+
+  while (n--)
+  {
+    if (redis_read_hdr(ctx, &p) < 0)
+      return -1;
+
+    if (REDIS_PARSE_BULK(p.type) && p.num >= 0)
+    {
+      if (redis_discard(ctx, p.num + 2) < 0)               /* + CRLF */
+        return -1;
+    }
+    else if (REDIS_PARSE_AGGR(p.type) && p.num > 0)
+      n += p.type == '%' ? p.num * 2 : p.num;
+  }
+
+  return 0;
+}
+
+/*
+ * Read a bulk payload of len bytes, the first cap of them into dst, and 
+ * its CRLF.
+ */
+static int redis_read_payload(redis_ctx_t *ctx, char *dst, 
+                              long long len, int cap)
+{
+  int          rc;
+  int          done;
+  int          copy = len < cap ? len : cap;
+  char         crlf[2];
+  struct iovec iov[2];
+
+  done = ctx->rlen - ctx->rcur < copy ? ctx->rlen - ctx->rcur : copy;
+
+  memcpy(dst, &ctx->rbuf[ctx->rcur], done);
+
+  ctx->rcur += done;
+
+  while (done < copy)                    /* rbuf is empty, read past it */
+  {
+    iov[0].iov_base = dst + done;
+    iov[0].iov_len  = copy - done;
+
+    iov[1].iov_base = ctx->rbuf;
+    iov[1].iov_len  = sizeof(ctx->rbuf);
+
+    if ((rc = readv(ctx->sfd, iov, 2)) < 0 && errno == EINTR)
+      continue;
+
+    if (rc <= 0)
+      return redis_io_error(ctx);
+
+    if (rc > copy - done)                       /* the rest went to rbuf */
+    {
+      ctx->rcur = 0;
+      ctx->rlen = rc - (copy - done);
+      rc        = copy - done;
+    }
+
+    done += rc;
+  }
+
+  if (redis_discard(ctx, len - copy) < 0)
+    return -1;
+
+  for (rc = 0; rc < 2; rc++)
+  {
+    if (redis_fill(ctx) < 0)
+      return -1;
+
+    crlf[rc] = ctx->rbuf[ctx->rcur++];
+  }
+
+  if (crlf[0] != '\r' || crlf[1] != '\n')
+    return redis_io_error(ctx);
+
+  return 0;
+}
+
+/*
+ * Read one reply header line ("$5", "+OK", ":1", ...) without the CRLF.
+ */
+static int redis_read_line(redis_ctx_t *ctx, char *line, int max)
+{
+  redis_parse_t p;
+
+  if (redis_read_hdr(ctx, &p) < 0)
+    return -1;
+
+  return snprintf(line, max, "%c%s", p.type, p.line);
+}
+
+/*
+ * Read a bulk string reply into val. *vlen is set to the number of bytes 
+ * copied, or -1 for a nil reply. Payload beyond vlen is discarded.
+ */
+static int redis_read_bulk(redis_ctx_t *ctx, void *val, int *vlen)
+{
+  redis_parse_t p;
+
+  if (redis_read_hdr(ctx, &p) < 0)
+    return -1;
+
+  if (p.type == '_' || ((REDIS_PARSE_BULK(p.type) || 
+                         REDIS_PARSE_AGGR(p.type)) && p.num < 0))
+  {
+    *vlen = -1;
+    return 0;
+  }
+
+  if (p.type != '$')                 /* error or a reply of another kind */
+  {
+    if (REDIS_PARSE_BULK(p.type))
+      redis_discard(ctx, p.num + 2);
+    else if (REDIS_PARSE_AGGR(p.type))
+      redis_skip(ctx, p.type == '%' ? p.num * 2 : p.num);
+
+    return -1;
+  }
+
+  if (redis_read_payload(ctx, (char *)val, p.num, *vlen) < 0)
+    return -1;
+
+  if (p.num < *vlen)
+    *vlen = p.num;
+
+  return 0;
+}
+
+#define REDIS_MAX_LEN (8192 )
+
+static int redis_get_int(redis_ctx_t *ctx, char *key, int klen, 
+                         void *val, int vlen)
+{
+  char         buf[64];
+  struct iovec iovec[5];
+
+  //printf("redis_get : key [%.*s] %d\n", klen, key, klen); 
+
+  iovec[0].iov_base = "*2\r\n";
+  iovec[0].iov_len  = strlen(iovec[0].iov_base);
+
+  iovec[1].iov_base = "$3\r\nGET\r\n";  /* GET - 3 char */
+  iovec[1].iov_len  = strlen(iovec[1].iov_base);
+
+  sprintf(buf, "$%d\r\n", klen);
+  iovec[2].iov_base = buf;
+  iovec[2].iov_len  = strlen(buf);;
+
+  iovec[3].iov_base = key;
+  iovec[3].iov_len  = klen;
+
+  iovec[4].iov_base = "\r\n";
+  iovec[4].iov_len  = 2;
+
+  if (redis_writev(ctx, iovec, sizeof(iovec)/sizeof(iovec[0])) < 0)
+    return -1;
+
+  if (redis_read_bulk(ctx, val, &vlen) < 0 || vlen < 0)
+    return -1;
+
+  return vlen;
+}
+
+int redis_get(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen)
+{
+  redis_call(ctx, redis_get_int(ctx, key, klen, val, vlen));
+}
+
+int redis_writev(redis_ctx_t *ctx, struct iovec *iov, int iovcnt)
+{
+  ssize_t rc;
+
+  while (iovcnt)
+  {
+    if ((rc = writev(ctx->sfd, iov, iovcnt)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return redis_io_error(ctx);
+    }
+
+    if (rc > 0)                        /* the server may run it from now */
+      ctx->sent = TRUE;
+
+    while (iovcnt && rc >= iov->iov_len)                 /* skip done iovs */
+    {
+      rc -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+
+    if (iovcnt)                                         /* partial iovec */
+    {
+      iov->iov_base  = (char *)iov->iov_base + rc;
+      iov->iov_len  -= rc;
+    }
+  }
+
+  return 0;
+}
+
+#define REDIS_PIPE_MAX (128)
+
+static int redis_mget_int(redis_ctx_t *ctx, char *keys[], int klens[], 
+                          void *vals[], int vlens[], int n)
+{
+  int          ind;
+  int          cnt;
+  int          base;
+  int          ret = 0;
+  char         hdr[REDIS_PIPE_MAX][16];
+  struct iovec iovec[REDIS_PIPE_MAX * 4];
+  struct iovec *iov;
+  for (base = 0; base < n; base += cnt)
+  {
+    cnt = n - base;
+
+    if (cnt > REDIS_PIPE_MAX)
+      cnt = REDIS_PIPE_MAX;
+
+    for (ind = 0, iov = iovec; ind < cnt; ind++, iov += 4)
+    {
+      iov[0].iov_base = "*2\r\n$3\r\nGET\r\n";
+      iov[0].iov_len  = strlen(iov[0].iov_base);
+
+      sprintf(hdr[ind], "$%d\r\n", klens[base + ind]);
+      iov[1].iov_base = hdr[ind];
+      iov[1].iov_len  = strlen(hdr[ind]);
+
+      iov[2].iov_base = keys[base + ind];
+      iov[2].iov_len  = klens[base + ind];
+
+      iov[3].iov_base = "\r\n";
+      iov[3].iov_len  = 2;
+    }
+
+    if (redis_writev(ctx, iovec, cnt * 4) < 0)
+      return -1;
+
+    for (ind = 0; ind < cnt; ind++)       /* replies come back in order */
+    {
+      if (redis_read_bulk(ctx, vals[base + ind], 
+                          &vlens[base + ind]) < 0)
+      {
+        if (ctx->err)
+          return -1;
+
+        ret = -1;                     /* error reply, drain the others */
+      }
+    }
+  }
+
+  return ret;
+}
+
+int redis_mget(redis_ctx_t *ctx, char *keys[], int klens[], 
+               void *vals[], int vlens[], int n)
+{
+  redis_call(ctx, redis_mget_int(ctx, keys, klens, vals, vlens, n));
+}
+
+static int redis_mset_int(redis_ctx_t *ctx, char *keys[], int klens[], 
+                          void *vals[], int vlens[], int n)
+{
+  int          ind;
+  int          cnt;
+  int          base;
+  int          ret = 0;
+  char         line[64];
+  char         khdr[REDIS_PIPE_MAX][16];
+  char         vhdr[REDIS_PIPE_MAX][16];
+  struct iovec iovec[REDIS_PIPE_MAX * 6];
+  struct iovec *iov;
+  for (base = 0; base < n; base += cnt)
+  {
+    cnt = n - base;
+
+    if (cnt > REDIS_PIPE_MAX)
+      cnt = REDIS_PIPE_MAX;
+
+    for (ind = 0, iov = iovec; ind < cnt; ind++, iov += 6)
+    {
+      iov[0].iov_base = "*3\r\n$3\r\nSET\r\n";
+      iov[0].iov_len  = strlen(iov[0].iov_base);
+
+      sprintf(khdr[ind], "$%d\r\n", klens[base + ind]);
+      iov[1].iov_base = khdr[ind];
+      iov[1].iov_len  = strlen(khdr[ind]);
+
+      iov[2].iov_base = keys[base + ind];
+      iov[2].iov_len  = klens[base + ind];
+
+      sprintf(vhdr[ind], "\r\n$%d\r\n", vlens[base + ind]);
+      iov[3].iov_base = vhdr[ind];
+      iov[3].iov_len  = strlen(vhdr[ind]);
+
+      iov[4].iov_base = vals[base + ind];
+      iov[4].iov_len  = vlens[base + ind];
+
+      iov[5].iov_base = "\r\n";
+      iov[5].iov_len  = 2;
+    }
+
+    if (redis_writev(ctx, iovec, cnt * 6) < 0)
+      return -1;
+
+    for (ind = 0; ind < cnt; ind++)    /* drain every reply, even on error */
+    {
+      if (redis_read_line(ctx, line, sizeof(line)) < 0)
+        return -1;
+
+      if (memcmp(line, REDIS_OK_STR, REDIS_OK_LEN) != 0)
+        ret = -1;
+    }
+  }
+
+  return ret;
+}
+
+int redis_mset(redis_ctx_t *ctx, char *keys[], int klens[], 
+               void *vals[], int vlens[], int n)
+{
+  redis_call(ctx, redis_mset_int(ctx, keys, klens, vals, vlens, n));
+}
+
+static int redis_mput_int(redis_ctx_t *ctx, char *keys[], int klens[], 
+                          void *vals[], int vlens[], long voffs[], int n, 
+                          char *bkeys[], int bklens[], size_t boffs[], 
+                          int bvals[], int nb)
+{
+  int          ind;
+  int          cnt;
+  int          ncmd;
+  int          base;
+  int          ret = 0;
+  char         line[64];
+  char         khdr[REDIS_PIPE_MAX][16];
+  long         voff;
+  char         vhdr[REDIS_PIPE_MAX][64];
+  struct iovec iovec[REDIS_PIPE_MAX * 6];
+  struct iovec *iov;
+  for (base = 0; base < n + nb; base += cnt)
+  {
+    cnt = n + nb - base;
+
+    if (cnt > REDIS_PIPE_MAX)
+      cnt = REDIS_PIPE_MAX;
+
+    for (ind = 0, iov = iovec, ncmd = base; ind < cnt; ind++, ncmd++)
+    {
+      if (ncmd < n && vals[ncmd] == NULL)
+      {
+        iov[0].iov_base = "*2\r\n$3\r\nDEL\r\n";
+        sprintf(khdr[ind], "$%d\r\n", klens[ncmd]);
+        vhdr[ind][0] = 0;
+      }
+      else if (ncmd < n)
+      {
+        voff = voffs ? voffs[ncmd] : REDIS_PUT_SET;
+
+        if (voff == REDIS_PUT_SET)
+          iov[0].iov_base = "*3\r\n$3\r\nSET\r\n";
+        else if (voff == REDIS_PUT_APPEND)
+          iov[0].iov_base = "*3\r\n$6\r\nAPPEND\r\n";
+        else if (voff == REDIS_PUT_RPUSH)
+          iov[0].iov_base = "*3\r\n$5\r\nRPUSH\r\n";
+        else
+          iov[0].iov_base = "*4\r\n$8\r\nSETRANGE\r\n";
+
+        sprintf(khdr[ind], "$%d\r\n", klens[ncmd]);
+
+        if (voff >= 0)
+        {
+          sprintf(line, "%ld", voff);
+          sprintf(vhdr[ind], "\r\n$%d\r\n%s\r\n$%d\r\n", 
+                  (int)strlen(line), line, vlens[ncmd]);
+        }
+        else
+          sprintf(vhdr[ind], "\r\n$%d\r\n", vlens[ncmd]);
+      }
+      else                          /* BITFIELD key SET u1 <offset> <value> */
+      {
+        iov[0].iov_base = "*6\r\n$8\r\nBITFIELD\r\n";
+        sprintf(khdr[ind], "$%d\r\n", bklens[ncmd - n]);
+        sprintf(line, "%llu", (unsigned long long)boffs[ncmd - n]);
+        sprintf(vhdr[ind], "\r\n$3\r\nSET\r\n$2\r\nu1\r\n$%d\r\n%s\r\n"
+                           "$1\r\n%d", 
+                (int)strlen(line), line, bvals[ncmd - n] ? 1 : 0);
+      }
+
+      iov[0].iov_len  = strlen(iov[0].iov_base);
+
+      iov[1].iov_base = khdr[ind];
+      iov[1].iov_len  = strlen(khdr[ind]);
+
+      iov[2].iov_base = ncmd < n ? keys[ncmd] : bkeys[ncmd - n];
+      iov[2].iov_len  = ncmd < n ? klens[ncmd] : bklens[ncmd - n];
+
+      iov[3].iov_base = vhdr[ind];
+      iov[3].iov_len  = strlen(vhdr[ind]);
+
+      iov += 4;
+
+      if (ncmd < n && vals[ncmd] != NULL)
+      {
+        iov[0].iov_base = vals[ncmd];
+        iov[0].iov_len  = vlens[ncmd];
+        iov++;
+      }
+
+      iov[0].iov_base = "\r\n";
+      iov[0].iov_len  = 2;
+      iov++;
+    }
+
+    if (redis_writev(ctx, iovec, iov - iovec) < 0)
+      return -1;
+
+    for (ind = 0, ncmd = base; ind < cnt; ind++, ncmd++)  /* drain replies */
+    {
+      if (redis_read_line(ctx, line, sizeof(line)) < 0)
+        return -1;
+
+      if (ncmd < n && vals[ncmd] != NULL && 
+          (voffs == NULL || voffs[ncmd] == REDIS_PUT_SET))
+      {
+        if (memcmp(line, REDIS_OK_STR, REDIS_OK_LEN) != 0)
+          ret = -1;
+      }
+      else if (ncmd < n)               /* DEL, SETRANGE, APPEND or RPUSH */
+      {
+        if (line[0] != ':')
+          ret = -1;
+      }
+      else if (line[0] != '*')                         /* *1 :<old value> */
+        return redis_io_error(ctx);
+      else if (redis_read_line(ctx, line, sizeof(line)) < 0)
+        return -1;
+    }
+  }
+
+  return ret;
+}
+
+/*
+ * One pipelined round trip : write vals[i] to keys[i] as voffs[i] says,
+ * REDIS_PUT_SET (or voffs NULL) for SET, REDIS_PUT_APPEND for APPEND,
+ * REDIS_PUT_RPUSH to push vals[i] on the list at keys[i] and an offset for
+ * SETRANGE there, or DEL the key when vals[i] is NULL. Then
+ * set bit boffs[j] of the string at bkeys[j] to bvals[j] with BITFIELD.
+ */
+int redis_mput(redis_ctx_t *ctx, char *keys[], int klens[], 
+               void *vals[], int vlens[], long voffs[], int n, 
+               char *bkeys[], int bklens[], size_t boffs[], int bvals[], 
+               int nb)
+{
+  int ind;
+  int replay = TRUE;
+
+  for (ind = 0; voffs && ind < n; ind++)
+  {
+    if (vals[ind] && (voffs[ind] == REDIS_PUT_APPEND || 
+                      voffs[ind] == REDIS_PUT_RPUSH))
+      replay = FALSE;                       /* twice appends twice */
+  }
+
+  redis_call_if(ctx, redis_mput_int(ctx, keys, klens, vals, vlens, voffs, n, 
+                                    bkeys, bklens, boffs, bvals, nb), replay);
+}
+
+static int redis_getrange_int(redis_ctx_t *ctx, char *key, int klen, 
+                              long start, void *val, int *vlen)
+{
+  char         hdr[64];
+  char         num[2][32];
+  char         mid[96];
+  struct iovec iovec[3];
+  sprintf(num[0], "%ld", start);
+  sprintf(num[1], "%ld", start + *vlen - 1);
+
+  sprintf(hdr, "*4\r\n$8\r\nGETRANGE\r\n$%d\r\n", klen);
+  sprintf(mid, "\r\n$%d\r\n%s\r\n$%d\r\n%s\r\n", 
+          (int)strlen(num[0]), num[0], (int)strlen(num[1]), num[1]);
+
+  iovec[0].iov_base = hdr;
+  iovec[0].iov_len  = strlen(hdr);
+
+  iovec[1].iov_base = key;
+  iovec[1].iov_len  = klen;
+
+  iovec[2].iov_base = mid;
+  iovec[2].iov_len  = strlen(mid);
+
+  if (redis_writev(ctx, iovec, 3) < 0)
+    return -1;
+
+  return redis_read_bulk(ctx, val, vlen);
+}
+
+/*
+ * Read *vlen bytes of the value at key from offset start. *vlen is set to
+ * the bytes there were, short or 0 past the end or for a missing key.
+ */
+int redis_getrange(redis_ctx_t *ctx, char *key, int klen, 
+                   long start, void *val, int *vlen)
+{
+  redis_call(ctx, redis_getrange_int(ctx, key, klen, start, val, vlen));
+}
+
+static int redis_set_int(redis_ctx_t *ctx, char *key, int klen, 
+                         void *val, int vlen)
+{
+  char        *sp;
+  char         buf[64];
+  char         buf2[64];
+  struct iovec iovec[8];
 
-  if (ip == NULL)
-    ip = REDIS_SERVER_DEFAULT_IP;
+  //printf("redis_set : key [%.*s] %d [%.*s] %d\n", klen, key, klen, vlen, val, vlen);
 
-  if (port == 0)
-    port = REDIS_SERVER_DEFAULT_PORT;
+  iovec[0].iov_base = "*3\r\n";
+  iovec[0].iov_len  = strlen(iovec[0].iov_base);
 
-  ctx->sfd = socket(AF_INET, SOCK_STREAM, 0);
+  iovec[1].iov_base = "$3\r\nSET\r\n";  /* SET - 3 char */
+  iovec[1].iov_len  = strlen(iovec[1].iov_base);
 
-  if (ctx->sfd < 0)
-  {
-    printf("socket creation failed : %d\n", errno); 
-    return -1;
-  }
+  sprintf(buf, "$%d\r\n", klen);
+  iovec[2].iov_base = buf;
+  iovec[2].iov_len  = strlen(buf);
 
-  bzero((char *) &serv_addr, sizeof(serv_addr));
+  iovec[3].iov_base = key;
+  iovec[3].iov_len  = klen;
+
+  iovec[4].iov_base = "\r\n";
+  iovec[4].iov_len  = 2;
 
-  serv_addr.sin_family      = AF_INET;
-  serv_addr.sin_addr.s_addr = inet_addr(ip);
-  serv_addr.sin_port        = htons(port);
+  sprintf(buf2, "$%d\r\n", vlen);
+  iovec[5].iov_base = buf2;
+  iovec[5].iov_len  = strlen(buf2);
 
-  if (connect(ctx->sfd, (struct sockaddr *) &serv_addr,
-              sizeof(serv_addr)) < 0)
-  {
-    printf("connect failed : %d\n", errno); 
-    close(ctx->sfd);
-    ctx->sfd = -1;
+  iovec[6].iov_base = val;
+  iovec[6].iov_len  = vlen;
+
+  iovec[7].iov_base = "\r\n";
+  iovec[7].iov_len  = 2;
 
+  if (redis_writev(ctx, iovec, sizeof(iovec)/sizeof(iovec[0])) < 0)
     return -1;
-  }
 
- // printf("connected to ip = %s port = %d, fd = %d\n", ip, port, ctx->sfd);
+  if (redis_read_line(ctx, buf, sizeof(buf)) < 0)
+    return -1;
+
+  if (memcmp(buf, REDIS_OK_STR, REDIS_OK_LEN) != 0)
+    return -1;
 
   return 0;
 }
 
-#define REDIS_MAX_LEN (8192 )
+int redis_set(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen)
+{
+  redis_call(ctx, redis_set_int(ctx, key, klen, val, vlen));
+}
 
-int redis_get(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen)
+static int redis_del_int(redis_ctx_t *ctx, char *key, int klen)
 {
-  int          rc;
-  int          rem;
-  int          len;
-  int          rlen;
-  int          parsed;
   char        *sp;
   char         buf[64];
-  int          to_read;
-  int          copied;
   struct iovec iovec[5];
 
-  //printf("redis_get : key [%.*s] %d\n", klen, key, klen); 
+  //printf("redis_set : key [%.*s] %d [%.*s] %d\n", klen, key, klen, vlen, val, vlen);
 
   iovec[0].iov_base = "*2\r\n";
   iovec[0].iov_len  = strlen(iovec[0].iov_base);
 
-  iovec[1].iov_base = "$3\r\nGET\r\n";  /* GET - 3 char */
+  iovec[1].iov_base = "$3\r\nDEL\r\n";  /* SET - 3 char */
   iovec[1].iov_len  = strlen(iovec[1].iov_base);
 
   sprintf(buf, "$%d\r\n", klen);
   iovec[2].iov_base = buf;
-  iovec[2].iov_len  = strlen(buf);;
+  iovec[2].iov_len  = strlen(buf);
 
   iovec[3].iov_base = key;
   iovec[3].iov_len  = klen;
@@ -110,401 +1038,502 @@ int redis_get(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen)
   iovec[4].iov_base = "\r\n";
   iovec[4].iov_len  = 2;
 
-  if ((rc = writev(ctx->sfd, iovec, sizeof(iovec)/sizeof(iovec[0]))) < 0)
+  if (redis_writev(ctx, iovec, sizeof(iovec)/sizeof(iovec[0])) < 0)
     return -1;
 
-  if ((rlen = read(ctx->sfd, buf, sizeof(buf))) < 0)
+  if (redis_read_line(ctx, buf, sizeof(buf)) < 0)
     return -1;
 
-  //printf("read = [%d] [%s]\n", rlen, buf);
-
-  if ((rc = sscanf(buf, "$%d\r\n%n", &len, &parsed)) != 1)
+  if (buf[0] != ':')                              /* number of keys removed */
     return -1;
 
-  if (len == -1)
-    return -1;
+  return 0;
+}
 
-  to_read  = parsed + len + 2;         /* total amount to read from socket */
-  to_read -= rlen;                                     /* read rlen so far */
+int redis_del(redis_ctx_t *ctx, char *key, int klen)
+{
+  redis_call(ctx, redis_del_int(ctx, key, klen));
+}
 
-  if (1)                                       /* Copy the read one so far */
+/* One UNLINK per REDIS_PIPE_MAX keys, all sent before the replies are read */
+static int redis_unlink_int(redis_ctx_t *ctx, char *keys[], int klens[], 
+                            int n)
+{
+  int          ind;
+  int          cnt;
+  int          base;
+  int          ncmd = 0;
+  int          ret  = 0;
+  char         hdr[64];
+  char         line[64];
+  char         khdr[REDIS_PIPE_MAX][16];
+  struct iovec iovec[REDIS_PIPE_MAX * 3 + 1];
+  struct iovec *iov;
+  for (base = 0; base < n; base += cnt, ncmd++)
   {
-    rem = rlen - parsed;
+    cnt = n - base < REDIS_PIPE_MAX ? n - base : REDIS_PIPE_MAX;
 
-    if (rem > len)                            /* value is smaller than buf */
-      rem = len;
+    sprintf(hdr, "*%d\r\n$6\r\nUNLINK\r\n", cnt + 1);
 
-    if (rem > vlen)
-      rem = vlen;
+    iovec[0].iov_base = hdr;
+    iovec[0].iov_len  = strlen(hdr);
 
-    memcpy(val, &buf[parsed], rem);
-
-    copied = rem;
+    for (ind = 0, iov = &iovec[1]; ind < cnt; ind++, iov += 3)
+    {
+      sprintf(khdr[ind], "$%d\r\n", klens[base + ind]);
 
-    vlen -= rem;
-    val   = (void *)&((char *)val)[rem];
-  }
+      iov[0].iov_base = khdr[ind];
+      iov[0].iov_len  = strlen(khdr[ind]);
 
-  if (vlen && to_read && (len - copied))
-  {
-    rem = len - copied;  /* remaining data to read */
+      iov[1].iov_base = keys[base + ind];
+      iov[1].iov_len  = klens[base + ind];
 
-    if (rem > vlen)
-      rem = vlen;
+      iov[2].iov_base = "\r\n";
+      iov[2].iov_len  = 2;
+    }
 
-    if (read(ctx->sfd, val, rem) != rem)
+    if (redis_writev(ctx, iovec, iov - iovec) < 0)
       return -1;
-
-    copied += rem;
-
-    to_read -= rem;
-    vlen -= rem;
   }
 
-  while (to_read)
+  for (ind = 0; ind < ncmd; ind++)            /* number of keys removed */
   {
-    rc = read(ctx->sfd, buf, sizeof(buf));
-
-    if (rc == -1)
-      break;
-
-    if (rc == 1 && buf[0] == '\n')  /* redis sends only the \n in some cases */
-      break;
+    if (redis_read_line(ctx, line, sizeof(line)) < 0)
+      return -1;
 
-    to_read -= rc;
+    if (line[0] != ':')
+      ret = -1;
   }
 
-  return copied;
+  return ret;
 }
 
-struct redis_buf_t
+/* Remove n keys, their memory is freed by redis in the background */
+int redis_unlink(redis_ctx_t *ctx, char *keys[], int klens[], int n)
 {
-  char   buf[REDIS_KEY_LEN * 2];
-  int    cur;
-  int    rem;
-};
-typedef struct redis_buf_t redis_buf_t;
+  redis_call(ctx, redis_unlink_int(ctx, keys, klens, n));
+}
 
-int redis_buf_consume(redis_buf_t *rbuf, char *buf, int n)
+static int redis_lindex_int(redis_ctx_t *ctx, char *key, int klen, 
+                            long index, void *val, int *vlen)
 {
-  if (rbuf->rem < n)
-    n = rbuf->rem;
+  char         hdr[64];
+  char         num[32];
+  char         mid[64];
+  struct iovec iovec[3];
+  sprintf(num, "%ld", index);
+  sprintf(hdr, "*3\r\n$6\r\nLINDEX\r\n$%d\r\n", klen);
+  sprintf(mid, "\r\n$%d\r\n%s\r\n", (int)strlen(num), num);
 
-  if (n)
-  {
-    memcpy(buf, &rbuf->buf[rbuf->cur], n);
-    rbuf->cur += n;
-    rbuf->rem -= n;
-  }
+  iovec[0].iov_base = hdr;
+  iovec[0].iov_len  = strlen(hdr);
 
-  return n;
-}
+  iovec[1].iov_base = key;
+  iovec[1].iov_len  = klen;
 
-int redis_buf_peek(redis_buf_t *rbuf, char *buf, int n)
-{
-  if (rbuf->rem < n)
-    n = rbuf->rem;
+  iovec[2].iov_base = mid;
+  iovec[2].iov_len  = strlen(mid);
 
-  if (n)
-  {
-    memcpy(buf, &rbuf->buf[rbuf->cur], n);
-  }
+  if (redis_writev(ctx, iovec, 3) < 0)
+    return -1;
+
+  return redis_read_bulk(ctx, val, vlen);
+}
 
-  return n;
+/*
+ * Read element index of the list at key into val, up to *vlen bytes. *vlen
+ * is set to the bytes copied, or -1 past the end or for a missing key.
+ */
+int redis_lindex(redis_ctx_t *ctx, char *key, int klen, 
+                 long index, void *val, int *vlen)
+{
+  redis_call(ctx, redis_lindex_int(ctx, key, klen, index, val, vlen));
 }
 
-int redis_buf_fill(redis_ctx_t *ctx, redis_buf_t *rbuf)
+static int redis_lrem_int(redis_ctx_t *ctx, char *key, int klen, 
+                          void *val, int vlen)
 {
-  int ret;
+  char         hdr[64];
+  char         mid[32];
+  char         line[64];
+  struct iovec iovec[5];
+  sprintf(hdr, "*4\r\n$4\r\nLREM\r\n$%d\r\n", klen);
+  sprintf(mid, "\r\n$1\r\n1\r\n$%d\r\n", vlen);
+
+  iovec[0].iov_base = hdr;
+  iovec[0].iov_len  = strlen(hdr);
+
+  iovec[1].iov_base = key;
+  iovec[1].iov_len  = klen;
+
+  iovec[2].iov_base = mid;
+  iovec[2].iov_len  = strlen(mid);
 
-  if (rbuf->rem)
-    return rbuf->rem;
+  iovec[3].iov_base = val;
+  iovec[3].iov_len  = vlen;
 
-  ret = read(ctx->sfd, rbuf->buf, sizeof(rbuf->buf));
+  iovec[4].iov_base = "\r\n";
+  iovec[4].iov_len  = 2;
 
-  if (ret < 0)
+  if (redis_writev(ctx, iovec, 5) < 0)
     return -1;
 
-  rbuf->cur = 0;
-  rbuf->rem = ret;
+  if (redis_read_line(ctx, line, sizeof(line)) < 0)
+    return -1;
 
-  return ret;
+  return line[0] == ':' ? 0 : -1;
 }
 
-int redis_read_int(redis_ctx_t *ctx, redis_buf_t *rbuf, int *rval)
+/* Remove the first element equal to val from the list at key */
+int redis_lrem(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen)
 {
-  int val = 0;
-  char c;
+  redis_call_once(ctx, redis_lrem_int(ctx, key, klen, val, vlen));
+}
 
-  while (TRUE)
-  {
-    if (redis_buf_fill(ctx, rbuf) < 0) 
-      break;
+static int redis_incrby_int(redis_ctx_t *ctx, char *key, int klen, 
+                            long long incr, long long *val)
+{
+  char         hdr[32];
+  char         num[32];
+  char         line[64];
+  struct iovec iovec[5];
+  sprintf(num, "%lld", incr);
+  sprintf(hdr, "*3\r\n$6\r\nINCRBY\r\n$%d\r\n", klen);
 
-    if (redis_buf_peek(rbuf, &c, 1) != 1)
-      break;
+  iovec[0].iov_base = hdr;
+  iovec[0].iov_len  = strlen(hdr);
 
-    if (c >= '0' && c <= '9')
-    {
-      val = val * 10 + (c - '0');
-      redis_buf_consume(rbuf, &c, 1);  /* discard */
-    }
-    else 
-      break;
-  }
+  iovec[1].iov_base = key;
+  iovec[1].iov_len  = klen;
 
-  *rval = val;
+  sprintf(line, "\r\n$%d\r\n", (int)strlen(num));
+  iovec[2].iov_base = line;
+  iovec[2].iov_len  = strlen(line);
 
-  return val;
-}
+  iovec[3].iov_base = num;
+  iovec[3].iov_len  = strlen(num);
 
-int redis_read_sep(redis_ctx_t *ctx, redis_buf_t *rbuf)
-{
-  int ret = -1;
-  char c[2];
+  iovec[4].iov_base = "\r\n";
+  iovec[4].iov_len  = 2;
 
-  if (redis_buf_fill(ctx, rbuf) < 0) 
+  if (redis_writev(ctx, iovec, 5) < 0)
     return -1;
 
-  if (redis_buf_peek(rbuf, c, 2) != 2)
+  if (redis_read_line(ctx, line, sizeof(line)) < 0)
     return -1;
 
-  ret = (c[0] == '\r' && c[1] == '\n') ? 0 : -1;
+  if (line[0] != ':')
+    return -1;
+
+  *val = atoll(&line[1]);
 
-  redis_buf_consume(rbuf, c, 2); /* discard */
+  return 0;
 }
 
-int redis_read_data(redis_ctx_t *ctx, void *ptr[], size_t size[], int n)
+/* Add incr to the integer at key, *val is the new value */
+int redis_incrby(redis_ctx_t *ctx, char *key, int klen, 
+                 long long incr, long long *val)
 {
-  char  *bp = NULL;
-  char  *ep = NULL;
-  int    rem;
-  int    done = 0;
-  int    nrec = 1;
-  int    crec = 0;
-  void   *tptr;
-  int     tsize;
-  int     tlen;
-  int      len;
-  redis_buf_t rbuf;
-  char buf[512];
-  char  c;
+  redis_call_once(ctx, redis_incrby_int(ctx, key, klen, incr, val));
+}
 
-  rbuf.rem = 0;
+static int redis_rename_int(redis_ctx_t *ctx, char *key, int klen, 
+                            char *nkey, int nklen)
+{
+  char         hdr[32];
+  char         mid[32];
+  char         line[64];
+  struct iovec iovec[5];
+  sprintf(hdr, "*3\r\n$6\r\nRENAME\r\n$%d\r\n", klen);
+  sprintf(mid, "\r\n$%d\r\n", nklen);
 
-  while (nrec)
-  {
-    redis_buf_fill(ctx, &rbuf);
+  iovec[0].iov_base = hdr;
+  iovec[0].iov_len  = strlen(hdr);
 
-    if (redis_buf_consume(&rbuf, &c, 1) == -1)
-      return -1;
+  iovec[1].iov_base = key;
+  iovec[1].iov_len  = klen;
 
-    switch (c)
-    {
-      case '*':
-      {
-        if (redis_read_int(ctx, &rbuf, &nrec) < 0)
-	  return -1;
-        
-	if (redis_read_sep(ctx, &rbuf) < 0)
-	  return -1;
+  iovec[2].iov_base = mid;
+  iovec[2].iov_len  = strlen(mid);
 
-        break;
-      }
-      case '$':
-      {
-        if (redis_read_int(ctx, &rbuf, &len) < 0)
-	  return -1;
+  iovec[3].iov_base = nkey;
+  iovec[3].iov_len  = nklen;
+
+  iovec[4].iov_base = "\r\n";
+  iovec[4].iov_len  = 2;
+
+  if (redis_writev(ctx, iovec, 5) < 0)
+    return -1;
 
-	if (redis_read_sep(ctx, &rbuf) < 0)
-	  return -1;
-        
-	tptr  = ptr[crec];
-	tlen  = len;
+  if (redis_read_line(ctx, line, sizeof(line)) < 0)
+    return -1;
 
-	if (tlen > size[crec])
-	  tlen = size[crec];
+  if (line[0] != '+')                         /* -ERR no such key */
+    return -1;
 
-	size[crec] = tlen;
+  return 0;
+}
 
-	while (tlen)
-	{
-          redis_buf_fill(ctx, &rbuf);
+/* Rename key to nkey, overwriting nkey */
+int redis_rename(redis_ctx_t *ctx, char *key, int klen, char *nkey, int nklen)
+{
+  redis_call_once(ctx, redis_rename_int(ctx, key, klen, nkey, nklen));
+}
 
-	  tsize = redis_buf_consume(&rbuf, (char *)tptr, tlen);
+/*
+ * Cursor based iteration with SCAN, HSCAN or SSCAN. Each batch is one 
+ * round trip that costs the server about count steps, so a walk of the
+ * whole keyspace never holds it up the way KEYS does. The elements of a
+ * batch are kept in scan->buf, each as an int length and its bytes.
+ */
+void redis_scan_init(redis_scan_t *scan, int type, char *key, int klen, 
+                     char *pat, int plen, int count)
+{
+  memset(scan, 0, sizeof(*scan));
 
-	  if (tsize < 0)
-	    return -1;
+  scan->type  = type;
+  scan->key   = key;
+  scan->klen  = klen;
+  scan->pat   = pat;
+  scan->plen  = plen;
+  scan->count = count > 0 ? count : REDIS_SCAN_COUNT;
 
-          tlen -= tsize;
-	  len  -= tsize;
-	}
+  strcpy(scan->cursor, "0");
+}
 
-	tlen = len;
+static int redis_scan_int(redis_ctx_t *ctx, redis_scan_t *scan)
+{
+  int            ind;
+  int            len;
+  int            key = scan->type != REDIS_SCAN;
+  char           hdr[64];
+  char           khdr[16];
+  char           cur[64];
+  char           phdr[32];
+  char           cnt[64];
+  char           num[16];
+  char           cursor[sizeof(scan->cursor)];
+  char          *nbuf;
+  size_t         need;
+  redis_parse_t  p;
+  struct iovec   iovec[9];
+  static char   *cmds[] = { "SCAN", "HSCAN", "SSCAN" };
+
+  sprintf(hdr, "*%d\r\n$%d\r\n%s\r\n", 4 + key + (scan->pat ? 2 : 0), 
+          (int)strlen(cmds[scan->type]), cmds[scan->type]);
+  sprintf(khdr, "$%d\r\n", scan->klen);
+  sprintf(cur, "$%d\r\n%s\r\n", (int)strlen(scan->cursor), scan->cursor);
+  sprintf(phdr, "$5\r\nMATCH\r\n$%d\r\n", scan->plen);
+  sprintf(num, "%d", scan->count);
+  sprintf(cnt, "$5\r\nCOUNT\r\n$%d\r\n%s\r\n", (int)strlen(num), num);
+
+  iovec[0].iov_base = hdr;
+  iovec[0].iov_len  = strlen(hdr);
+
+  iovec[1].iov_base = khdr;                     /* HSCAN and SSCAN only */
+  iovec[1].iov_len  = key ? strlen(khdr) : 0;
+
+  iovec[2].iov_base = scan->key;
+  iovec[2].iov_len  = key ? scan->klen : 0;
+
+  iovec[3].iov_base = "\r\n";
+  iovec[3].iov_len  = key ? 2 : 0;
+
+  iovec[4].iov_base = cur;
+  iovec[4].iov_len  = strlen(cur);
+
+  iovec[5].iov_base = phdr;                              /* MATCH if any */
+  iovec[5].iov_len  = scan->pat ? strlen(phdr) : 0;
+
+  iovec[6].iov_base = scan->pat;
+  iovec[6].iov_len  = scan->pat ? scan->plen : 0;
 
-	while (tlen)
-	{
-          redis_buf_fill(ctx, &rbuf);
+  iovec[7].iov_base = "\r\n";
+  iovec[7].iov_len  = scan->pat ? 2 : 0;
 
-	  tsize = redis_buf_consume(&rbuf, buf, sizeof(buf));
+  iovec[8].iov_base = cnt;
+  iovec[8].iov_len  = strlen(cnt);
 
-	  if (tsize < 0)
-	    return -1;
+  if (redis_writev(ctx, iovec, 9) < 0)
+    return -1;
 
-          tlen -= tsize;
-	  len  -= tsize;
-	}
+  if (redis_read_hdr(ctx, &p) < 0)
+    return -1;
 
-	if (redis_read_sep(ctx, &rbuf) < 0)
-	  return -1;
+  if (p.type == '-')                  /* WRONGTYPE, or no such command */
+    return -1;
 
-        nrec--;
-	crec++;
-        
-	break;
-      }
-    }
-  }
+  if (p.type != '*' || p.num != 2)                 /* [cursor, elements] */
+    return redis_io_error(ctx);
 
-  return crec;
-}
+  len = sizeof(cursor) - 1;
 
-int redis_get_keys(redis_ctx_t *ctx, char *pat, int plen, void *ptr[], size_t size[], int n)
-{
-  int          rc;
-  int          rem;
-  int          len;
-  int          rlen;
-  int          parsed;
-  char        *sp;
-  char         buf[REDIS_KEY_LEN * 2];
-  int          to_read;
-  int          copied;
-  struct iovec iovec[5];
+  if (redis_read_bulk(ctx, cursor, &len) < 0 || len <= 0)
+    return redis_io_error(ctx);
 
-  //printf("redis_get : key [%.*s] %d\n", klen, key, klen); 
+  cursor[len] = 0;
 
-  iovec[0].iov_base = "*2\r\n";
-  iovec[0].iov_len  = strlen(iovec[0].iov_base);
+  if (redis_read_hdr(ctx, &p) < 0)
+    return -1;
 
-  iovec[1].iov_base = "$4\r\nKEYS\r\n";  /* GET - 3 char */
-  iovec[1].iov_len  = strlen(iovec[1].iov_base);
+  if (p.type != '*' && p.type != '~' && p.type != '%')
+    return redis_io_error(ctx);
 
-  sprintf(buf, "$%d\r\n", plen);
-  iovec[2].iov_base = buf;
-  iovec[2].iov_len  = strlen(buf);;
+  scan->blen = 0;
+  scan->bcur = 0;
 
-  iovec[3].iov_base = pat;
-  iovec[3].iov_len  = plen;
+  for (ind = 0; ind < (p.type == '%' ? p.num * 2 : p.num); ind++)
+  {
+    redis_parse_t e;
 
-  iovec[4].iov_base = "\r\n";
-  iovec[4].iov_len  = 2;
+    if (redis_read_hdr(ctx, &e) < 0)
+      return -1;
 
-  if ((rc = writev(ctx->sfd, iovec, sizeof(iovec)/sizeof(iovec[0]))) < 0)
-    return -1;
+    if (e.type != '$' || e.num < 0)
+      return redis_io_error(ctx);
 
-  rc = redis_read_data(ctx, ptr, size, n);
+    need = scan->blen + sizeof(int) + e.num;
 
-  return rc;
-}
+    if (need > scan->bcap)
+    {
+      if ((nbuf = realloc(scan->buf, need * 2)) == NULL)
+        return redis_io_error(ctx);     /* reply is half read, drop it */
 
-int redis_set(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen)
-{
-  int          rc;
-  char        *sp;
-  char         buf[64];
-  char         buf2[64];
-  struct iovec iovec[8];
+      scan->buf  = nbuf;
+      scan->bcap = need * 2;
+    }
 
-  //printf("redis_set : key [%.*s] %d [%.*s] %d\n", klen, key, klen, vlen, val, vlen);
+    len = e.num;
 
-  iovec[0].iov_base = "*3\r\n";
-  iovec[0].iov_len  = strlen(iovec[0].iov_base);
+    memcpy(&scan->buf[scan->blen], &len, sizeof(int));
 
-  iovec[1].iov_base = "$3\r\nSET\r\n";  /* SET - 3 char */
-  iovec[1].iov_len  = strlen(iovec[1].iov_base);
+    if (redis_read_payload(ctx, &scan->buf[scan->blen + sizeof(int)], 
+                           len, len) < 0)
+      return -1;
 
-  sprintf(buf, "$%d\r\n", klen);
-  iovec[2].iov_base = buf;
-  iovec[2].iov_len  = strlen(buf);
+    scan->blen = need;
+  }
 
-  iovec[3].iov_base = key;
-  iovec[3].iov_len  = klen;
+  strcpy(scan->cursor, cursor);      /* only once the batch is all read */
 
-  iovec[4].iov_base = "\r\n";
-  iovec[4].iov_len  = 2;
+  scan->done = strcmp(cursor, "0") == 0;
 
-  sprintf(buf2, "$%d\r\n", vlen);
-  iovec[5].iov_base = buf2;
-  iovec[5].iov_len  = strlen(buf2);
+  return 0;
+}
 
-  iovec[6].iov_base = val;
-  iovec[6].iov_len  = vlen;
+static int redis_scan_batch(redis_ctx_t *ctx, redis_scan_t *scan)
+{
+  redis_call(ctx, redis_scan_int(ctx, scan));
+}
 
-  iovec[7].iov_base = "\r\n";
-  iovec[7].iov_len  = 2;
+/*
+ * Return the next element in *elem and *len, valid until the following
+ * call. Returns 1, 0 once the iteration is complete, or -1. HSCAN gives
+ * fields and values in turn. As with SCAN, an element may come up twice.
+ */
+int redis_scan_next(redis_ctx_t *ctx, redis_scan_t *scan, 
+                    char **elem, int *len)
+{
+  while (scan->bcur == scan->blen)
+  {
+    if (scan->done)
+      return 0;
 
-  if ((rc = writev(ctx->sfd, iovec, sizeof(iovec)/sizeof(iovec[0]))) < 0)
-    return rc;
+    if (redis_scan_batch(ctx, scan) < 0)
+    {
+      scan->blen = 0;
+      scan->bcur = 0;
+      return -1;
+    }
+  }
 
-  if ((rc = read(ctx->sfd, buf, sizeof(buf))) < 0)
-    return 0;
+  memcpy(len, &scan->buf[scan->bcur], sizeof(int));
 
-  if (memcmp(buf, REDIS_OK_STR, REDIS_OK_LEN) != 0)
-    return -1;
+  *elem       = &scan->buf[scan->bcur + sizeof(int)];
+  scan->bcur += sizeof(int) + *len;
 
-  return 0;
+  return 1;
 }
 
-int redis_del(redis_ctx_t *ctx, char *key, int klen)
+void redis_scan_free(redis_scan_t *scan)
 {
-  int          rc;
-  char        *sp;
-  char         buf[64];
-  struct iovec iovec[5];
+  free(scan->buf);
 
-  //printf("redis_set : key [%.*s] %d [%.*s] %d\n", klen, key, klen, vlen, val, vlen);
+  scan->buf  = NULL;
+  scan->bcap = 0;
+  scan->blen = 0;
+  scan->bcur = 0;
+}
 
-  iovec[0].iov_base = "*2\r\n";
-  iovec[0].iov_len  = strlen(iovec[0].iov_base);
+int redis_close(redis_ctx_t *ctx)
+{
+  int ret = 0;
 
-  iovec[1].iov_base = "$3\r\nDEL\r\n";  /* SET - 3 char */
-  iovec[1].iov_len  = strlen(iovec[1].iov_base);
+  if (ctx->sfd >= 0)
+    ret = close(ctx->sfd);
 
-  sprintf(buf, "$%d\r\n", klen);
-  iovec[2].iov_base = buf;
-  iovec[2].iov_len  = strlen(buf);
+  ctx->sfd = -1;
 
-  iovec[3].iov_base = key;
-  iovec[3].iov_len  = klen;
+  return ret;
+}
 
-  iovec[4].iov_base = "\r\n";
-  iovec[4].iov_len  = 2;
+int redis_pool_init(redis_pool_t *pool, char *ip, int port, int size)
+{
+  int ind;
 
-  if ((rc = writev(ctx->sfd, iovec, sizeof(iovec)/sizeof(iovec[0]))) < 0)
-    return rc;
+  if (size <= 0)
+    size = REDIS_POOL_DEFAULT_SIZE;
 
-  if ((rc = read(ctx->sfd, buf, sizeof(buf))) < 0)
-    return 0;
+  pool->ctx = calloc(size, sizeof(redis_ctx_t));
 
-  if (memcmp(buf, REDIS_OK_STR, REDIS_OK_LEN) != 0)
+  if (pool->ctx == NULL)
     return -1;
 
+  for (ind = 0; ind < size; ind++)          /* connected lazily on first use */
+    redis_ctx_init(&pool->ctx[ind], ip, port);
+
+  pool->size = size;
+  pool->next = 0;
+
   return 0;
 }
 
-int redis_close(redis_ctx_t *ctx)
+static __thread redis_pool_t *redis_pool_owner;
+static __thread redis_ctx_t  *redis_pool_tctx;
+
+/*
+ * Return the context bound to the calling thread. Threads are spread over
+ * the pool round robin the first time they ask; with more threads than 
+ * contexts a context is shared and its commands serialize on its lock.
+ * A binding is dropped when the pool was closed and opened again.
+ */
+redis_ctx_t *redis_pool_get(redis_pool_t *pool)
 {
-  int ret;
+  int ind;
 
-  ret = close(ctx->sfd);
+  if (redis_pool_owner != pool || 
+      redis_pool_tctx < pool->ctx || redis_pool_tctx >= pool->ctx + pool->size)
+  {
+    ind = __sync_fetch_and_add(&pool->next, 1) % pool->size;
 
-  if (ret < 0)
-    ret;
+    redis_pool_tctx  = &pool->ctx[ind];
+    redis_pool_owner = pool;
+  }
 
-  ctx->sfd = -1;
+  return redis_pool_tctx;
+}
 
-  return ret;
+void redis_pool_close(redis_pool_t *pool)
+{
+  int ind;
+
+  for (ind = 0; ind < pool->size; ind++)
+    redis_close(&pool->ctx[ind]);
+
+  free(pool->ctx);
+
+  pool->ctx  = NULL;
+  pool->size = 0;
 }
 
 #ifdef TEST
@@ -558,30 +1587,22 @@ int main()
 
   redis_close(&ctx);
 }
-int key_test()
+int key_test(redis_ctx_t *ctx)
   {
-    void  *tdata[16];
-    size_t tsize[16];
-    char *pat = "/[^/]*@fobj";
-    char   tbuf[16][512];
-    int ind;
-
-    for (ind = 0; ind < 16; ind++)
-    {
-      tdata[ind] = tbuf[ind];
-      tsize[ind] = 512;
-    }
+    char        *pat = "/[^/]*@fobj";
+    char        *key;
+    int          klen;
+    int          ind = 0;
+    redis_scan_t scan;
 
-  // redis_get(&redis_ctx, "key_1_12_abcd", strlen("key_1_12_abcd"), data, sizeof(data));
-    ret = redis_get_keys(&redis_ctx, pat, strlen(pat), tdata, tsize, 16);
+    redis_scan_init(&scan, REDIS_SCAN, NULL, 0, pat, strlen(pat), 0);
 
-    printf("Read keys = %d\n", ret);
+    while (redis_scan_next(ctx, &scan, &key, &klen) > 0)
+      printf("key[%d] : [%.*s]\n", ind++, klen, key);
 
-    for (ind = 0; ind < ret; ind++)
-    {
-      printf("key[%d] : [%s]\n", ind, (char *)tdata[ind]);
-    }
+    printf("Read keys = %d\n", ind);
 
+    redis_scan_free(&scan);
   }
 #endif
 
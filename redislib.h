@@ -17,24 +17,140 @@
  */
 #ifndef _REDISLIB_H
 
+#include <pthread.h>
+#include <sys/uio.h>
+
 #define REDIS_SERVER_DEFAULT_IP    "127.0.0.1"
 #define REDIS_SERVER_DEFAULT_PORT  6379
+#define REDIS_POOL_DEFAULT_SIZE    8
+#define REDIS_KEEPALIVE_DEFAULT    60             /* idle seconds, 0 is off */
 
 #define _REDISLIB_H
 
 #define REDIS_KEY_LEN (512)
 
+#define REDIS_PUT_SET      (-1)                      /* redis_mput voffs[] */
+#define REDIS_PUT_APPEND   (-2)
+#define REDIS_PUT_RPUSH    (-3)
+
+#define REDIS_RBUF_SIZE    (64 * 1024)          /* reply buffer per context */
+
 struct redis_ctx_t
 {
-  int sfd;
+  int              sfd;
+  int              err;               /* I/O failed, reconnect on next use */
+  int              sent;            /* the current command reached the wire */
+  char             ip[108];            /* address, host or socket path */
+  int              port;
+  pthread_mutex_t  lock;
+  int              rcur;                        /* next unparsed reply byte */
+  int              rlen;
+  char             rbuf[REDIS_RBUF_SIZE];
 };
 typedef struct redis_ctx_t redis_ctx_t;
 
+#define REDIS_PARSE_TYPE   (0)                         /* redis_parse_t state */
+#define REDIS_PARSE_LINE   (1)
+#define REDIS_PARSE_LF     (2)
+#define REDIS_PARSE_DONE   (3)
+
+/*
+ * Reply header parser, RESP2 and RESP3. It may be fed the header a few 
+ * bytes at a time; payloads of bulk replies and the elements of aggregates
+ * are not part of the header.
+ */
+struct redis_parse_t
+{
+  int              state;
+  char             type;                    /* '+', '$', '*', '%', '_', ... */
+  int              neg;
+  long long        num;     /* integer, bulk length or count, -1 for nil */
+  int              len;
+  char             line[64];            /* header text after the type byte */
+};
+typedef struct redis_parse_t redis_parse_t;
+
+#define REDIS_SCAN         (0)                         /* redis_scan_t type */
+#define REDIS_HSCAN        (1)
+#define REDIS_SSCAN        (2)
+
+#define REDIS_SCAN_COUNT   (512)                 /* default COUNT per batch */
+
+/* SCAN, HSCAN or SSCAN iteration, see redis_scan_next */
+struct redis_scan_t
+{
+  int              type;
+  char            *key;                        /* hash or set, not copied */
+  int              klen;
+  char            *pat;             /* MATCH pattern or NULL, not copied */
+  int              plen;
+  int              count;
+  int              done;                  /* server returned cursor 0 */
+  char             cursor[32];
+  char            *buf;                      /* elements of the last batch */
+  size_t           bcap;
+  size_t           blen;
+  size_t           bcur;
+};
+typedef struct redis_scan_t redis_scan_t;
+
+/* Socket tuning applied to every new connection, see redis_tune */
+struct redis_tune_t
+{
+  int              nodelay;                        /* TCP_NODELAY, TCP only */
+  int              keepalive;        /* idle seconds before probes, 0 off */
+  int              sndbuf;               /* SO_SNDBUF, 0 for the default */
+  int              rcvbuf;                                   /* SO_RCVBUF */
+};
+typedef struct redis_tune_t redis_tune_t;
+
+extern redis_tune_t redis_tune;
+
+/* Connection pool, one context per worker thread */
+struct redis_pool_t
+{
+  int              size;
+  int              next;                        /* next context to hand out */
+  redis_ctx_t     *ctx;
+};
+typedef struct redis_pool_t redis_pool_t;
+
 int redis_connect(redis_ctx_t *ctx, char *ip, int port);
+int redis_attach(redis_ctx_t *ctx, int sfd);
 int redis_get(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen);
 int redis_set(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen);
-int redis_keys(redis_ctx_t *ctx, char *pat, int plen, char *keys[REDIS_KEY_LEN], int nkeys);
+int redis_mget(redis_ctx_t *ctx, char *keys[], int klens[], 
+               void *vals[], int vlens[], int n);
+int redis_mset(redis_ctx_t *ctx, char *keys[], int klens[], 
+               void *vals[], int vlens[], int n);
+int redis_mput(redis_ctx_t *ctx, char *keys[], int klens[], 
+               void *vals[], int vlens[], long voffs[], int n, 
+               char *bkeys[], int bklens[], size_t boffs[], int bvals[], 
+               int nb);
+int redis_getrange(redis_ctx_t *ctx, char *key, int klen, 
+                   long start, void *val, int *vlen);
 int redis_del(redis_ctx_t *ctx, char *key, int klen);
+int redis_unlink(redis_ctx_t *ctx, char *keys[], int klens[], int n);
+int redis_lindex(redis_ctx_t *ctx, char *key, int klen, 
+                 long index, void *val, int *vlen);
+int redis_lrem(redis_ctx_t *ctx, char *key, int klen, void *val, int vlen);
+int redis_incrby(redis_ctx_t *ctx, char *key, int klen, 
+                 long long incr, long long *val);
+int redis_rename(redis_ctx_t *ctx, char *key, int klen, char *nkey, int nklen);
 int redis_close(redis_ctx_t *ctx);
 
+void redis_scan_init(redis_scan_t *scan, int type, char *key, int klen, 
+                     char *pat, int plen, int count);
+int  redis_scan_next(redis_ctx_t *ctx, redis_scan_t *scan, 
+                     char **elem, int *len);
+void redis_scan_free(redis_scan_t *scan);
+int redis_writev(redis_ctx_t *ctx, struct iovec *iov, int iovcnt);
+
+void redis_parse_init(redis_parse_t *p);
+int  redis_parse(redis_parse_t *p, char *bp, int avail);
+
+int redis_pool_init(redis_pool_t *pool, char *ip, int port, int size);
+redis_ctx_t *redis_pool_get(redis_pool_t *pool);
+void redis_pool_close(redis_pool_t *pool);
+
 #endif /* redislib.h */
@@ -27,18 +27,28 @@
 #include <dirent.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <sys/statfs.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <redislib.h>
+#include <tengine.h>
 #include <ytrace.h>
 
 #define TANTO_PATH_MAXLEN (512)
 #define TANTO_KEY_MAXLEN  (512)
 #define TANTO_NAME_MAX    (256)
-#define TANTO_BLOCK_SIZE  (4 * 1024)
+#define TANTO_BLOCK_SIZE  (4 * 1024)         /* default, and minimum size */
+#define TANTO_BLOCK_MAX   (4 * 1024 * 1024)
+#define TANTO_BATCH_MAX   (32)            /* blocks per pipelined request */
+
+/* Data block size of the mounted filesystem, see tanto_init */
+#define tanto_bsize() (tanto_ctx.bsize)
 
 #define tanto_block_align(size) \
-        ( ((size) + (TANTO_BLOCK_SIZE - 1)) & ~(TANTO_BLOCK_SIZE - 1))
+        ( ((size) + (tanto_bsize() - 1)) & ~(tanto_bsize() - 1))
 
 /* File object in backend */
 struct tanto_fobj_t
@@ -48,14 +58,27 @@ struct tanto_fobj_t
   uid_t     uid;
   gid_t     gid;
   int32_t   nblocks;
-  int32_t   bsize;
+  int32_t   bsize;  /* data block size, set in the root object only */
   int64_t   actime; /* last access */
   int64_t   modtime; /* last modification */
   int64_t   ctime;  /* creation time */
+  uint32_t  flags;  /* TANTO_FOBJ_xxx, zero in objects from older versions */
+  uint32_t  nlink;  /* directory entries naming the object, 0 reads as 1 */
+  uint32_t  ilen;   /* inline data bytes, see TANTO_FOBJ_INLINE */
+  uint64_t  size;   /* file bytes, see TANTO_FOBJ_SIZE */
+  uint32_t  tblocks; /* blocks from nblocks up to here may await reclaim */
 };
 typedef struct tanto_fobj_t tanto_fobj_t;
 
-/* Directory object in directory file data */
+#define TANTO_FOBJ_HASHDIR  (0x1)          /* directory is a hashed table */
+#define TANTO_FOBJ_PACKDIR  (0x2)        /* with packed tanto_dirent_t buckets */
+#define TANTO_FOBJ_INLINE   (0x4)     /* data follows the object, no blocks */
+#define TANTO_FOBJ_AMAP     (0x8)   /* stored blocks recorded, see tanto_amap */
+#define TANTO_FOBJ_SIZE     (0x10)     /* size kept, else nblocks full blocks */
+
+#define TANTO_INLINE_MAX    (1024)          /* max inline_max, idata bytes */
+
+/* Fixed size directory entry, older directory layouts */
 struct tanto_dobj_t
 {
   uint32_t  seqno;
@@ -64,33 +87,343 @@ struct tanto_dobj_t
 };
 typedef struct tanto_dobj_t tanto_dobj_t;
 
+/* Directory bucket header, followed by count packed entries */
+struct tanto_dirblk_t
+{
+  uint8_t   magic;
+  uint8_t   version;
+  uint16_t  count;
+} __attribute__((packed));
+typedef struct tanto_dirblk_t tanto_dirblk_t;
+
+#define TANTO_DIRBLK_MAGIC   (0xd1)
+#define TANTO_DIRBLK_VERSION (1)
+
+/* Packed directory entry, name is namel bytes without the NUL */
+struct tanto_dirent_t
+{
+  uint64_t  ino;
+  uint8_t   type;                                                /* DT_xxx */
+  uint8_t   namel;
+  char      name[];
+} __attribute__((packed));
+typedef struct tanto_dirent_t tanto_dirent_t;
+
+#define tanto_dirent_size(de) (sizeof(tanto_dirent_t) + (de)->namel)
+
 /* Runtime file handle */
 struct tanto_file_t
 {
   char          path[TANTO_PATH_MAXLEN];
+  uint64_t      ino;
+  uint32_t      gen;                    /* path_gen when path was resolved */
   char          key[TANTO_KEY_MAXLEN];
   int           keyl;
   tanto_fobj_t  fobj;
+  int           iload;              /* idata read along with fobj */
+  char          idata[TANTO_INLINE_MAX];
 };
 typedef struct tanto_file_t tanto_file_t;
 
-#define TANTO_BLOCK_DIR_MAX (TANTO_BLOCK_SIZE / sizeof(tanto_dobj_t))
+#define TANTO_WBUF_BLOCKS (32)        /* default dirty blocks per open file */
+#define TANTO_WBUF_MAX    (8 * 1024 * 1024)      /* bytes per open file */
+
+/* Dirty block buffered in an open file */
+struct tanto_wblk_t
+{
+  size_t  blk;
+  size_t  lo;                                  /* dirty bytes [lo, hi) */
+  size_t  hi;
+  char   *data;                                 /* tanto_bsize() bytes */
+};
+typedef struct tanto_wblk_t tanto_wblk_t;
+
+/* Open file handle, kept in fuse_file_info fh */
+struct tanto_fh_t
+{
+  pthread_mutex_t     lock;
+  tanto_file_t        file;
+  int                 ndirty;
+  int                 maxdirty;
+  size_t              size;          /* end of buffered writes, 0 if none */
+  tanto_wblk_t       *dirty;                         /* maxdirty entries */
+  struct tanto_fh_t  *prev;                           /* open handles */
+  struct tanto_fh_t  *next;
+};
+typedef struct tanto_fh_t tanto_fh_t;
+
+#define TANTO_DIR_BUCKET_MAX (64)              /* old hashed layout entries */
+#define TANTO_DIR_SPLIT      (TANTO_BLOCK_SIZE)  /* split at bytes / bucket */
+#define TANTO_DIR_BUCKET_SIZE (4 * TANTO_BLOCK_SIZE)
 
-#define tanto_stat_key(key, path) \
+/*
+ * Objects are keyed by inode number : "f:<ino>" holds the tanto_fobj_t,
+ * "d:<ino>:<blk>" file data and "e:<ino>:<n>" directory buckets, all in
+ * hex. Directories map names to inode numbers, so a rename only moves one
+ * directory entry whatever lies below it.
+ */
+#define TANTO_INO_ROOT    (1)
+#define TANTO_INO_KEY     "tanto@ino"          /* last reserved, less root */
+#define TANTO_INO_BATCH   (1024)          /* default inode numbers per range */
+
+/*
+ * Blocks of removed and truncated files are deleted in the background. A
+ * tanto_reclaim_t per range is pushed on the TANTO_RECLAIM_KEY list with the
+ * object update, and only taken off once its blocks are gone.
+ */
+#define TANTO_RECLAIM_KEY   "tanto@reclaim"
+#define TANTO_RECLAIM_BATCH (512)                /* keys per UNLINK round */
+#define TANTO_RECLAIM_WAIT  (1)              /* seconds between queue polls */
+
+#define TANTO_RECLAIM_DEL   (0x1)             /* object removed, all of it */
+#define TANTO_RECLAIM_DIR   (0x2)                /* directory bucket keys */
+#define TANTO_RECLAIM_AMAP  (0x4)                  /* with allocation bits */
+
+struct tanto_reclaim_t
+{
+  uint64_t  ino;
+  uint32_t  from;                                    /* blocks [from, to) */
+  uint32_t  to;
+  uint32_t  flags;                                    /* TANTO_RECLAIM_xxx */
+  uint32_t  pad;
+};
+typedef struct tanto_reclaim_t tanto_reclaim_t;
+
+#define tanto_stat_key(key, ino) \
+        sprintf(key, "f:%llx", (unsigned long long)(ino))
+
+#define tanto_data_key(key, ino, ind) \
+        sprintf(key, "d:%llx:%llx", (unsigned long long)(ino), \
+                (unsigned long long)(ind))
+
+#define tanto_amap_key(key, ino, ind) \
+        sprintf(key, "m:%llx:%llx", (unsigned long long)(ino), \
+                (unsigned long long)(ind))
+
+#define tanto_dir_key(key, ino, ind) \
+        sprintf(key, "e:%llx:%llx", (unsigned long long)(ino), \
+                (unsigned long long)(ind))
+
+/* Path keyed layout of older versions, see tanto_convert */
+#define tanto_old_stat_key(key, path) \
         sprintf(key, "%s@fobj", path)
 
-#define tanto_data_key(key, path, ind) \
+#define tanto_old_data_key(key, path, ind) \
         sprintf(key, "%s@data::%lld", path, (signed long long)ind)
 
+#define tanto_old_hdir_key(key, path, ind) \
+        sprintf(key, "%s@dir::%lld", path, (signed long long)ind)
+
+#define tanto_old_dent_key(key, path, ind) \
+        sprintf(key, "%s@dent::%lld", path, (signed long long)ind)
+
+#define TANTO_LOCK_STRIPES (64)
+
+#define TANTO_ACACHE_SHARDS   (16)
+#define TANTO_ACACHE_BUCKETS  (1024)                          /* per shard */
+#define TANTO_ACACHE_TTL      (1000)                        /* default, ms */
+#define TANTO_NCACHE_TTL      (1000)               /* negative entries, ms */
+#define TANTO_ACACHE_SIZE     (64 * 1024)                  /* max entries */
+
+/* Attribute cache entry, a copy of the backend file object */
+struct tanto_acache_ent_t
+{
+  char                       *path;
+  uint32_t                    hash;
+  uint32_t                    gen;                             /* path_gen */
+  size_t                      expire;                    /* ytime_get() us */
+  int                         neg;              /* known not to exist */
+  uint64_t                    ino;
+  tanto_fobj_t                fobj;
+  struct tanto_acache_ent_t  *next;
+};
+typedef struct tanto_acache_ent_t tanto_acache_ent_t;
+
+struct tanto_acache_shard_t
+{
+  pthread_mutex_t      lock;
+  int                  count;
+  int                  hand;                   /* next bucket to evict */
+  tanto_acache_ent_t  *buckets[TANTO_ACACHE_BUCKETS];
+};
+typedef struct tanto_acache_shard_t tanto_acache_shard_t;
+
+#define TANTO_BCACHE_SHARDS   (16)
+#define TANTO_BCACHE_BUCKETS  (4096)                          /* per shard */
+#define TANTO_BCACHE_SIZE     (64)                        /* default, MiB */
+
+/* Block cache entry, one data block of a file */
+struct tanto_bcache_ent_t
+{
+  uint64_t                    ino;
+  size_t                      blk;
+  uint32_t                    hash;
+  struct tanto_bcache_ent_t  *hnext;                        /* hash chain */
+  struct tanto_bcache_ent_t  *prev;                                /* LRU */
+  struct tanto_bcache_ent_t  *next;
+  char                       *data;        /* tanto_bsize(), follows */
+};
+typedef struct tanto_bcache_ent_t tanto_bcache_ent_t;
+
+struct tanto_bcache_shard_t
+{
+  pthread_mutex_t      lock;
+  int                  count;
+  tanto_bcache_ent_t   lru;            /* list head, most recent first */
+  tanto_bcache_ent_t  *buckets[TANTO_BCACHE_BUCKETS];
+};
+typedef struct tanto_bcache_shard_t tanto_bcache_shard_t;
+
+#define TANTO_AMAP_BYTES      (4096)                    /* bitmap per key */
+#define TANTO_AMAP_BITS       (TANTO_AMAP_BYTES * 8)
+#define TANTO_AMAP_SHARDS     (16)
+#define TANTO_AMAP_BUCKETS    (64)                            /* per shard */
+#define TANTO_AMAP_SIZE       (16)                /* entries per shard */
+
+/* Allocation bitmap of TANTO_AMAP_BITS blocks of a file */
+struct tanto_amap_ent_t
+{
+  uint64_t                  ino;
+  size_t                    ind;                         /* bitmap number */
+  uint32_t                  hash;
+  size_t                    expire;                    /* ytime_get() us */
+  struct tanto_amap_ent_t  *next;
+  uint8_t                   bits[TANTO_AMAP_BYTES];
+};
+typedef struct tanto_amap_ent_t tanto_amap_ent_t;
+
+struct tanto_amap_shard_t
+{
+  pthread_mutex_t    lock;
+  int                count;
+  int                hand;                     /* next bucket to evict */
+  tanto_amap_ent_t  *buckets[TANTO_AMAP_BUCKETS];
+};
+typedef struct tanto_amap_shard_t tanto_amap_shard_t;
+
+/* Runtime counters, see tanto_getxattr */
+struct tanto_stats_t
+{
+  uint64_t  acache_hits;
+  uint64_t  acache_misses;
+  uint64_t  ncache_hits;                            /* ENOENT from cache */
+  uint64_t  bcache_hits;
+  uint64_t  bcache_misses;
+  uint64_t  wbuf_writes;                       /* writes absorbed in wbuf */
+  uint64_t  wbuf_flushes;
+  uint64_t  ino_ranges;                 /* inode ranges reserved (INCRBY) */
+  uint64_t  amap_holes;              /* blocks read as holes, no backend */
+  uint64_t  zero_blocks;                 /* zero blocks written, not stored */
+  uint64_t  range_reads;                      /* partial block GETRANGEs */
+  uint64_t  range_writes;                     /* partial block SETRANGEs */
+  uint64_t  reclaim_blocks;              /* deleted by the reclaimer thread */
+};
+typedef struct tanto_stats_t tanto_stats_t;
+
+#define tanto_stats_inc(field) \
+        __sync_fetch_and_add(&tanto_ctx.stats.field, 1)
+
+#define TANTO_STATS_XATTR "user.tanto.stats"
+
 struct tanto_ctx_t
 {
-  redis_ctx_t redis_ctx;
+  tengine_t             engine;                    /* storage backend */
+  pthread_mutex_t       locks[TANTO_LOCK_STRIPES];   /* ino striped locks */
+  tanto_acache_shard_t  acache[TANTO_ACACHE_SHARDS];
+  uint32_t              create_gen;          /* bumped by every create */
+  volatile uint32_t     path_gen;       /* bumped when names are moved */
+  tanto_bcache_shard_t  bcache[TANTO_BCACHE_SHARDS];
+  volatile uint32_t     bcache_gen;   /* bumped by every block update */
+  int                   bcache_max;                /* entries per shard */
+  size_t                bsize;           /* data block size, root fobj */
+  tanto_amap_shard_t    amap[TANTO_AMAP_SHARDS];
+  volatile uint32_t     amap_gen;          /* bumped by every bit update */
+  pthread_mutex_t       fh_lock;
+  tanto_fh_t            fh_list;             /* open handles, list head */
+  pthread_t             reclaim_thread;
+  pthread_mutex_t       reclaim_lock;
+  pthread_cond_t        reclaim_cond;      /* signalled on queue or stop */
+  int                   reclaim_run;             /* thread started */
+  int                   reclaim_stop;
+  tanto_stats_t         stats;
 };
 typedef struct tanto_ctx_t tanto_ctx_t;
 
-__thread tanto_ctx_t tanto_ctx;
+tanto_ctx_t tanto_ctx;
+
+#define tanto_engine() (&tanto_ctx.engine)
+
+/* Mount options (-o name=value) */
+struct tanto_opt_t
+{
+  int  pool_size;                            /* redis connections in pool */
+  int  acache_ttl;                /* attribute cache ttl in ms, 0 disables */
+  int  acache_size;                      /* attribute cache max entries */
+  int  ncache_ttl;                 /* negative entry ttl in ms, 0 disables */
+  int  bcache_size;                  /* block cache size in MiB, 0 disables */
+  int  wbuf_blocks;          /* dirty blocks buffered per open file, 0 off */
+  int  ino_batch;            /* inode numbers reserved per backend call */
+  int  block_size;           /* data block size for a new filesystem */
+  int  inline_max;           /* largest file kept inline in bytes, 0 off */
+  char *redis_host;           /* address, host name or unix socket path */
+  int  redis_port;
+  int  tcp_nodelay;
+  int  tcp_keepalive;        /* idle seconds before probes, 0 off */
+  int  sock_sndbuf;          /* socket buffer sizes, 0 system default */
+  int  sock_rcvbuf;
+  char *engine;        /* redis (default), mem, log or sqlite */
+  char *path;                 /* log directory or sqlite database file */
+  int  sync_ms;              /* log flush interval in ms, 0 every write */
+};
+typedef struct tanto_opt_t tanto_opt_t;
+
+static tanto_opt_t tanto_opt = 
+{
+  REDIS_POOL_DEFAULT_SIZE,
+  TANTO_ACACHE_TTL,
+  TANTO_ACACHE_SIZE,
+  TANTO_NCACHE_TTL,
+  TANTO_BCACHE_SIZE,
+  TANTO_WBUF_BLOCKS,
+  TANTO_INO_BATCH,
+  TANTO_BLOCK_SIZE,
+  TANTO_INLINE_MAX,
+  NULL,
+  REDIS_SERVER_DEFAULT_PORT,
+  1,
+  REDIS_KEEPALIVE_DEFAULT,
+  0,
+  0,
+  NULL,
+  NULL,
+  TENGINE_SYNC_MS
+};
 
-#define tanto_redis_ctx() (&tanto_ctx.redis_ctx)
+#define TANTO_OPT(templ, field) \
+        { templ, offsetof(tanto_opt_t, field), 0 }
+
+static struct fuse_opt tanto_opts[] = 
+{
+  TANTO_OPT("pool_size=%d", pool_size),
+  TANTO_OPT("acache_ttl=%d", acache_ttl),
+  TANTO_OPT("acache_size=%d", acache_size),
+  TANTO_OPT("ncache_ttl=%d", ncache_ttl),
+  TANTO_OPT("bcache_size=%d", bcache_size),
+  TANTO_OPT("wbuf_blocks=%d", wbuf_blocks),
+  TANTO_OPT("block_size=%d", block_size),
+  TANTO_OPT("ino_batch=%d", ino_batch),
+  TANTO_OPT("inline_max=%d", inline_max),
+  TANTO_OPT("redis_host=%s", redis_host),
+  TANTO_OPT("redis_port=%d", redis_port),
+  TANTO_OPT("tcp_nodelay=%d", tcp_nodelay),
+  TANTO_OPT("tcp_keepalive=%d", tcp_keepalive),
+  TANTO_OPT("sock_sndbuf=%d", sock_sndbuf),
+  TANTO_OPT("sock_rcvbuf=%d", sock_rcvbuf),
+  TANTO_OPT("engine=%s", engine),
+  TANTO_OPT("path=%s", path),
+  TANTO_OPT("sync_ms=%d", sync_ms),
+  FUSE_OPT_END
+};
 
 #define tanto_ns2timespec(ts, t)\
         do \
@@ -100,368 +433,3094 @@ __thread tanto_ctx_t tanto_ctx;
 	} \
 	while (0)
 
-static int tanto_add_obj(const char *path, mode_t mode, uid_t uid, gid_t gid)
+static uint32_t tanto_hash(const char *str)
 {
-  tanto_fobj_t fobj;
-  char         key[TANTO_KEY_MAXLEN];
-  int          keyl;
-  size_t       cur_us = ytime_get();
-  
-  memset(&fobj, 0, sizeof(&fobj));
+  uint32_t hash = 2166136261u;                                 /* FNV-1a */
+
+  while (*str)
+  {
+    hash ^= (unsigned char)*str++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static uint32_t tanto_ino_hash(uint64_t ino)
+{
+  return (uint32_t)(ino ^ (ino >> 32)) * 2654435761u;
+}
+
+/*
+ * Serialize read-modify-write updates of an object (file size, directory
+ * blocks) between FUSE worker threads.
+ */
+static pthread_mutex_t *tanto_lock(uint64_t ino)
+{
+  pthread_mutex_t *lock;
+
+  lock = &tanto_ctx.locks[tanto_ino_hash(ino) % TANTO_LOCK_STRIPES];
+
+  pthread_mutex_lock(lock);
+
+  return lock;
+}
+
+static void tanto_unlock(pthread_mutex_t *lock)
+{
+  pthread_mutex_unlock(lock);
+}
+
+/* Lock two objects in stripe order, *lock2 is NULL when they share one */
+static void tanto_lock2(uint64_t ino1, uint64_t ino2, 
+                        pthread_mutex_t **lock1, pthread_mutex_t **lock2)
+{
+  uint32_t s1 = tanto_ino_hash(ino1) % TANTO_LOCK_STRIPES;
+  uint32_t s2 = tanto_ino_hash(ino2) % TANTO_LOCK_STRIPES;
+
+  *lock1 = &tanto_ctx.locks[s1 < s2 ? s1 : s2];
+  *lock2 = s1 == s2 ? NULL : &tanto_ctx.locks[s1 < s2 ? s2 : s1];
+
+  pthread_mutex_lock(*lock1);
+
+  if (*lock2)
+    pthread_mutex_lock(*lock2);
+}
+
+static void tanto_unlock2(pthread_mutex_t *lock1, pthread_mutex_t *lock2)
+{
+  if (lock2)
+    pthread_mutex_unlock(lock2);
+
+  pthread_mutex_unlock(lock1);
+}
+
+/*---------------------------------------------------------------------------*
+ *                           ATTRIBUTE CACHE                                 *
+ *---------------------------------------------------------------------------*/
+
+/*
+ * In-process cache of path lookups : the inode number and file object a
+ * path resolved to, so getattr/open/read of a hot file neither walk the
+ * directories nor GET its object every time. Entries expire after 
+ * acache_ttl ms (other clients may change the object) and are written
+ * through by tanto_file_sync.
+ *
+ * Lookups that found nothing are cached too, as negative entries living 
+ * ncache_ttl ms, so repeated probes of missing paths stay local. Creating 
+ * a path in its parent directory replaces its negative entry.
+ *
+ * Entries carry the path_gen they were resolved under. A rename, or a link
+ * count change of a file known under several names, bumps path_gen and so
+ * retires every entry at once.
+ */
+
+static void tanto_path_gen_bump(void)
+{
+  __sync_fetch_and_add(&tanto_ctx.path_gen, 1);
+}
+
+static tanto_acache_shard_t *tanto_acache_shard(uint32_t hash)
+{
+  return &tanto_ctx.acache[hash % TANTO_ACACHE_SHARDS];
+}
+
+static void tanto_acache_init(void)
+{
+  int ind;
+
+  for (ind = 0; ind < TANTO_ACACHE_SHARDS; ind++)
+    pthread_mutex_init(&tanto_ctx.acache[ind].lock, NULL);
+}
+
+static void tanto_acache_free(tanto_acache_ent_t *ent)
+{
+  free(ent->path);
+  free(ent);
+}
+
+/* Caller holds the shard lock */
+static tanto_acache_ent_t **tanto_acache_find(tanto_acache_shard_t *shard,
+                                              const char *path, uint32_t hash)
+{
+  tanto_acache_ent_t **pent;
+
+  pent = &shard->buckets[(hash / TANTO_ACACHE_SHARDS) % TANTO_ACACHE_BUCKETS];
+
+  for (; *pent; pent = &(*pent)->next)
+  {
+    if ((*pent)->hash == hash && strcmp((*pent)->path, path) == 0)
+      break;
+  }
+
+  return pent;
+}
+
+/* Caller holds the shard lock. Drop whole buckets, clock style. */
+static void tanto_acache_evict(tanto_acache_shard_t *shard, int max)
+{
+  tanto_acache_ent_t *ent;
+
+  while (shard->count >= max)
+  {
+    while ((ent = shard->buckets[shard->hand]) != NULL)
+    {
+      shard->buckets[shard->hand] = ent->next;
+      shard->count--;
+
+      tanto_acache_free(ent);
+    }
+
+    shard->hand = (shard->hand + 1) % TANTO_ACACHE_BUCKETS;
+  }
+}
+
+static int tanto_acache_get(const char *path, uint64_t *ino, 
+                            tanto_fobj_t *fobj)
+{
+  int                    ret  = -1;
+  uint32_t               hash = tanto_hash(path);
+  tanto_acache_shard_t  *shard = tanto_acache_shard(hash);
+  tanto_acache_ent_t   **pent;
+  tanto_acache_ent_t    *ent;
+
+  if (tanto_opt.acache_ttl <= 0)
+    return -1;
+
+  pthread_mutex_lock(&shard->lock);
+
+  pent = tanto_acache_find(shard, path, hash);
+
+  if ((ent = *pent) != NULL)
+  {
+    if (ent->expire > ytime_get() && ent->gen == tanto_ctx.path_gen)
+    {
+      if (ent->neg)
+        ret = -ENOENT;
+      else
+      {
+        *ino  = ent->ino;
+        *fobj = ent->fobj;
+        ret   = 0;
+      }
+    }
+    else                                             /* expired or moved */
+    {
+      *pent = ent->next;
+      shard->count--;
+
+      tanto_acache_free(ent);
+    }
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  if (ret == 0)
+    tanto_stats_inc(acache_hits);
+  else if (ret == -ENOENT)
+    tanto_stats_inc(ncache_hits);
+  else
+    tanto_stats_inc(acache_misses);
+
+  return ret;
+}
+
+/* 
+ * Cache ino and fobj for path, or a negative entry if fobj is NULL. gen is
+ * the path_gen the path was resolved under, stale lookups are not cached.
+ * A lookup miss passes the create_gen it ran under in cgen: it is dropped
+ * if a create ran since, and never replaces a live positive entry.
+ */
+static void tanto_acache_set(const char *path, uint64_t ino, 
+                             tanto_fobj_t *fobj, uint32_t gen, 
+                             const uint32_t *cgen)
+{
+  uint32_t               hash  = tanto_hash(path);
+  tanto_acache_shard_t  *shard = tanto_acache_shard(hash);
+  tanto_acache_ent_t   **pent;
+  tanto_acache_ent_t    *ent;
+  int                    max;
+  int                    ttl;
+
+  ttl = fobj ? tanto_opt.acache_ttl : tanto_opt.ncache_ttl;
+
+  if (tanto_opt.acache_ttl <= 0 || ttl <= 0)
+    return;
+
+  max = tanto_opt.acache_size / TANTO_ACACHE_SHARDS;
+
+  if (max < 1)
+    max = 1;
+
+  pthread_mutex_lock(&shard->lock);
+
+  pent = tanto_acache_find(shard, path, hash);
+
+  if (gen != tanto_ctx.path_gen || 
+      (cgen && (*cgen != tanto_ctx.create_gen ||
+                (*pent && !(*pent)->neg && (*pent)->gen == gen &&
+                 (*pent)->expire > ytime_get()))))
+  {
+    pthread_mutex_unlock(&shard->lock);
+    return;
+  }
+
+  if ((ent = *pent) == NULL)
+  {
+    tanto_acache_evict(shard, max);
+
+    if ((ent = calloc(1, sizeof(*ent))) == NULL ||
+        (ent->path = strdup(path)) == NULL)
+    {
+      free(ent);
+      pthread_mutex_unlock(&shard->lock);
+      return;
+    }
+
+    ent->hash = hash;
+
+    pent = tanto_acache_find(shard, path, hash);          /* evict moved it */
+
+    ent->next = *pent;
+    *pent     = ent;
+
+    shard->count++;
+  }
+
+  if (fobj)
+    ent->fobj = *fobj;
+
+  ent->ino    = ino;
+  ent->gen    = gen;
+  ent->neg    = fobj == NULL;
+  ent->expire = ytime_get() + (size_t)ttl * 1000;
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+static void tanto_acache_put(const char *path, uint64_t ino, 
+                             tanto_fobj_t *fobj, uint32_t gen)
+{
+  tanto_acache_set(path, ino, fobj, gen, NULL);
+}
+
+/* Cache a failed lookup of path, see tanto_file_get */
+static void tanto_acache_miss(const char *path, uint32_t gen, uint32_t cgen)
+{
+  tanto_acache_set(path, 0, NULL, gen, &cgen);
+}
+
+static void tanto_acache_del(const char *path)
+{
+  uint32_t               hash  = tanto_hash(path);
+  tanto_acache_shard_t  *shard = tanto_acache_shard(hash);
+  tanto_acache_ent_t   **pent;
+  tanto_acache_ent_t    *ent;
+
+  pthread_mutex_lock(&shard->lock);
+
+  pent = tanto_acache_find(shard, path, hash);
+
+  if ((ent = *pent) != NULL)
+  {
+    *pent = ent->next;
+    shard->count--;
+
+    tanto_acache_free(ent);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/*---------------------------------------------------------------------------*
+ *                             BLOCK CACHE                                   *
+ *---------------------------------------------------------------------------*/
+
+/*
+ * Bounded LRU cache of file data blocks, bcache_size MiB split over 
+ * TANTO_BCACHE_SHARDS shards. Writes update it, truncate and unlink drop
+ * the blocks they release. Blocks fetched by a read are only inserted if 
+ * no write or invalidation ran meanwhile, so a racing writer's data is 
+ * never replaced by the older contents.
+ */
+
+static uint32_t tanto_bcache_hash(uint64_t ino, size_t blk)
+{
+  return tanto_ino_hash(ino) ^ (uint32_t)(blk * 2654435761u);
+}
+
+static tanto_bcache_shard_t *tanto_bcache_shard(uint32_t hash)
+{
+  return &tanto_ctx.bcache[hash % TANTO_BCACHE_SHARDS];
+}
+
+static void tanto_bcache_init(void)
+{
+  int                   ind;
+  tanto_bcache_shard_t *shard;
+
+  tanto_ctx.bcache_max = ((size_t)tanto_opt.bcache_size * 1024 * 1024) / 
+                         tanto_bsize() / TANTO_BCACHE_SHARDS;
+  tanto_ctx.bcache_gen = 1;                    /* odd, so never 0 : see put */
+
+  for (ind = 0; ind < TANTO_BCACHE_SHARDS; ind++)
+  {
+    shard = &tanto_ctx.bcache[ind];
+
+    pthread_mutex_init(&shard->lock, NULL);
+
+    shard->lru.prev = &shard->lru;
+    shard->lru.next = &shard->lru;
+  }
+}
+
+/* Caller holds the shard lock */
+static tanto_bcache_ent_t **tanto_bcache_find(tanto_bcache_shard_t *shard,
+                                              uint64_t ino, size_t blk,
+                                              uint32_t hash)
+{
+  tanto_bcache_ent_t **pent;
+
+  pent = &shard->buckets[(hash / TANTO_BCACHE_SHARDS) % TANTO_BCACHE_BUCKETS];
+
+  for (; *pent; pent = &(*pent)->hnext)
+  {
+    if ((*pent)->hash == hash && (*pent)->blk == blk && (*pent)->ino == ino)
+      break;
+  }
+
+  return pent;
+}
+
+static void tanto_bcache_lru_del(tanto_bcache_ent_t *ent)
+{
+  ent->prev->next = ent->next;
+  ent->next->prev = ent->prev;
+}
+
+static void tanto_bcache_lru_add(tanto_bcache_shard_t *shard, 
+                                 tanto_bcache_ent_t *ent)
+{
+  ent->prev = &shard->lru;
+  ent->next = shard->lru.next;
+
+  shard->lru.next->prev = ent;
+  shard->lru.next       = ent;
+}
+
+/* Caller holds the shard lock, *pent is the entry to drop */
+static void tanto_bcache_remove(tanto_bcache_shard_t *shard,
+                                tanto_bcache_ent_t **pent)
+{
+  tanto_bcache_ent_t *ent = *pent;
+
+  *pent = ent->hnext;
+
+  tanto_bcache_lru_del(ent);
+  shard->count--;
+
+  free(ent);
+}
+
+/* Copy len bytes at off of a cached block, returns -1 if not cached */
+static int tanto_bcache_read(uint64_t ino, size_t blk, size_t off, 
+                             void *data, size_t len)
+{
+  int                    ret   = -1;
+  uint32_t               hash  = tanto_bcache_hash(ino, blk);
+  tanto_bcache_shard_t  *shard = tanto_bcache_shard(hash);
+  tanto_bcache_ent_t    *ent;
+
+  if (tanto_ctx.bcache_max <= 0)
+    return -1;
+
+  pthread_mutex_lock(&shard->lock);
+
+  if ((ent = *tanto_bcache_find(shard, ino, blk, hash)) != NULL)
+  {
+    memcpy(data, &ent->data[off], len);
+
+    tanto_bcache_lru_del(ent);
+    tanto_bcache_lru_add(shard, ent);
+
+    ret = 0;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  if (ret == 0)
+    tanto_stats_inc(bcache_hits);
+  else
+    tanto_stats_inc(bcache_misses);
+
+  return ret;
+}
 
-  keyl = tanto_stat_key(key, path);
+static int tanto_bcache_get(uint64_t ino, size_t blk, void *data)
+{
+  return tanto_bcache_read(ino, blk, 0, data, tanto_bsize());
+}
+
+/* Patch len bytes at off of a block just written, if it is cached */
+static void tanto_bcache_patch(uint64_t ino, size_t blk, size_t off, 
+                               void *data, size_t len)
+{
+  uint32_t               hash  = tanto_bcache_hash(ino, blk);
+  tanto_bcache_shard_t  *shard = tanto_bcache_shard(hash);
+  tanto_bcache_ent_t    *ent;
+
+  if (tanto_ctx.bcache_max <= 0)
+    return;
+
+  pthread_mutex_lock(&shard->lock);
+
+  __sync_fetch_and_add(&tanto_ctx.bcache_gen, 2);
+
+  if ((ent = *tanto_bcache_find(shard, ino, blk, hash)) != NULL)
+    memcpy(&ent->data[off], data, len);
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/* Insert or update a block. gen is the bcache_gen seen before the data
+ * was read from the backend, or 0 for data just written. */
+static void tanto_bcache_put(uint64_t ino, size_t blk, void *data,
+                             uint32_t gen)
+{
+  uint32_t               hash  = tanto_bcache_hash(ino, blk);
+  tanto_bcache_shard_t  *shard = tanto_bcache_shard(hash);
+  tanto_bcache_ent_t   **pent;
+  tanto_bcache_ent_t    *ent;
+
+  if (tanto_ctx.bcache_max <= 0)
+    return;
+
+  pthread_mutex_lock(&shard->lock);
+
+  if (gen == 0)
+    __sync_fetch_and_add(&tanto_ctx.bcache_gen, 2);
+  else if (gen != tanto_ctx.bcache_gen)             /* raced with an update */
+  {
+    pthread_mutex_unlock(&shard->lock);
+    return;
+  }
+
+  pent = tanto_bcache_find(shard, ino, blk, hash);
+
+  if ((ent = *pent) != NULL)
+  {
+    tanto_bcache_lru_del(ent);
+  }
+  else
+  {
+    while (shard->count >= tanto_ctx.bcache_max)       /* evict the tail */
+    {
+      ent = shard->lru.prev;
+
+      tanto_bcache_remove(shard, 
+                          tanto_bcache_find(shard, ent->ino, ent->blk, 
+                                            ent->hash));
+    }
+
+    if ((ent = malloc(sizeof(*ent) + tanto_bsize())) == NULL)
+    {
+      pthread_mutex_unlock(&shard->lock);
+      return;
+    }
+
+    ent->data  = (char *)(ent + 1);
+    ent->ino   = ino;
+    ent->blk   = blk;
+    ent->hash  = hash;
+    ent->hnext = *pent;
+    *pent      = ent;
+
+    shard->count++;
+  }
+
+  memcpy(ent->data, data, tanto_bsize());
+
+  tanto_bcache_lru_add(shard, ent);
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/* Drop blocks [from, to) of inode ino */
+static void tanto_bcache_inval(uint64_t ino, size_t from, size_t to)
+{
+  size_t                 blk;
+  uint32_t               hash;
+  tanto_bcache_shard_t  *shard;
+  tanto_bcache_ent_t   **pent;
+
+  if (tanto_ctx.bcache_max <= 0)
+    return;
+
+  for (blk = from; blk < to; blk++)
+  {
+    hash  = tanto_bcache_hash(ino, blk);
+    shard = tanto_bcache_shard(hash);
+
+    pthread_mutex_lock(&shard->lock);
+
+    __sync_fetch_and_add(&tanto_ctx.bcache_gen, 2);
+
+    pent = tanto_bcache_find(shard, ino, blk, hash);
+
+    if (*pent)
+      tanto_bcache_remove(shard, pent);
+
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+/*---------------------------------------------------------------------------*
+ *                       ALLOCATION MAP / ZERO BLOCKS                        *
+ *---------------------------------------------------------------------------*/
+
+/*
+ * Regular files created with TANTO_FOBJ_AMAP record which of their data
+ * blocks are stored in bitmaps "m:<ino>:<n>", TANTO_AMAP_BITS blocks per
+ * key, in redis bit order. Bits are set and cleared with BITFIELD in the
+ * same pipelined round trip as the block SETs (tanto_file_put_blocks). A
+ * block whose bit is clear is a hole and reads as zeroes locally. Blocks
+ * written as all zeroes are not stored, or deleted if they were, so sparse
+ * and preallocated files take no space for their holes.
+ *
+ * Bitmaps are cached for acache_ttl ms like attributes. A bitmap read from
+ * the backend is only cached when no bit update ran meanwhile (amap_gen).
+ */
+
+static uint32_t tanto_amap_hash(uint64_t ino, size_t ind)
+{
+  return tanto_ino_hash(ino) ^ (uint32_t)(ind * 2654435761u);
+}
+
+static tanto_amap_shard_t *tanto_amap_shard(uint32_t hash)
+{
+  return &tanto_ctx.amap[hash % TANTO_AMAP_SHARDS];
+}
+
+static void tanto_amap_init(void)
+{
+  int ind;
+
+  for (ind = 0; ind < TANTO_AMAP_SHARDS; ind++)
+    pthread_mutex_init(&tanto_ctx.amap[ind].lock, NULL);
+}
+
+/* Caller holds the shard lock */
+static tanto_amap_ent_t **tanto_amap_find(tanto_amap_shard_t *shard,
+                                          uint64_t ino, size_t ind, 
+                                          uint32_t hash)
+{
+  tanto_amap_ent_t **pent;
+
+  pent = &shard->buckets[(hash / TANTO_AMAP_SHARDS) % TANTO_AMAP_BUCKETS];
+
+  for (; *pent; pent = &(*pent)->next)
+  {
+    if ((*pent)->hash == hash && (*pent)->ind == ind && (*pent)->ino == ino)
+      break;
+  }
+
+  return pent;
+}
+
+/* Caller holds the shard lock. Drop whole buckets, clock style. */
+static void tanto_amap_evict(tanto_amap_shard_t *shard)
+{
+  tanto_amap_ent_t *ent;
+
+  while (shard->count >= TANTO_AMAP_SIZE)
+  {
+    while ((ent = shard->buckets[shard->hand]) != NULL)
+    {
+      shard->buckets[shard->hand] = ent->next;
+      shard->count--;
+
+      free(ent);
+    }
+
+    shard->hand = (shard->hand + 1) % TANTO_AMAP_BUCKETS;
+  }
+}
+
+#define tanto_amap_bit(bits, off) (((bits)[(off) / 8] >> (7 - (off) % 8)) & 1)
+
+/* Returns 1 if block blk of file is stored, 0 for a hole, -1 if unknown */
+static int tanto_amap_test(tanto_file_t *file, size_t blk)
+{
+  int                  ret  = -1;
+  int                  vlen = TANTO_AMAP_BYTES;
+  size_t               ind  = blk / TANTO_AMAP_BITS;
+  size_t               off  = blk % TANTO_AMAP_BITS;
+  uint32_t             hash = tanto_amap_hash(file->ino, ind);
+  uint32_t             gen;
+  tanto_amap_shard_t  *shard = tanto_amap_shard(hash);
+  tanto_amap_ent_t   **pent;
+  tanto_amap_ent_t    *ent;
+  char                 key[TANTO_KEY_MAXLEN];
+  char                *kptr = key;
+  int                  klen;
+  void                *vptr;
+
+  if (!(file->fobj.flags & TANTO_FOBJ_AMAP) || tanto_opt.acache_ttl <= 0)
+    return -1;
+
+  pthread_mutex_lock(&shard->lock);
+
+  pent = tanto_amap_find(shard, file->ino, ind, hash);
+
+  if ((ent = *pent) != NULL && ent->expire > ytime_get())
+    ret = tanto_amap_bit(ent->bits, off);
+  else if (ent)                                                 /* expired */
+  {
+    *pent = ent->next;
+    shard->count--;
+
+    free(ent);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  if (ret >= 0)
+    return ret;
+
+  if ((ent = calloc(1, sizeof(*ent))) == NULL)
+    return -1;
+
+  gen  = tanto_ctx.amap_gen;
+  klen = tanto_amap_key(key, file->ino, ind);
+  vptr = ent->bits;
+
+  if (tengine_mget(tanto_engine(), &kptr, &klen, &vptr, &vlen, 1) < 0)
+  {
+    free(ent);
+    return -1;
+  }
+
+  ret = tanto_amap_bit(ent->bits, off);               /* nil reads as holes */
+
+  pthread_mutex_lock(&shard->lock);
+
+  if (gen != tanto_ctx.amap_gen)                    /* raced with an update */
+    ret = -1;
+  else if (*tanto_amap_find(shard, file->ino, ind, hash) == NULL)
+  {
+    tanto_amap_evict(shard);
+
+    ent->ino    = file->ino;
+    ent->ind    = ind;
+    ent->hash   = hash;
+    ent->expire = ytime_get() + (size_t)tanto_opt.acache_ttl * 1000;
+
+    pent = tanto_amap_find(shard, file->ino, ind, hash);
+
+    ent->next = *pent;
+    *pent     = ent;
+    ent       = NULL;
+
+    shard->count++;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  free(ent);
+
+  return ret;
+}
+
+/*
+ * Record in the cache that bit blk of inode ino is now val in the backend,
+ * or drop its bitmap if val is -1 (update failed, state not known).
+ */
+static void tanto_amap_update(uint64_t ino, size_t blk, int val)
+{
+  size_t               ind   = blk / TANTO_AMAP_BITS;
+  size_t               off   = blk % TANTO_AMAP_BITS;
+  uint32_t             hash  = tanto_amap_hash(ino, ind);
+  tanto_amap_shard_t  *shard = tanto_amap_shard(hash);
+  tanto_amap_ent_t   **pent;
+  tanto_amap_ent_t    *ent;
+
+  pthread_mutex_lock(&shard->lock);
+
+  __sync_fetch_and_add(&tanto_ctx.amap_gen, 1);
+
+  pent = tanto_amap_find(shard, ino, ind, hash);
+
+  if ((ent = *pent) != NULL)
+  {
+    if (val < 0)
+    {
+      *pent = ent->next;
+      shard->count--;
+
+      free(ent);
+    }
+    else if (val)
+      ent->bits[off / 8] |= 0x80 >> (off % 8);
+    else
+      ent->bits[off / 8] &= ~(0x80 >> (off % 8));
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/* Drop the cached bitmaps of the first nblocks blocks of inode ino */
+static void tanto_amap_inval(uint64_t ino, size_t nblocks)
+{
+  size_t ind;
+
+  for (ind = 0; ind * TANTO_AMAP_BITS < nblocks; ind++)
+    tanto_amap_update(ino, ind * TANTO_AMAP_BITS, -1);
+}
+
+/*
+ * Zero block check, len is a multiple of 256. The widest variant the CPU
+ * runs is picked once in tanto_zero_init.
+ */
+static int tanto_zero_any(const void *data, size_t len)
+{
+  const uint64_t *p = (const uint64_t *)data;
+  const uint64_t *e = p + len / sizeof(uint64_t);
+
+  for (; p < e; p += 4)
+  {
+    if (p[0] | p[1] | p[2] | p[3])
+      return 0;
+  }
+
+  return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static int tanto_zero_sse2(const void *data, size_t len)
+{
+  const __m128i *p = (const __m128i *)data;
+  const __m128i *e = p + len / sizeof(__m128i);
+  __m128i        acc;
+  int            ind;
+
+  for (; p < e; p += 16)                          /* 256 bytes per check */
+  {
+    acc = _mm_loadu_si128(p);
+
+    for (ind = 1; ind < 16; ind++)
+      acc = _mm_or_si128(acc, _mm_loadu_si128(p + ind));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) 
+        != 0xffff)
+      return 0;
+  }
+
+  return 1;
+}
+
+__attribute__((target("avx2")))
+static int tanto_zero_avx2(const void *data, size_t len)
+{
+  const __m256i *p = (const __m256i *)data;
+  const __m256i *e = p + len / sizeof(__m256i);
+  __m256i        acc;
+  int            ind;
+
+  for (; p < e; p += 8)                           /* 256 bytes per check */
+  {
+    acc = _mm256_loadu_si256(p);
+
+    for (ind = 1; ind < 8; ind++)
+      acc = _mm256_or_si256(acc, _mm256_loadu_si256(p + ind));
+
+    if (!_mm256_testz_si256(acc, acc))
+      return 0;
+  }
+
+  return 1;
+}
+#endif
+
+static int (*tanto_zero_fn)(const void *data, size_t len) = tanto_zero_any;
+
+static void tanto_zero_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    tanto_zero_fn = tanto_zero_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    tanto_zero_fn = tanto_zero_sse2;
+#endif
+}
+
+#define tanto_block_zero(data) tanto_zero_fn(data, tanto_bsize())
+
+/*---------------------------------------------------------------------------*
+ *                            BACKEND OBJECTS                                *
+ *---------------------------------------------------------------------------*/
+
+static int tanto_split_name(const char *path, char *dir, int dirl, 
+                            char *base, int basel);
+
+/*
+ * Inode numbers are reserved from the backend counter ino_batch at a time
+ * with one INCRBY, which no other client can overlap, and handed out from
+ * a range private to the calling thread. Numbers left in a range when the
+ * process exits are never used.
+ */
+static __thread uint64_t tanto_ino_next;
+static __thread uint64_t tanto_ino_end;
+
+/* Allocate a new inode number */
+static int tanto_ino_alloc(uint64_t *ino)
+{
+  long long val;
+  int       batch = tanto_opt.ino_batch > 0 ? tanto_opt.ino_batch : 1;
+
+  if (tanto_ino_next == tanto_ino_end)
+  {
+    if (tengine_incrby(tanto_engine(), TANTO_INO_KEY, strlen(TANTO_INO_KEY),
+                     batch, &val) < 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "inode allocation failed\n");
+      return -1;
+    }
+
+    tanto_ino_end  = TANTO_INO_ROOT + val + 1;        /* range (val-batch, val] */
+    tanto_ino_next = tanto_ino_end - batch;
+
+    tanto_stats_inc(ino_ranges);
+  }
+
+  *ino = tanto_ino_next++;
+
+  return 0;
+}
+
+/* Create a new object with inode number ino (0 allocates one) */
+static int tanto_add_obj(tanto_file_t *file, uint64_t ino, 
+                         mode_t mode, uid_t uid, gid_t gid)
+{
+  tanto_fobj_t *fobj = &file->fobj;
+  size_t        cur_us = ytime_get();
+  
+  if (ino == 0 && tanto_ino_alloc(&ino) < 0)
+    return -ENOSPC;
+
+  memset(fobj, 0, sizeof(*fobj));
+
+  file->ino   = ino;
+  file->keyl  = tanto_stat_key(file->key, ino);
+  file->iload = 1;
+
+  fobj->mode  = mode;
+  fobj->uid   = uid;
+  fobj->gid   = gid;
+  fobj->nlink = 1;
+  fobj->seqno = cur_us/1000/1000;                      /* convert to seconds */
+  fobj->modtime = cur_us * 1000;                          /* in nano seconds */
+  fobj->actime  = cur_us * 1000;
+  fobj->ctime   = cur_us * 1000;
+
+  if (S_ISDIR(mode))
+    fobj->flags = TANTO_FOBJ_HASHDIR | TANTO_FOBJ_PACKDIR;
+  else if (S_ISREG(mode))
+    fobj->flags = TANTO_FOBJ_AMAP | TANTO_FOBJ_SIZE;
+  else if (S_ISLNK(mode))
+    fobj->flags = TANTO_FOBJ_SIZE;
+
+  if (tengine_set(tanto_engine(), file->key, file->keyl, 
+                (void *)fobj, sizeof(tanto_fobj_t)) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "set %s failed\n", file->key);
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
+/* Read the object of inode ino, file->path is left alone */
+static int tanto_file_load(tanto_file_t *file, uint64_t ino)
+{
+  int  len;
+  int  hlen;
+  char val[sizeof(tanto_fobj_t) + TANTO_INLINE_MAX];
+
+  file->ino  = ino;
+  file->keyl = tanto_stat_key(file->key, ino);
+
+  memset(&file->fobj, 0, sizeof(file->fobj));      /* older objects are short */
+
+  if ((len = tengine_get(tanto_engine(), file->key, file->keyl, 
+                       val, sizeof(val))) < 0) 
+  {
+    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n",
+               file->key, file->keyl);
+    return -ENOENT;
+  }
+
+  memcpy(&file->fobj, val, 
+         len < sizeof(tanto_fobj_t) ? len : sizeof(tanto_fobj_t));
+
+  if (file->fobj.nlink == 0)
+    file->fobj.nlink = 1;
+
+  if (file->fobj.flags & TANTO_FOBJ_INLINE)   /* after an object of any size */
+  {
+    hlen = len - (int)file->fobj.ilen;
+
+    if (file->fobj.ilen > TANTO_INLINE_MAX ||
+        hlen < (int)offsetof(tanto_fobj_t, size))
+    {
+      ytrace_msg(YTRACE_ERROR, "bad inline data [%s]\n", file->key);
+      return -EIO;
+    }
+
+    if (hlen < (int)sizeof(tanto_fobj_t))
+      memset((char *)&file->fobj + hlen, 0, sizeof(tanto_fobj_t) - hlen);
+
+    memcpy(file->idata, &val[hlen], file->fobj.ilen);
+  }
+
+  file->iload = 1;
+
+  return 0;
+}
+
+static int tanto_dir_lookup(tanto_file_t *dfile, const char *name, 
+                            uint64_t *ino);
+
+/* Resolve path, through the attribute cache or parent directory by parent */
+static int tanto_file_get(tanto_file_t *file, const char *path)
+{
+  uint32_t      gen  = tanto_ctx.path_gen;
+  uint32_t      cgen = tanto_ctx.create_gen;
+  int           ret;
+  uint64_t      ino;
+  char          base[TANTO_PATH_MAXLEN];
+  char          dir[TANTO_PATH_MAXLEN];
+  tanto_file_t  dfile;
+
+  ytrace_msg(YTRACE_LEVEL1, "path = %s\n", path);
+
+  strcpy(file->path, path);
+
+  file->gen = gen;
+
+  switch (tanto_acache_get(path, &ino, &file->fobj))
+  {
+    case 0       : 
+      file->ino   = ino;
+      file->keyl  = tanto_stat_key(file->key, ino);
+      file->iload = 0;                          /* see tanto_file_idata */
+      return 0;
+
+    case -ENOENT : 
+      return -ENOENT;
+  }
+
+  if (strcmp(path, "/") == 0)
+    ino = TANTO_INO_ROOT;
+  else
+  {
+    tanto_split_name(path, dir, sizeof(dir), base, sizeof(base));
+
+    if (tanto_file_get(&dfile, dir) < 0 || !S_ISDIR(dfile.fobj.mode))
+      return -ENOENT;
+
+    if ((ret = tanto_dir_lookup(&dfile, base, &ino)) < 0)
+    {
+      if (ret == -ENOENT)           /* a failed bucket read is not cached */
+        tanto_acache_miss(path, gen, cgen);
+
+      return ret;
+    }
+  }
+
+  if (tanto_file_load(file, ino) < 0)
+    return -ENOENT;
+
+  tanto_acache_put(path, ino, &file->fobj, gen);
+  
+  return 0;
+}
+
+/* 
+ * Read the object of file again, through the cache while its path still
+ * names the same inode.
+ */
+static int tanto_file_reget(tanto_file_t *file)
+{
+  tanto_file_t cur;
+
+  if (tanto_file_get(&cur, file->path) == 0 && cur.ino == file->ino)
+  {
+    *file = cur;
+    return 0;
+  }
+
+  return tanto_file_load(file, file->ino);
+}
+
+/*
+ * Make sure idata holds the inline data of file, an object from the
+ * attribute cache comes without it. fobj is left alone but for ilen, so
+ * changes made to it before a sync are kept.
+ */
+static int tanto_file_idata(tanto_file_t *file)
+{
+  tanto_file_t cur;
+
+  if (file->iload || !(file->fobj.flags & TANTO_FOBJ_INLINE))
+    return 0;
+
+  if (tanto_file_load(&cur, file->ino) < 0)
+    return -ENOENT;
+
+  if (cur.fobj.flags & TANTO_FOBJ_INLINE)
+  {
+    file->fobj.ilen = cur.fobj.ilen;
+    memcpy(file->idata, cur.idata, cur.fobj.ilen);
+  }
+  else                                      /* moved to blocks meanwhile */
+  {
+    file->fobj.flags  &= ~TANTO_FOBJ_INLINE;
+    file->fobj.ilen    = 0;
+    file->fobj.nblocks = cur.fobj.nblocks;
+  }
+
+  file->iload = 1;
+
+  return 0;
+}
+
+/* Resolve path and lock its object, returns NULL if it does not exist */
+static pthread_mutex_t *tanto_file_lock(tanto_file_t *file, const char *path)
+{
+  pthread_mutex_t *lock;
+
+  if (tanto_file_get(file, path) < 0)
+    return NULL;
+
+  lock = tanto_lock(file->ino);
+
+  if (tanto_file_reget(file) < 0 ||              /* changed while waiting */
+      tanto_file_idata(file) < 0)
+  {
+    tanto_unlock(lock);
+    return NULL;
+  }
+
+  return lock;
+}
+
+/* Object and inline data are stored as one value, returns its length */
+static int tanto_file_pack(tanto_file_t *file, char *val)
+{
+  int len = sizeof(tanto_fobj_t);
+
+  if ((file->fobj.flags & TANTO_FOBJ_INLINE) && tanto_file_idata(file) < 0)
+    return -ENOENT;
+
+  memcpy(val, &file->fobj, sizeof(tanto_fobj_t));
+
+  if (file->fobj.flags & TANTO_FOBJ_INLINE)
+  {
+    memcpy(&val[len], file->idata, file->fobj.ilen);
+    len += file->fobj.ilen;
+  }
+
+  return len;
+}
+
+/* Cache the object of file just stored */
+static void tanto_file_synced(tanto_file_t *file)
+{
+  if (file->fobj.nlink > 1)             /* cached under other names as well */
+    tanto_path_gen_bump();
+  else
+    tanto_acache_put(file->path, file->ino, &file->fobj, file->gen);
+}
+
+static int tanto_file_sync(tanto_file_t *file)
+{
+  int   len;
+  char  val[sizeof(tanto_fobj_t) + TANTO_INLINE_MAX];
+
+  ytrace_msg(YTRACE_LEVEL1, "path = %s %s\n", file->path, file->key);
+
+  if ((len = tanto_file_pack(file, val)) < 0)
+    return -ENOENT;
+
+  if (tengine_set(tanto_engine(), file->key, file->keyl, val, len) < 0) 
+  {
+    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n",
+               file->key, file->keyl);
+    tanto_acache_del(file->path);
+    return -ENOENT;
+  }
+
+  tanto_file_synced(file);
+  
+  return 0;
+}
+
+/* Bytes in file, objects without TANTO_FOBJ_SIZE count whole blocks */
+static size_t tanto_file_size(tanto_fobj_t *fobj)
+{
+  if (fobj->flags & TANTO_FOBJ_INLINE)
+    return fobj->ilen;
+
+  if (fobj->flags & TANTO_FOBJ_SIZE)
+    return fobj->size;
+
+  return (size_t)fobj->nblocks * tanto_bsize();
+}
+
+static void tanto_file_resize(tanto_fobj_t *fobj, size_t size)
+{
+  fobj->size   = size;
+  fobj->flags |= TANTO_FOBJ_SIZE;
+}
+
+static int tanto_file_read(tanto_file_t *file,
+                           size_t blk_ind, void *data, size_t datal)
+{
+  char key[TANTO_KEY_MAXLEN];
+  int  keyl;
+
+  ytrace_msg(YTRACE_LEVEL1, "block_ind = %lu\n", (unsigned long)blk_ind);
+
+  if (file->fobj.flags & TANTO_FOBJ_INLINE)
+  {
+    if (blk_ind || tanto_file_idata(file) < 0)
+      return -ENOENT;
+
+    if (datal > file->fobj.ilen)
+    {
+      memset((char *)data + file->fobj.ilen, 0, datal - file->fobj.ilen);
+      datal = file->fobj.ilen;
+    }
+
+    memcpy(data, file->idata, datal);
+
+    return 0;
+  }
+
+  keyl = tanto_data_key(key, file->ino, blk_ind);
+
+  if (tengine_get(tanto_engine(), key, keyl, data, datal) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n", key, keyl);
+    return -ENOENT;
+  }
+  
+  return 0;
+}
+
+/*
+ * Read cnt consecutive blocks starting at blk_ind into data with pipelined
+ * GETs. Missing blocks and short values read back as zeroes.
+ */
+static int tanto_file_read_blocks(tanto_file_t *file, size_t blk_ind,
+                                  size_t cnt, void *data)
+{
+  int       ind;
+  int       bcnt;
+  int       nmiss;
+  uint32_t  gen;
+  char      keys[TANTO_BATCH_MAX][TANTO_KEY_MAXLEN];
+  char     *kptr[TANTO_BATCH_MAX];
+  int       klen[TANTO_BATCH_MAX];
+  void     *vptr[TANTO_BATCH_MAX];
+  int       vlen[TANTO_BATCH_MAX];
+  size_t    vblk[TANTO_BATCH_MAX];
+  size_t    bsize = tanto_bsize();
+  char     *bp = (char *)data;
+
+  ytrace_msg(YTRACE_LEVEL1, "block_ind = %lu : cnt = %lu\n", 
+             (unsigned long)blk_ind, (unsigned long)cnt);
+
+  while (cnt)
+  {
+    bcnt  = cnt < TANTO_BATCH_MAX ? cnt : TANTO_BATCH_MAX;
+    nmiss = 0;
+    gen   = tanto_ctx.bcache_gen;
+
+    for (ind = 0; ind < bcnt; ind++)             /* only fetch the misses */
+    {
+      if (tanto_amap_test(file, blk_ind + ind) == 0)
+      {
+        memset(&bp[ind * bsize], 0, bsize);
+        tanto_stats_inc(amap_holes);
+        continue;
+      }
+
+      if (tanto_bcache_get(file->ino, blk_ind + ind, 
+                           &bp[ind * bsize]) == 0)
+        continue;
+
+      kptr[nmiss] = keys[nmiss];
+      klen[nmiss] = tanto_data_key(keys[nmiss], file->ino, blk_ind + ind);
+      vptr[nmiss] = &bp[ind * bsize];
+      vlen[nmiss] = bsize;
+      vblk[nmiss] = blk_ind + ind;
+      nmiss++;
+    }
+
+    if (nmiss && 
+        tengine_mget(tanto_engine(), kptr, klen, vptr, vlen, nmiss) < 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "redis mget [%s] failed\n", file->path);
+      return -EIO;
+    }
+
+    for (ind = 0; ind < nmiss; ind++)
+    {
+      if (vlen[ind] < 0)                                   /* not written */
+        vlen[ind] = 0;
+
+      memset((char *)vptr[ind] + vlen[ind], 0, bsize - vlen[ind]);
+
+      tanto_bcache_put(file->ino, vblk[ind], vptr[ind], gen);
+    }
+
+    bp      += bcnt * bsize;
+    blk_ind += bcnt;
+    cnt     -= bcnt;
+  }
+
+  return 0;
+}
+
+/*
+ * Read len bytes at off of block blk. Small reads of large blocks that miss
+ * the cache fetch only the range with GETRANGE and do not fill the cache.
+ */
+static int tanto_file_read_range(tanto_file_t *file, size_t blk, size_t off,
+                                 void *data, size_t len)
+{
+  int   vlen = len;
+  char  key[TANTO_KEY_MAXLEN];
+  int   klen;
+
+  if (tanto_amap_test(file, blk) == 0)
+  {
+    memset(data, 0, len);
+    tanto_stats_inc(amap_holes);
+    return 0;
+  }
+
+  if (tanto_bcache_read(file->ino, blk, off, data, len) == 0)
+    return 0;
+
+  klen = tanto_data_key(key, file->ino, blk);
+
+  if (tengine_getrange(tanto_engine(), key, klen, off, data, &vlen) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "redis getrange [%s] failed\n", file->path);
+    return -EIO;
+  }
+
+  if (vlen < 0)                                            /* not written */
+    vlen = 0;
+
+  memset((char *)data + vlen, 0, len - vlen);
+
+  tanto_stats_inc(range_reads);
+
+  return 0;
+}
+
+/*
+ * Store n blocks, in any order, with pipelined SETs and write them through
+ * to the block cache. All zero blocks are deleted instead, or skipped when
+ * already a hole, and the allocation bits that change go in the same round
+ * trip. With offs, datas[i] is lens[i] bytes at offs[i] of the block and a
+ * part of a block is written in place with SETRANGE, no read needed. With
+ * sync the object of file is stored in the last round trip as well.
+ */
+static int tanto_file_put_blocks(tanto_file_t *file, size_t blks[], 
+                                 void *datas[], size_t offs[], 
+                                 size_t lens[], int n, int sync)
+{
+  int     ind;
+  int     bcnt;
+  int     nput;
+  int     nbit;
+  int     part;
+  int     zero;
+  int     cur;
+  char    keys[TANTO_BATCH_MAX][TANTO_KEY_MAXLEN];
+  char   *kptr[TANTO_BATCH_MAX + 1];
+  int     klen[TANTO_BATCH_MAX + 1];
+  void   *vptr[TANTO_BATCH_MAX + 1];
+  int     vlen[TANTO_BATCH_MAX + 1];
+  long    voff[TANTO_BATCH_MAX + 1];
+  char    obj[sizeof(tanto_fobj_t) + TANTO_INLINE_MAX];
+  char    bkeys[TANTO_BATCH_MAX][TANTO_KEY_MAXLEN];
+  char   *bptr[TANTO_BATCH_MAX];
+  int     bklen[TANTO_BATCH_MAX];
+  size_t  boff[TANTO_BATCH_MAX];
+  int     bval[TANTO_BATCH_MAX];
+  size_t  bblk[TANTO_BATCH_MAX];
+  int     amap  = file->fobj.flags & TANTO_FOBJ_AMAP;
+  size_t  bsize = tanto_bsize();
+
+  while (n)
+  {
+    bcnt = n < TANTO_BATCH_MAX ? n : TANTO_BATCH_MAX;
+    nput = 0;
+    nbit = 0;
+
+    for (ind = 0; ind < bcnt; ind++)
+    {
+      part = offs && lens[ind] < bsize;
+      zero = !part && tanto_block_zero(datas[ind]);
+      cur  = amap ? tanto_amap_test(file, blks[ind]) : -1;
+
+      if (zero)
+        tanto_stats_inc(zero_blocks);
+      else if (part)
+        tanto_stats_inc(range_writes);
+
+      if (!(zero && cur == 0))                     /* a hole stays a hole */
+      {
+        kptr[nput] = keys[nput];
+        klen[nput] = tanto_data_key(keys[nput], file->ino, blks[ind]);
+        vptr[nput] = zero ? NULL : datas[ind];
+        vlen[nput] = part ? lens[ind] : bsize;
+        voff[nput] = part ? offs[ind] : TENGINE_PUT_SET;
+        nput++;
+      }
+
+      if (amap && cur != !zero)
+      {
+        bptr[nbit]  = bkeys[nbit];
+        bklen[nbit] = tanto_amap_key(bkeys[nbit], file->ino, 
+                                     blks[ind] / TANTO_AMAP_BITS);
+        boff[nbit]  = blks[ind] % TANTO_AMAP_BITS;
+        bval[nbit]  = !zero;
+        bblk[nbit]  = blks[ind];
+        nbit++;
+      }
+    }
+
+    if (sync && bcnt == n)                     /* object with the last */
+    {
+      kptr[nput] = file->key;
+      klen[nput] = file->keyl;
+      vptr[nput] = obj;
+      vlen[nput] = tanto_file_pack(file, obj);
+      voff[nput] = TENGINE_PUT_SET;
+
+      if (vlen[nput] < 0)
+        return -EIO;
+
+      nput++;
+    }
+
+    if (tengine_mput(tanto_engine(), kptr, klen, vptr, vlen, voff, nput, 
+                   bptr, bklen, boff, bval, nbit) < 0) 
+    {
+      ytrace_msg(YTRACE_ERROR, "redis mput [%s] failed\n", file->path);
+
+      if (sync)
+        tanto_acache_del(file->path);
+
+      for (ind = 0; ind < bcnt; ind++)
+        tanto_bcache_inval(file->ino, blks[ind], blks[ind] + 1);
+
+      for (ind = 0; ind < nbit; ind++)
+        tanto_amap_update(file->ino, bblk[ind], -1);
+
+      return -EIO;
+    }
+
+    for (ind = 0; ind < nbit; ind++)
+      tanto_amap_update(file->ino, bblk[ind], bval[ind]);
+
+    for (ind = 0; ind < bcnt; ind++)                      /* write through */
+    {
+      if (offs && lens[ind] < bsize)
+        tanto_bcache_patch(file->ino, blks[ind], offs[ind], datas[ind], 
+                           lens[ind]);
+      else
+        tanto_bcache_put(file->ino, blks[ind], datas[ind], 0);
+    }
+
+    if (sync && bcnt == n)
+      tanto_file_synced(file);
+
+    blks  += bcnt;
+    datas += bcnt;
+    n     -= bcnt;
+
+    if (offs)
+    {
+      offs += bcnt;
+      lens += bcnt;
+    }
+  }
+
+  return 0;
+}
+
+/* UNLINK the data blocks, or directory buckets, [from, to) of inode ino */
+static int tanto_blocks_unlink(uint64_t ino, size_t from, size_t to, int dir)
+{
+  int     ind;
+  int     cnt;
+  char    keys[TANTO_RECLAIM_BATCH][48];
+  char   *kptr[TANTO_RECLAIM_BATCH];
+  int     klen[TANTO_RECLAIM_BATCH];
+
+  tanto_bcache_inval(ino, from, to);
+
+  for (; from < to; from += cnt)
+  {
+    cnt = to - from < TANTO_RECLAIM_BATCH ? to - from : TANTO_RECLAIM_BATCH;
+
+    for (ind = 0; ind < cnt; ind++)
+    {
+      kptr[ind] = keys[ind];
+      klen[ind] = dir ? tanto_dir_key(keys[ind], ino, from + ind) :
+                        tanto_data_key(keys[ind], ino, from + ind);
+    }
+
+    if (tengine_unlink(tanto_engine(), kptr, klen, cnt) < 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "redis unlink [%llx] failed\n", 
+                 (unsigned long long)ino);
+      return -EIO;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Grow file to nblocks blocks in memory. Blocks a truncate left for the
+ * reclaimer come back into the file here, so they are deleted first.
+ */
+static int tanto_file_grow(tanto_file_t *file, size_t nblocks)
+{
+  size_t end = file->fobj.tblocks;
+
+  if (nblocks <= file->fobj.nblocks)
+    return 0;
+
+  if (end > file->fobj.nblocks)
+  {
+    if (tanto_blocks_unlink(file->ino, file->fobj.nblocks, 
+                            end < nblocks ? end : nblocks, 0) < 0)
+      return -EIO;
+
+    if (end <= nblocks)
+      file->fobj.tblocks = 0;
+  }
+
+  file->fobj.nblocks = nblocks;
+
+  return 0;
+}
+
+/*
+ * A regular file or symlink keeps its data inline, after the object in the
+ * same value, while it fits in inline_max bytes. Reading it then costs the
+ * one GET of the object, and no block is stored for it. The first write
+ * past inline_max moves the data to block 0.
+ */
+static int tanto_file_spill(tanto_file_t *file)
+{
+  int     ret;
+  size_t  blk = 0;
+  void   *data;
+
+  tanto_file_resize(&file->fobj, file->fobj.ilen);
+
+  file->fobj.flags &= ~TANTO_FOBJ_INLINE;
+
+  if (file->fobj.ilen == 0)
+    return tanto_file_sync(file);
+
+  if ((data = calloc(1, tanto_bsize())) == NULL)
+    return -ENOMEM;
+
+  memcpy(data, file->idata, file->fobj.ilen);
+
+  file->fobj.ilen = 0;
+
+  if ((ret = tanto_file_grow(file, 1)) == 0)
+    ret = tanto_file_put_blocks(file, &blk, &data, NULL, NULL, 1, 1);
+
+  free(data);
+
+  return ret;
+}
+
+/*
+ * Write inline if the file is, or is empty, and stays within inline_max.
+ * Returns 1 if written, 0 if the write is for the blocks. Caller holds
+ * the lock of file.
+ */
+static int tanto_file_inline_write(tanto_file_t *file, const void *data, 
+                                   size_t size, size_t offset)
+{
+  tanto_fobj_t *fobj = &file->fobj;
+
+  if (!(fobj->flags & TANTO_FOBJ_INLINE))
+  {
+    if (fobj->nblocks || !(S_ISREG(fobj->mode) || S_ISLNK(fobj->mode)) ||
+        offset + size > tanto_opt.inline_max)
+      return 0;
+
+    fobj->flags |= TANTO_FOBJ_INLINE;
+    fobj->ilen   = 0;
+    file->iload  = 1;
+  }
+  else if (tanto_file_idata(file) < 0)
+    return -EIO;
+  else if (offset + size > tanto_opt.inline_max)
+    return tanto_file_spill(file) < 0 ? -EIO : 0;
+
+  if (offset > fobj->ilen)
+    memset(&file->idata[fobj->ilen], 0, offset - fobj->ilen);
+
+  memcpy(&file->idata[offset], data, size);
+
+  if (offset + size > fobj->ilen)
+    fobj->ilen = offset + size;
+
+  tanto_file_resize(fobj, fobj->ilen);
+
+  return tanto_file_sync(file) < 0 ? -EIO : 1;
+}
+
+/*
+ * Write size bytes at offset, TANTO_BATCH_MAX blocks per round trip. Whole
+ * blocks are SET, the partial edge blocks are patched in place with
+ * SETRANGE so nothing has to be read first. A size change is stored with
+ * the last blocks.
+ */
+static int tanto_file_write(tanto_file_t *file, 
+                            void *data, size_t size, size_t offset)
+{
+  int     ind;
+  int     bcnt;
+  int     ret;
+  int     sync = 0;
+  size_t  blk_ind;
+  size_t  blk_first;
+  size_t  blk_last;
+  size_t  boff;
+  size_t  bend;
+  char   *bp = (char *)data;
+  void   *vptr[TANTO_BATCH_MAX];
+  size_t  vblk[TANTO_BATCH_MAX];
+  size_t  voff[TANTO_BATCH_MAX];
+  size_t  vlen[TANTO_BATCH_MAX];
+  size_t  bsize = tanto_bsize();
+
+  if (size == 0)
+    return 0;
+
+  if ((ret = tanto_file_inline_write(file, data, size, offset)) != 0)
+    return ret < 0 ? ret : 0;
+
+  blk_first = offset / bsize;
+  blk_last  = (offset + size - 1) / bsize;
+
+  ytrace_msg(YTRACE_LEVEL1, "blocks = %lu - %lu : nblocks = %lu\n",
+             (unsigned long)blk_first, (unsigned long)blk_last,
+             (unsigned long)file->fobj.nblocks);
+
+  if (tanto_file_size(&file->fobj) < offset + size)  /* update on growth */
+  {
+    tanto_file_resize(&file->fobj, offset + size);
+    sync = 1;
+  }
+
+  if (file->fobj.nblocks < blk_last + 1)
+  {
+    if (tanto_file_grow(file, blk_last + 1) < 0)
+      return -EIO;
+
+    sync = 1;
+  }
+
+  for (blk_ind = blk_first; blk_ind <= blk_last; blk_ind += bcnt)
+  {
+    bcnt = blk_last - blk_ind + 1;
+
+    if (bcnt > TANTO_BATCH_MAX)
+      bcnt = TANTO_BATCH_MAX;
+
+    for (ind = 0; ind < bcnt; ind++)
+    {
+      boff = blk_ind + ind == blk_first ? offset % bsize : 0;
+      bend = blk_ind + ind == blk_last ? 
+             (offset + size - 1) % bsize + 1 : bsize;
+
+      vblk[ind] = blk_ind + ind;
+      voff[ind] = boff;
+      vlen[ind] = bend - boff;
+      vptr[ind] = &bp[(blk_ind + ind) * bsize + boff - offset];
+    }
+
+    if (tanto_file_put_blocks(file, vblk, vptr, voff, vlen, bcnt, 
+                              sync && blk_ind + bcnt > blk_last) < 0)
+      return -EIO;
+  }
+
+  return 0;
+}
+
+/* Wake the reclaimer for a range just queued */
+static void tanto_reclaim_kick(void)
+{
+  pthread_mutex_lock(&tanto_ctx.reclaim_lock);
+  pthread_cond_signal(&tanto_ctx.reclaim_cond);
+  pthread_mutex_unlock(&tanto_ctx.reclaim_lock);
+}
+
+/*
+ * Clear the allocation bits of blocks [from, to) of file still set, caller
+ * holds its lock. Stale bits only cost a GET, this keeps holes cheap.
+ */
+static int tanto_amap_clear(tanto_file_t *file, size_t from, size_t to)
+{
+  int     nbit = 0;
+  char    bkeys[TANTO_BATCH_MAX][48];
+  char   *bptr[TANTO_BATCH_MAX];
+  int     bklen[TANTO_BATCH_MAX];
+  size_t  boff[TANTO_BATCH_MAX];
+  int     bval[TANTO_BATCH_MAX];
+  size_t  bblk[TANTO_BATCH_MAX];
+
+  for (; from < to; from++)
+  {
+    if (from < to && tanto_amap_test(file, from) != 0)
+    {
+      bptr[nbit]  = bkeys[nbit];
+      bklen[nbit] = tanto_amap_key(bkeys[nbit], file->ino, 
+                                   from / TANTO_AMAP_BITS);
+      boff[nbit]  = from % TANTO_AMAP_BITS;
+      bval[nbit]  = 0;
+      bblk[nbit]  = from;
+      nbit++;
+    }
+
+    if (nbit == TANTO_BATCH_MAX || (from + 1 == to && nbit))
+    {
+      if (tengine_mput(tanto_engine(), NULL, NULL, NULL, NULL, NULL, 0,
+                     bptr, bklen, boff, bval, nbit) < 0)
+      {
+        tanto_amap_inval(file->ino, to);
+        return -EIO;
+      }
+
+      while (nbit)
+      {
+        nbit--;
+        tanto_amap_update(file->ino, bblk[nbit], 0);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Delete the blocks of one queued range. A truncated file may have grown
+ * back meanwhile, blocks below its nblocks are in use again and kept.
+ */
+static int tanto_reclaim_range(tanto_reclaim_t *rec)
+{
+  int              cnt;
+  int              len;
+  int              live;
+  size_t           blk;
+  size_t           ind;
+  char             key[TANTO_KEY_MAXLEN];
+  char             obj[sizeof(tanto_fobj_t) + TANTO_INLINE_MAX];
+  tanto_file_t     file;
+  pthread_mutex_t *lock = NULL;
+
+  file.path[0] = 0;
+
+  for (blk = rec->from; blk < rec->to; blk += cnt)
+  {
+    cnt = rec->to - blk < TANTO_RECLAIM_BATCH ? 
+          rec->to - blk : TANTO_RECLAIM_BATCH;
+
+    lock = NULL;
+    live = 0;
+
+    if (!(rec->flags & TANTO_RECLAIM_DEL))
+    {
+      lock = tanto_lock(rec->ino);
+      live = tanto_file_load(&file, rec->ino) == 0;
+
+      if (live && file.fobj.nblocks > blk)
+      {
+        cnt = 0;
+        blk = file.fobj.nblocks;
+
+        tanto_unlock(lock);
+        continue;
+      }
+    }
+
+    if (tanto_blocks_unlink(rec->ino, blk, blk + cnt, 
+                            rec->flags & TANTO_RECLAIM_DIR) < 0 ||
+        (live && (rec->flags & TANTO_RECLAIM_AMAP) && 
+         tanto_amap_clear(&file, blk, blk + cnt) < 0))
+    {
+      if (lock)
+        tanto_unlock(lock);
+
+      return -EIO;
+    }
+
+    if (lock)
+      tanto_unlock(lock);
+
+    __sync_fetch_and_add(&tanto_ctx.stats.reclaim_blocks, cnt);
+  }
+
+  if (rec->flags & TANTO_RECLAIM_DEL)
+  {
+    for (ind = 0; (rec->flags & TANTO_RECLAIM_AMAP) && 
+                  ind * TANTO_AMAP_BITS < rec->to; ind++)
+    {
+      tanto_amap_key(key, rec->ino, ind);
+
+      if (tengine_del(tanto_engine(), key, strlen(key)) < 0)
+        return -EIO;
+    }
+
+    return 0;
+  }
+
+  /* 
+   * Nothing is left up to tblocks. Cached copies of the object may still
+   * have it set, that only costs an UNLINK should the file grow back. 
+   */
+  lock = tanto_lock(rec->ino);
+
+  if (tanto_file_load(&file, rec->ino) == 0 && file.fobj.tblocks &&
+      file.fobj.tblocks <= rec->to)
+  {
+    file.fobj.tblocks = 0;
+
+    if ((len = tanto_file_pack(&file, obj)) > 0)
+      tengine_set(tanto_engine(), file.key, file.keyl, obj, len);
+  }
+
+  tanto_unlock(lock);
+
+  return 0;
+}
+
+/*
+ * Reclaimer thread : take the oldest range off the queue, delete it and
+ * only then remove it, so a crash in between redoes it on the next mount.
+ * LREM rather than LPOP lets several mounts share the queue.
+ */
+static void *tanto_reclaim_main(void *arg)
+{
+  int              vlen;
+  struct timespec  ts;
+  tanto_reclaim_t  rec;
+
+  while (!tanto_ctx.reclaim_stop)
+  {
+    vlen = sizeof(rec);
+
+    if (tengine_lindex(tanto_engine(), TANTO_RECLAIM_KEY, 
+                     strlen(TANTO_RECLAIM_KEY), 0, &rec, &vlen) == 0 &&
+        vlen == sizeof(rec))
+    {
+      ytrace_msg(YTRACE_LEVEL1, "reclaim [%llx] %u - %u : %x\n",
+                 (unsigned long long)rec.ino, rec.from, rec.to, rec.flags);
+
+      if (tanto_reclaim_range(&rec) == 0)
+      {
+        tengine_lrem(tanto_engine(), TANTO_RECLAIM_KEY, 
+                   strlen(TANTO_RECLAIM_KEY), &rec, sizeof(rec));
+        continue;
+      }
+    }
+    else if (vlen > 0)
+    {
+      ytrace_msg(YTRACE_ERROR, "bad reclaim entry, %d bytes\n", vlen);
+
+      tengine_lrem(tanto_engine(), TANTO_RECLAIM_KEY, 
+                 strlen(TANTO_RECLAIM_KEY), &rec, vlen);
+      continue;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += TANTO_RECLAIM_WAIT;
+
+    pthread_mutex_lock(&tanto_ctx.reclaim_lock);
+
+    if (!tanto_ctx.reclaim_stop)
+      pthread_cond_timedwait(&tanto_ctx.reclaim_cond, 
+                             &tanto_ctx.reclaim_lock, &ts);
+
+    pthread_mutex_unlock(&tanto_ctx.reclaim_lock);
+  }
+
+  return NULL;
+}
+
+static void tanto_reclaim_start(void)
+{
+  if (pthread_create(&tanto_ctx.reclaim_thread, NULL, 
+                     tanto_reclaim_main, NULL) != 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "reclaimer start failed\n");
+    return;
+  }
+
+  tanto_ctx.reclaim_run = 1;
+}
+
+static void tanto_reclaim_stop(void)
+{
+  if (!tanto_ctx.reclaim_run)
+    return;
+
+  pthread_mutex_lock(&tanto_ctx.reclaim_lock);
+  tanto_ctx.reclaim_stop = 1;
+  pthread_cond_signal(&tanto_ctx.reclaim_cond);
+  pthread_mutex_unlock(&tanto_ctx.reclaim_lock);
+
+  pthread_join(tanto_ctx.reclaim_thread, NULL);
+
+  tanto_ctx.reclaim_run = 0;
+}
+
+/*
+ * Remove the object of file. Its blocks, buckets and bitmaps are queued for
+ * the reclaimer in the same round trip, so this takes one whatever the size.
+ */
+static int tanto_file_del(tanto_file_t *file)
+{
+  int              first;
+  char            *kptr[2];
+  int              klen[2];
+  void            *vptr[2];
+  int              vlen[2];
+  long             voff[2];
+  tanto_reclaim_t  rec;
+
+  ytrace_msg(YTRACE_LEVEL1, "delete file = %s [%llx]\n", 
+             file->path, (unsigned long long)file->ino);
+
+  memset(&rec, 0, sizeof(rec));
+
+  rec.ino   = file->ino;
+  rec.to    = file->fobj.nblocks > file->fobj.tblocks ? 
+              file->fobj.nblocks : file->fobj.tblocks;
+  rec.flags = TANTO_RECLAIM_DEL;
+
+  if (S_ISDIR(file->fobj.mode))
+    rec.flags |= TANTO_RECLAIM_DIR;
+  else if (file->fobj.flags & TANTO_FOBJ_AMAP)
+    rec.flags |= TANTO_RECLAIM_AMAP;
+
+  kptr[0] = TANTO_RECLAIM_KEY;                   /* queued before it goes */
+  klen[0] = strlen(TANTO_RECLAIM_KEY);
+  vptr[0] = &rec;
+  vlen[0] = sizeof(rec);
+  voff[0] = TENGINE_PUT_RPUSH;
+
+  kptr[1] = file->key;
+  klen[1] = file->keyl;
+  vptr[1] = NULL;
+  vlen[1] = 0;
+  voff[1] = TENGINE_PUT_SET;
+
+  first = rec.to ? 0 : 1;                   /* nothing to reclaim, no push */
+
+  if (tengine_mput(tanto_engine(), &kptr[first], &klen[first], 
+                 &vptr[first], &vlen[first], &voff[first], 2 - first, 
+                 NULL, NULL, NULL, NULL, 0) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "redis delete [%s] failed\n", file->path);
+    return -EIO;
+  }
+
+  tanto_bcache_inval(file->ino, 0, rec.to);
+
+  if (rec.flags & TANTO_RECLAIM_AMAP)
+    tanto_amap_inval(file->ino, rec.to);
+
+  if (rec.to)
+    tanto_reclaim_kick();
+
+  return 0;
+}
+
+static void tanto_fh_discard(uint64_t ino, size_t size);
+
+/* Drop one link to the object of file, removing it with the last one */
+static int tanto_file_unref(tanto_file_t *file)
+{
+  int              ret;
+  pthread_mutex_t *lock;
+
+  lock = tanto_lock(file->ino);
+
+  if (tanto_file_load(file, file->ino) < 0)
+  {
+    tanto_unlock(lock);
+    return -ENOENT;
+  }
+
+  if (--file->fobj.nlink > 0)
+  {
+    tanto_path_gen_bump();          /* other names, do not cache this one */
+
+    ret = tanto_file_sync(file);
+  }
+  else
+    ret = tanto_file_del(file);
+
+  tanto_unlock(lock);
+
+  if (file->fobj.nlink == 0)        /* fh_lock and fh->lock go before ours */
+    tanto_fh_discard(file->ino, 0);
+
+  return ret;
+}
+
+/*
+ * Directories are linear hash tables. Entry names hash to one of nblocks
+ * buckets, each bucket an "e:<ino>:<n>" value : a tanto_dirblk_t header and
+ * packed, variable length tanto_dirent_t entries naming inode numbers.
+ * Lookup, insert and delete touch a single bucket whatever the directory
+ * size. A bucket growing past TANTO_DIR_SPLIT bytes splits the next bucket
+ * in line, which keeps the average bucket around a block in size.
+ */
+
+/* Bucket of name in a table of n buckets */
+static int tanto_dir_bucket(uint32_t hash, int n)
+{
+  uint32_t lvl = 1;
+  uint32_t ind;
+
+  while (lvl * 2 <= n)
+    lvl *= 2;
+
+  ind = hash % (lvl * 2);
+
+  if (ind >= n)
+    ind = hash % lvl;
+
+  return ind;
+}
+
+/* Read bucket ind into buf, returns its length including the header */
+static int tanto_dir_read_bucket(tanto_file_t *dfile, int ind, char *buf)
+{
+  char            key[TANTO_KEY_MAXLEN];
+  int             keyl;
+  int             len;
+  tanto_dirblk_t *hdr = (tanto_dirblk_t *)buf;
+
+  if (ind >= dfile->fobj.nblocks)                /* empty table, no bucket */
+    len = 0;
+  else
+  {
+    keyl = tanto_dir_key(key, dfile->ino, ind);
+
+    if ((len = tengine_get(tanto_engine(), key, keyl, (void *)buf,
+                         TANTO_DIR_BUCKET_SIZE)) < 0)
+    {
+      ytrace_msg(YTRACE_LEVEL1, "dir bucket read [%s] failed\n", key);
+      return -1;
+    }
+  }
+
+  if (len < sizeof(tanto_dirblk_t))
+  {
+    hdr->magic   = TANTO_DIRBLK_MAGIC;
+    hdr->version = TANTO_DIRBLK_VERSION;
+    hdr->count   = 0;
+
+    return sizeof(tanto_dirblk_t);
+  }
+
+  if (hdr->magic != TANTO_DIRBLK_MAGIC || hdr->version != TANTO_DIRBLK_VERSION)
+  {
+    ytrace_msg(YTRACE_ERROR, "dir [%s] bucket %d : bad version %d\n",
+               dfile->path, ind, hdr->version);
+    return -1;
+  }
+
+  return len;
+}
+
+static int tanto_dir_write_bucket(tanto_file_t *dfile, int ind, 
+                                  char *buf, int len)
+{
+  char key[TANTO_KEY_MAXLEN];
+  int  keyl;
+
+  keyl = tanto_dir_key(key, dfile->ino, ind);
+
+  if (tengine_set(tanto_engine(), key, keyl, (void *)buf, len) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "dir bucket write [%s] failed\n", key);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Store a bucket that grew from olen to len bytes by appending entries. A
+ * stored bucket only gets its header rewritten and the new bytes APPENDed.
+ */
+static int tanto_dir_append_bucket(tanto_file_t *dfile, int ind, 
+                                   char *buf, int olen, int len)
+{
+  char   key[TANTO_KEY_MAXLEN];
+  int    keyl;
+  char  *kptr[2];
+  int    klen[2];
+  void  *vptr[2];
+  int    vlen[2];
+  long   voff[2];
+
+  if (olen <= sizeof(tanto_dirblk_t))           /* may not exist, full SET */
+    return tanto_dir_write_bucket(dfile, ind, buf, len);
+
+  keyl = tanto_dir_key(key, dfile->ino, ind);
+
+  kptr[0] = kptr[1] = key;
+  klen[0] = klen[1] = keyl;
+
+  vptr[0] = buf;
+  vlen[0] = sizeof(tanto_dirblk_t);
+  voff[0] = 0;
+
+  vptr[1] = &buf[olen];
+  vlen[1] = len - olen;
+  voff[1] = TENGINE_PUT_APPEND;
+
+  if (tengine_mput(tanto_engine(), kptr, klen, vptr, vlen, voff, 2,
+                 NULL, NULL, NULL, NULL, 0) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "dir bucket append [%s] failed\n", key);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Append a copy of de to the bucket in buf, returns the new length */
+static int tanto_dir_append(char *buf, int len, tanto_dirent_t *de)
+{
+  memcpy(&buf[len], de, tanto_dirent_size(de));
+
+  ((tanto_dirblk_t *)buf)->count++;
+
+  return len + tanto_dirent_size(de);
+}
+
+/* Split the next bucket in line, nblocks grows by one */
+static int tanto_dir_split(tanto_file_t *dfile)
+{
+  int             off;
+  int             len;
+  int             lold;
+  int             lnew;
+  int             n = dfile->fobj.nblocks;
+  int             src;
+  uint32_t        lvl = 1;
+  char            name[TANTO_NAME_MAX];
+  char            buf[TANTO_DIR_BUCKET_SIZE];
+  char            bold[TANTO_DIR_BUCKET_SIZE];
+  char            bnew[TANTO_DIR_BUCKET_SIZE];
+  tanto_dirent_t *de;
+
+  while (lvl * 2 <= n)
+    lvl *= 2;
+
+  src = n - lvl;
+
+  if ((len = tanto_dir_read_bucket(dfile, src, buf)) < 0)
+    return -1;
+
+  memcpy(bold, buf, sizeof(tanto_dirblk_t));
+  memcpy(bnew, buf, sizeof(tanto_dirblk_t));
+
+  ((tanto_dirblk_t *)bold)->count = 0;
+  ((tanto_dirblk_t *)bnew)->count = 0;
+
+  lold = lnew = sizeof(tanto_dirblk_t);
+
+  for (off = sizeof(tanto_dirblk_t); off < len; off += tanto_dirent_size(de))
+  {
+    de = (tanto_dirent_t *)&buf[off];
+
+    memcpy(name, de->name, de->namel);
+    name[de->namel] = 0;
+
+    if (tanto_hash(name) % (lvl * 2) == src)
+      lold = tanto_dir_append(bold, lold, de);
+    else
+      lnew = tanto_dir_append(bnew, lnew, de);
+  }
+
+  if (tanto_dir_write_bucket(dfile, n, bnew, lnew) < 0 ||
+      tanto_dir_write_bucket(dfile, src, bold, lold) < 0)
+    return -1;
+
+  dfile->fobj.nblocks++;
+
+  ytrace_msg(YTRACE_LEVEL1, "dir [%s] split bucket %d : %d + %d bytes\n",
+             dfile->path, src, lold, lnew);
+
+  return 0;
+}
+
+/* Find name in the bucket in buf, returns its offset or -1 */
+static int tanto_dir_find(char *buf, int len, const char *name)
+{
+  int             off;
+  int             namel = strlen(name);
+  tanto_dirent_t *de;
+
+  for (off = sizeof(tanto_dirblk_t); off < len; off += tanto_dirent_size(de))
+  {
+    de = (tanto_dirent_t *)&buf[off];
+
+    if (de->namel == namel && memcmp(de->name, name, namel) == 0)
+      return off;
+  }
+
+  return -1;
+}
+
+/* 
+ * Insert name into the hash table, updating dfile->fobj.nblocks in memory
+ * only. Returns 1 when the caller has to sync the directory object, -EEXIST
+ * if the name is taken.
+ */
+static int tanto_dir_insert(tanto_file_t *dfile, const char *name, 
+                            uint64_t ino, int type)
+{
+  int             ind;
+  int             len;
+  int             olen;
+  int             grown = 0;
+  uint32_t        hash = tanto_hash(name);
+  char            buf[TANTO_DIR_BUCKET_SIZE];
+  char            ebuf[sizeof(tanto_dirent_t) + TANTO_NAME_MAX];
+  tanto_dirent_t *de = (tanto_dirent_t *)ebuf;
+
+  de->ino   = ino;
+  de->type  = type;
+  de->namel = strnlen(name, TANTO_NAME_MAX - 1);
+
+  memcpy(de->name, name, de->namel);
+
+  if (dfile->fobj.nblocks == 0)                  /* first entry, bucket 0 */
+  {
+    ind = 0;
+    len = tanto_dir_read_bucket(dfile, ind, buf);
+
+    dfile->fobj.nblocks = 1;
+    grown = 1;
+  }
+  else for (;;)
+  {
+    ind = tanto_dir_bucket(hash, dfile->fobj.nblocks);
+
+    if ((len = tanto_dir_read_bucket(dfile, ind, buf)) < 0)
+      return -1;
+
+    if (tanto_dir_find(buf, len, name) >= 0)
+      return -EEXIST;
+
+    if (len + tanto_dirent_size(de) <= TANTO_DIR_BUCKET_SIZE)
+      break;
+
+    if (tanto_dir_split(dfile) < 0)               /* full, make some room */
+      return -1;
+
+    grown = 1;
+  }
+
+  olen = len;
+  len  = tanto_dir_append(buf, len, de);
+
+  if (tanto_dir_append_bucket(dfile, ind, buf, olen, len) < 0)
+    return -1;
+
+  if (len > TANTO_DIR_SPLIT)
+  {
+    if (tanto_dir_split(dfile) < 0)
+      return -1;
+
+    grown = 1;
+  }
+
+  return grown;
+}
+
+/* Add entry name -> ino to a directory, caller holds the directory lock */
+static int tanto_dir_add_file(tanto_file_t *dfile, const char *name, 
+                              uint64_t ino, mode_t mode)
+{
+  int ret;
+
+  ytrace_msg(YTRACE_LEVEL1, "%s: name = %s : ino = %llx\n", __func__, 
+             name, (unsigned long long)ino);
+
+  if ((ret = tanto_dir_insert(dfile, name, ino, IFTODT(mode))) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "tanto_dir_add_file : insert failed\n");
+    return ret == -EEXIST ? -EEXIST : -ENOMEM;
+  }
+
+  if (ret && tanto_file_sync(dfile) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "tanto_dir_add_file : meta update failed\n");
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
+static int tanto_dir_lookup(tanto_file_t *dfile, const char *name, 
+                            uint64_t *ino)
+{
+  int             ind;
+  int             off;
+  int             len;
+  char            buf[TANTO_DIR_BUCKET_SIZE];
+
+  ind = tanto_dir_bucket(tanto_hash(name), dfile->fobj.nblocks);
+
+  if ((len = tanto_dir_read_bucket(dfile, ind, buf)) < 0)
+    return -EIO;
+
+  if ((off = tanto_dir_find(buf, len, name)) < 0)
+    return -ENOENT;
+
+  *ino = ((tanto_dirent_t *)&buf[off])->ino;
+
+  return 0;
+}
+
+/* Remove entry name, caller holds the directory lock */
+static int tanto_dir_del_file(tanto_file_t *dfile, const char *name)
+{
+  int             ind;
+  int             off;
+  int             len;
+  int             entl;
+  char            buf[TANTO_DIR_BUCKET_SIZE];
+
+  ytrace_msg(YTRACE_LEVEL1, "%s: name = %s\n", __func__, name);
+
+  ind = tanto_dir_bucket(tanto_hash(name), dfile->fobj.nblocks);
+
+  if ((len = tanto_dir_read_bucket(dfile, ind, buf)) < 0)
+    return -ENOENT;
+
+  if ((off = tanto_dir_find(buf, len, name)) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "file %s not found in dir %s\n", 
+               name, dfile->path);
+    return -ENOENT;
+  }
+
+  entl = tanto_dirent_size((tanto_dirent_t *)&buf[off]);
+
+  memmove(&buf[off], &buf[off + entl], len - off - entl);
+
+  ((tanto_dirblk_t *)buf)->count--;
+
+  if (tanto_dir_write_bucket(dfile, ind, buf, len - entl) < 0)
+    return -ENOENT;
+
+  return 0;
+}
+
+/* Returns 1 if the directory has no entries */
+static int tanto_dir_empty(tanto_file_t *dfile)
+{
+  int  ind;
+  char buf[TANTO_DIR_BUCKET_SIZE];
+
+  for (ind = 0; ind < dfile->fobj.nblocks; ind++)
+  {
+    if (tanto_dir_read_bucket(dfile, ind, buf) < 0 ||
+        ((tanto_dirblk_t *)buf)->count)
+      return 0;
+  }
+
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*
+ *                         OPEN FILES / WRITE BACK                           *
+ *---------------------------------------------------------------------------*/
+
+/*
+ * Each open file buffers up to wbuf_blocks dirty blocks. Small and 
+ * sequential writes are absorbed in the buffer, a partial block is read
+ * at most once while it stays dirty, and the blocks go to the backend in
+ * one pipelined batch on flush, fsync, release or when the buffer is full.
+ * Block count growth is still synced right away, a byte size grown within
+ * the last block goes with the blocks and getattr adds it meanwhile.
+ *
+ * Lock order : fh_lock -> fh->lock -> tanto_lock(ino).
+ */
+
+static void tanto_fh_init(void)
+{
+  pthread_mutex_init(&tanto_ctx.fh_lock, NULL);
+
+  tanto_ctx.fh_list.prev = &tanto_ctx.fh_list;
+  tanto_ctx.fh_list.next = &tanto_ctx.fh_list;
+}
+
+static tanto_fh_t *tanto_fh_get(struct fuse_file_info *finfo)
+{
+  return finfo ? (tanto_fh_t *)(uintptr_t)finfo->fh : NULL;
+}
+
+static tanto_fh_t *tanto_fh_open(tanto_file_t *file)
+{
+  tanto_fh_t *fh;
+
+  if ((fh = calloc(1, sizeof(*fh))) == NULL)
+    return NULL;
+
+  pthread_mutex_init(&fh->lock, NULL);
+
+  fh->file = *file;
+
+  pthread_mutex_lock(&tanto_ctx.fh_lock);
+
+  fh->prev = &tanto_ctx.fh_list;
+  fh->next = tanto_ctx.fh_list.next;
+
+  tanto_ctx.fh_list.next->prev = fh;
+  tanto_ctx.fh_list.next       = fh;
+
+  pthread_mutex_unlock(&tanto_ctx.fh_lock);
+
+  return fh;
+}
+
+static void tanto_fh_close(tanto_fh_t *fh)
+{
+  pthread_mutex_lock(&tanto_ctx.fh_lock);
+
+  fh->prev->next = fh->next;
+  fh->next->prev = fh->prev;
+
+  pthread_mutex_unlock(&tanto_ctx.fh_lock);
+
+  free(fh->dirty);
+  free(fh);
+}
+
+/*
+ * Write all dirty blocks back, caller holds fh->lock. A size grown by the
+ * buffered writes is stored along with the last blocks.
+ */
+static int tanto_fh_flush(tanto_fh_t *fh)
+{
+  int     ind;
+  int     bcnt;
+  int     done;
+  int     ret  = 0;
+  int     sync = 0;
+  size_t  vblk[TANTO_BATCH_MAX];
+  void   *vptr[TANTO_BATCH_MAX];
+  size_t  voff[TANTO_BATCH_MAX];
+  size_t  vlen[TANTO_BATCH_MAX];
+  tanto_wblk_t    *wblk;
+  pthread_mutex_t *lock = NULL;
+
+  if (fh->size > tanto_file_size(&fh->file.fobj))
+  {
+    lock = tanto_lock(fh->file.ino);
+
+    if (tanto_file_reget(&fh->file) == 0 &&
+        fh->size > tanto_file_size(&fh->file.fobj))
+    {
+      tanto_file_resize(&fh->file.fobj, fh->size);
+      sync = 1;
+    }
+  }
+
+  for (done = 0; done < fh->ndirty; done += bcnt)
+  {
+    bcnt = fh->ndirty - done;
+
+    if (bcnt > TANTO_BATCH_MAX)
+      bcnt = TANTO_BATCH_MAX;
+
+    for (ind = 0; ind < bcnt; ind++)
+    {
+      wblk      = &fh->dirty[done + ind];
+      vblk[ind] = wblk->blk;
+      vptr[ind] = &wblk->data[wblk->lo];
+      voff[ind] = wblk->lo;
+      vlen[ind] = wblk->hi - wblk->lo;
+    }
+
+    if (tanto_file_put_blocks(&fh->file, vblk, vptr, voff, vlen, bcnt,
+                              sync && done + bcnt == fh->ndirty) < 0)
+    {
+      ret = -EIO;
+      goto out;
+    }
+  }
+
+  if (sync && fh->ndirty == 0 && tanto_file_sync(&fh->file) < 0)
+  {
+    ret = -EIO;
+    goto out;
+  }
+
+  if (fh->ndirty)
+    tanto_stats_inc(wbuf_flushes);
+
+  fh->ndirty = 0;
+  fh->size   = 0;
+
+out:
+  if (lock)
+    tanto_unlock(lock);
+
+  return ret;
+}
+
+/*
+ * Allocate the write buffer on first write, the entries followed by their
+ * blocks. Capped at TANTO_WBUF_MAX bytes as blocks may be large.
+ */
+static int tanto_fh_alloc(tanto_fh_t *fh)
+{
+  int     ind;
+  size_t  bsize = tanto_bsize();
+  char   *data;
+
+  fh->maxdirty = tanto_opt.wbuf_blocks;
+
+  if (fh->maxdirty > TANTO_WBUF_MAX / bsize)
+    fh->maxdirty = TANTO_WBUF_MAX / bsize;
+
+  if (fh->maxdirty < 1)
+    fh->maxdirty = 1;
+
+  if ((fh->dirty = malloc(fh->maxdirty * (sizeof(tanto_wblk_t) + bsize))) 
+      == NULL)
+    return -1;
+
+  data = (char *)&fh->dirty[fh->maxdirty];
+
+  for (ind = 0; ind < fh->maxdirty; ind++)
+    fh->dirty[ind].data = &data[ind * bsize];
+
+  return 0;
+}
+
+static tanto_wblk_t *tanto_fh_find(tanto_fh_t *fh, size_t blk)
+{
+  int ind;
+
+  for (ind = 0; ind < fh->ndirty; ind++)
+  {
+    if (fh->dirty[ind].blk == blk)
+      return &fh->dirty[ind];
+  }
+
+  return NULL;
+}
+
+/*
+ * Read the stored block under a buffered one whose dirty range is about to
+ * become discontiguous, keeping the buffered bytes. Caller holds fh->lock.
+ */
+static int tanto_fh_fill(tanto_fh_t *fh, tanto_wblk_t *wblk)
+{
+  int     ret;
+  size_t  bsize = tanto_bsize();
+  char   *data;
+
+  if ((data = malloc(bsize)) == NULL)
+    return -ENOMEM;
+
+  if ((ret = tanto_file_read_blocks(&fh->file, wblk->blk, 1, data)) == 0)
+  {
+    memcpy(&data[wblk->lo], &wblk->data[wblk->lo], wblk->hi - wblk->lo);
+    memcpy(wblk->data, data, bsize);
+
+    wblk->lo = 0;
+    wblk->hi = bsize;
+  }
+
+  free(data);
+
+  return ret < 0 ? -EIO : 0;
+}
+
+/*
+ * Buffer a write, caller holds fh->lock. Only the written range of a block
+ * is kept, the rest is read when the range would have a gap.
+ */
+static int tanto_fh_write(tanto_fh_t *fh, const char *buf, 
+                          size_t size, size_t offset)
+{
+  int              ret;
+  size_t           blk;
+  size_t           ioffset;
+  size_t           tsize;
+  size_t           nblocks;
+  size_t           oblocks;
+  size_t           end;
+  size_t           bsize = tanto_bsize();
+  tanto_file_t     file;
+  tanto_wblk_t    *wblk;
+  pthread_mutex_t *lock;
+
+  if (fh->file.fobj.nblocks == 0 ||                /* may go or be inline */
+      (fh->file.fobj.flags & TANTO_FOBJ_INLINE))
+  {
+    lock = tanto_lock(fh->file.ino);
+
+    ret = tanto_file_reget(&fh->file);
+
+    if (ret == 0)
+      ret = tanto_file_inline_write(&fh->file, buf, size, offset);
+
+    tanto_unlock(lock);
+
+    if (ret != 0)
+      return ret < 0 ? ret : 0;
+  }
+
+  if (fh->dirty == NULL && tanto_fh_alloc(fh) < 0)
+    return -ENOMEM;
+
+  end     = offset + size;
+  nblocks = (end + bsize - 1) / bsize;
+  oblocks = fh->file.fobj.nblocks;
+
+  if (nblocks > fh->file.fobj.nblocks)  /* grow first, blocks may be flushed */
+  {
+    lock = tanto_lock(fh->file.ino);
+
+    file = fh->file;
+
+    if ((ret = tanto_file_reget(&file)) == 0 && 
+        (oblocks = file.fobj.nblocks) < nblocks)
+    {
+      if (tanto_file_size(&file.fobj) < end)
+        tanto_file_resize(&file.fobj, end);
+
+      if ((ret = tanto_file_grow(&file, nblocks)) == 0)
+        ret = tanto_file_sync(&file);
+    }
+
+    if (ret == 0)
+      fh->file.fobj = file.fobj;
+
+    tanto_unlock(lock);
+
+    if (ret < 0)
+      return -EIO;
+  }
+
+  while (size)
+  {
+    blk     = offset / bsize;
+    ioffset = offset % bsize;
+    tsize   = bsize - ioffset;
+
+    if (tsize > size)
+      tsize = size;
+
+    if ((wblk = tanto_fh_find(fh, blk)) == NULL)
+    {
+      if (fh->ndirty == fh->maxdirty && tanto_fh_flush(fh) < 0)
+        return -EIO;
 
-  fobj.mode  = mode;
-  fobj.uid   = uid;
-  fobj.gid   = gid;
-  fobj.seqno = cur_us/1000/1000;                       /* convert to seconds */
-  fobj.modtime = cur_us * 1000;                           /* in nano seconds */
-  fobj.actime  = cur_us * 1000;
-  fobj.ctime   = cur_us * 1000;
+      wblk      = &fh->dirty[fh->ndirty];
+      wblk->blk = blk;
+      wblk->lo  = ioffset;
+      wblk->hi  = ioffset;
 
-  if (redis_set(tanto_redis_ctx(), key, keyl, 
-                (void *)&fobj, sizeof(tanto_fobj_t)) < 0)
-  {
-    ytrace_msg(YTRACE_ERROR, "set %s failed\n", key);
-    return -ENOMEM;
-  }
+      if (tsize != bsize && blk >= oblocks)
+      {
+        memset(wblk->data, 0, bsize);                    /* past the end */
+        wblk->lo = 0;
+        wblk->hi = bsize;
+      }
 
-  return 0;
-}
+      fh->ndirty++;
+    }
+    else if ((ioffset > wblk->hi || ioffset + tsize < wblk->lo) &&
+             (ret = tanto_fh_fill(fh, wblk)) < 0)
+      return ret;
 
-static int tanto_get_obj(tanto_fobj_t *fobj, const char *path)
-{
-  char key[TANTO_KEY_MAXLEN];
-  int  keyl;
+    memcpy(&wblk->data[ioffset], buf, tsize);
 
-  ytrace_msg(YTRACE_LEVEL1, "path = %s\n", path);
+    if (wblk->lo > ioffset)
+      wblk->lo = ioffset;
 
-  keyl = tanto_stat_key(key, path);
+    if (wblk->hi < ioffset + tsize)
+      wblk->hi = ioffset + tsize;
 
-  if (redis_get(tanto_redis_ctx(), key, keyl, 
-                (void *)fobj, sizeof(tanto_fobj_t)) < 0) 
-  {
-    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n",
-               key, keyl);
-    return -ENOENT;
+    buf    += tsize;
+    offset += tsize;
+    size   -= tsize;
   }
-  
-  return 0;
-}
-
-static int tanto_file_get(tanto_file_t *file, const char *path)
-{
-  ytrace_msg(YTRACE_LEVEL1, "path = %s\n", path);
 
-  strcpy(file->path, path);
+  tanto_stats_inc(wbuf_writes);
 
-  file->keyl = tanto_stat_key(file->key, path);
+  if (fh->size < end)                       /* stored on flush, see getattr */
+    fh->size = end;
 
-  if (redis_get(tanto_redis_ctx(), file->key, file->keyl, 
-                (void *)&file->fobj, sizeof(tanto_fobj_t)) < 0) 
-  {
-    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n",
-               file->key, file->keyl);
-    return -ENOENT;
-  }
-  
   return 0;
 }
 
-static int tanto_file_sync(tanto_file_t *file)
+/* Copy buffered bytes over data read for [offset, offset + size) */
+static void tanto_fh_overlay(tanto_fh_t *fh, size_t offset, size_t size, 
+                             char *data)
 {
-  ytrace_msg(YTRACE_LEVEL1, "path = %s %s\n", file->path, file->key);
+  int            ind;
+  size_t         lo;
+  size_t         hi;
+  size_t         bsize = tanto_bsize();
+  tanto_wblk_t  *wblk;
 
-  if (redis_set(tanto_redis_ctx(), file->key, file->keyl, 
-                (void *)&file->fobj, sizeof(tanto_fobj_t)) < 0) 
+  for (ind = 0; ind < fh->ndirty; ind++)
   {
-    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n",
-               file->key, file->keyl);
-    return -ENOENT;
-  }
-  
-  return 0;
-}
-
-static int tanto_file_read(tanto_file_t *file,
-                           size_t blk_ind, void *data, size_t datal)
-{
-  char key[TANTO_KEY_MAXLEN];
-  int  keyl;
+    wblk = &fh->dirty[ind];
+    lo   = wblk->blk * bsize + wblk->lo;
+    hi   = wblk->blk * bsize + wblk->hi;
 
-  ytrace_msg(YTRACE_LEVEL1, "block_ind = %lu\n", (unsigned long)blk_ind);
+    if (lo < offset)
+      lo = offset;
 
-  keyl = tanto_data_key(key, file->path, blk_ind);
+    if (hi > offset + size)
+      hi = offset + size;
 
-  if (redis_get(tanto_redis_ctx(), key, keyl, data, datal) < 0)
-  {
-    ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n", key, keyl);
-    return -ENOENT;
+    if (lo < hi)
+      memcpy(&data[lo - offset], &wblk->data[lo - wblk->blk * bsize], 
+             hi - lo);
   }
-  
-  return 0;
 }
 
-static int tanto_file_write(tanto_file_t *file, 
-                            void *data, size_t size, size_t offset)
+/* Drop buffered bytes from size on, in every handle open on inode ino */
+static void tanto_fh_discard(uint64_t ino, size_t size)
 {
-  int     keyl;
-  void   *bp;
-  size_t  blk_ind = 0;
-  size_t  noffset;
-  size_t  ioffset;
-  size_t  tsize;
-  size_t  rem = size;
-  char    key[TANTO_KEY_MAXLEN];
-  char    ldata[TANTO_BLOCK_SIZE];
-  size_t  nblocks = 0;
-
-  while (rem)
-  {
-    noffset = (offset + TANTO_BLOCK_SIZE) & ~(TANTO_BLOCK_SIZE - 1);
-    
-    tsize   = noffset - offset;
-    blk_ind = offset / TANTO_BLOCK_SIZE;
+  int           ind;
+  int           nkeep;
+  size_t        bsize = tanto_bsize();
+  size_t        blk   = tanto_block_align(size) / bsize;
+  tanto_wblk_t  wblk;
+  tanto_fh_t   *fh;
 
-    ytrace_msg(YTRACE_LEVEL1, "block_ind = %lu\n", (unsigned long)blk_ind);
+  pthread_mutex_lock(&tanto_ctx.fh_lock);
 
-    keyl    = tanto_data_key(key, file->path, blk_ind);
-    bp      = data;
+  for (fh = tanto_ctx.fh_list.next; fh != &tanto_ctx.fh_list; fh = fh->next)
+  {
+    if (fh->file.ino != ino)
+      continue;
 
-    if (rem < tsize)
-      tsize = rem;
+    pthread_mutex_lock(&fh->lock);
 
-    if (tsize != TANTO_BLOCK_SIZE)
+    for (ind = 0, nkeep = 0; ind < fh->ndirty; ind++)
     {
-      ioffset = offset - blk_ind * TANTO_BLOCK_SIZE;
-
-      if (redis_get(tanto_redis_ctx(), key, keyl, ldata, TANTO_BLOCK_SIZE) < 0)
-        memset(ldata, 0, TANTO_BLOCK_SIZE);
+      if (fh->dirty[ind].blk == size / bsize &&     /* the new last block */
+          fh->dirty[ind].hi > size % bsize)
+        fh->dirty[ind].hi = size % bsize;
 
-      memcpy(&ldata[ioffset], (char *)bp, tsize);
-
-      bp = ldata;
+      if (fh->dirty[ind].blk < blk &&          /* swap, data is not moved */
+          fh->dirty[ind].lo < fh->dirty[ind].hi)
+      {
+        wblk               = fh->dirty[nkeep];
+        fh->dirty[nkeep++] = fh->dirty[ind];
+        fh->dirty[ind]     = wblk;
+      }
     }
 
-    if (redis_set(tanto_redis_ctx(), key, keyl, bp, TANTO_BLOCK_SIZE) < 0) 
-    {
-      ytrace_msg(YTRACE_LEVEL1, "redis key get [%s][%d] failed\n", key, keyl);
-      return -ENOENT;
-    }
+    fh->ndirty = nkeep;
 
-    nblocks++;
+    if (fh->size > size)
+      fh->size = size;
 
-    rem    -= tsize;
-    offset += tsize;
-    data    = (void *)((char *)data + tsize);
-  }
+    if (fh->file.fobj.nblocks > blk)
+      fh->file.fobj.nblocks = blk;
 
-  ytrace_msg(YTRACE_LEVEL1, "nblocks = %lu : blk_ind = %lu\n" , 
-             file->fobj.nblocks, blk_ind);
+    if (tanto_file_size(&fh->file.fobj) > size)
+      tanto_file_resize(&fh->file.fobj, size);
 
-  if (file->fobj.nblocks < blk_ind)                 /* update on size change */
-  {
-    file->fobj.nblocks = blk_ind;
-    tanto_file_sync(file);
+    pthread_mutex_unlock(&fh->lock);
   }
 
-  return 0;
+  pthread_mutex_unlock(&tanto_ctx.fh_lock);
 }
 
-static int tanto_file_del(tanto_file_t *file)
+static int tanto_split_name(const char *path, char *dir, int dirl, 
+                            char *base, int basel)
 {
-  size_t  ind;
-  char    key[TANTO_KEY_MAXLEN];
-  int     keyl;
-
-  ytrace_msg(YTRACE_LEVEL1, "delete file = %s\n", file->path);
+  const char *bp;
+  const char *lp;
 
-  /* First remove the entry */
-  redis_del(tanto_redis_ctx(), file->key, file->keyl);
+  bp = lp = path;
 
-  for (ind = 0; ind < file->fobj.nblocks; ind++)
+  while (*bp)
   {
-    keyl = tanto_data_key(key, file->path, ind);
+    if (*bp == '/')
+    {
+      if (bp[1])                              /* assume normalized file name */
+        lp = bp + 1;
+    }
 
-    redis_del(tanto_redis_ctx(), key, keyl);
+    bp++;
   }
 
+  dirl = lp - path;
+
+  strncpy(dir, path, dirl);
+  dir[dirl] = 0;
+
+  if (dirl > 1 && dir[dirl - 1] == '/')
+    dir[dirl - 1] = 0;
+
+  strncpy(base, &path[dirl], basel);
+
+  ytrace_msg(YTRACE_LEVEL1, "tanto_split_name : [%s] [%s] [%s]\n", 
+             path, dir, base);
+
   return 0;
 }
 
-static int tanto_dir_add_file(tanto_file_t *dfile, const char *path)
+/*---------------------------------------------------------------------------*
+ *                          OLD LAYOUT CONVERSION                            *
+ *---------------------------------------------------------------------------*/
+
+/*
+ * Trees written by older versions are keyed by path. When a mount finds no
+ * root inode but an old root object, the tree is converted once : every 
+ * object gets an inode number, data blocks are RENAMEd to their new keys
+ * and directories, in any of the older layouts, are rebuilt as packed 
+ * buckets. The root object is written last. An interrupted conversion is
+ * not resumed, so save the redis database before the first mount.
+ */
+
+#define TANTO_OLD_BUCKET_SIZE (TANTO_DIR_BUCKET_MAX * sizeof(tanto_dobj_t))
+
+/* Read block or bucket ind of an old directory, returns its length */
+static int tanto_old_dir_read(const char *path, tanto_fobj_t *fobj, int ind,
+                              char *buf)
 {
-  char key[TANTO_KEY_MAXLEN];
+  char key[TANTO_KEY_MAXLEN + 32];
   int  keyl;
-  int  ind;
-  int  ind2;
-  char  data[TANTO_BLOCK_SIZE];
-  tanto_dobj_t *dobj;
-  tanto_fobj_t *dir = &dfile->fobj;
-
-  ytrace_msg(YTRACE_LEVEL1, "%s: path = %s\n", __func__, path);
 
-  for (ind = 0; ind < dir->nblocks; ind++)
-  {
-    keyl = tanto_data_key(key, dfile->path, ind);
+  if (fobj->flags & TANTO_FOBJ_PACKDIR)
+    keyl = tanto_old_dent_key(key, path, ind);
+  else if (fobj->flags & TANTO_FOBJ_HASHDIR)
+    keyl = tanto_old_hdir_key(key, path, ind);
+  else
+    keyl = tanto_old_data_key(key, path, ind);
 
-    if (redis_get(tanto_redis_ctx(), key, keyl, 
-                  (void *)data, sizeof(data)) < 0)
-    {
-      ytrace_msg(YTRACE_LEVEL1, "tanto_dir_add_file : block read failed\n");
-      return -ENOENT;
-    }
+  return tengine_get(tanto_engine(), key, keyl, buf, TANTO_OLD_BUCKET_SIZE);
+}
 
-    dobj = (tanto_dobj_t *)data;
-    
-    for (ind2 = 0; ind2 < TANTO_BLOCK_DIR_MAX; ind2++)
-    {
-      if (dobj[ind2].name[0] == '\0')                          /* free entry */
-      {
-        strcpy(dobj[ind2].name, path);
+/* Next name in an old directory block, returns 0 at the end */
+static int tanto_old_dir_next(tanto_fobj_t *fobj, char *buf, int len, 
+                              int *pos, char *name)
+{
+  tanto_dobj_t   *dobj = (tanto_dobj_t *)buf;
+  tanto_dirent_t *de;
 
-        if (redis_set(tanto_redis_ctx(), key, keyl, 
-	              (void *)data, sizeof(data)) < 0)
-        {
-          ytrace_msg(YTRACE_LEVEL1, "block read failed\n");
-          return -ENOENT;
-        }
+  if (fobj->flags & TANTO_FOBJ_PACKDIR)
+  {
+    if (*pos < sizeof(tanto_dirblk_t))
+      *pos = sizeof(tanto_dirblk_t);
 
-	return 0;                                   /* reused an entry, done */
-      }
-    }
-  }
+    if (*pos >= len)
+      return 0;
 
-  /* No free entry found. Add another block */
-  keyl = tanto_data_key(key, dfile->path, ind);
+    de = (tanto_dirent_t *)&buf[*pos];
 
-  ytrace_msg(YTRACE_LEVEL1, "Adding new entry to dir [%s] : [%s] \n",
-             dfile->path, path);
+    memcpy(name, de->name, de->namel);
+    name[de->namel] = 0;
 
-  memset(data, 0, sizeof(data));
+    *pos += tanto_dirent_size(de);
 
-  dobj = (tanto_dobj_t *)data;
-  strcpy(dobj[0].name, path);
+    return 1;
+  }
 
-  if (redis_set(tanto_redis_ctx(), key, keyl, (void *)data, sizeof(data)) < 0)
+  for (; (*pos + 1) * sizeof(tanto_dobj_t) <= len; (*pos)++)
   {
-    ytrace_msg(YTRACE_LEVEL1, "tanto_dir_add_file : new block add failed\n");
-    return -ENOMEM;
-  }
+    if (dobj[*pos].name[0] == '\0')
+      continue;
 
-  dir->nblocks++;                                       /* add another block */
+    strncpy(name, dobj[*pos].name, TANTO_NAME_MAX - 1);
+    name[TANTO_NAME_MAX - 1] = 0;
 
-  ytrace_msg(YTRACE_LEVEL1, "new block count [%s] : [%d] \n",
-             dfile->path, dir->nblocks);
+    (*pos)++;
 
-  if (redis_set(tanto_redis_ctx(), dfile->key, dfile->keyl, 
-                (void *)dir, sizeof(tanto_fobj_t)) < 0)
-  {
-    ytrace_msg(YTRACE_LEVEL1, "tanto_dir_add_file : meta update failed\n");
-    return -ENOMEM;
+    return 1;
   }
 
   return 0;
 }
 
-static int tanto_dir_del_file(tanto_file_t *dfile, const char *path)
+static int tanto_convert_obj(const char *path, tanto_fobj_t *fobj, 
+                             uint64_t ino)
 {
-  char key[TANTO_KEY_MAXLEN];
-  int  keyl;
-  int  ind;
-  int  ind2;
-  char  data[TANTO_BLOCK_SIZE];
-  tanto_dobj_t *dobj;
-  tanto_fobj_t *dir = &dfile->fobj;
-
-  ytrace_msg(YTRACE_LEVEL1, "%s: path = %s\n", __func__, path);
-
-  for (ind = 0; ind < dir->nblocks; ind++)
+  int           ind;
+  int           pos;
+  int           len;
+  int           ret = 0;
+  char          key[TANTO_KEY_MAXLEN + 32];
+  char          nkey[TANTO_KEY_MAXLEN];
+  int           keyl;
+  char          name[TANTO_NAME_MAX];
+  char          cpath[TANTO_PATH_MAXLEN];
+  char         *buf;
+  tanto_fobj_t  cfobj;
+  uint64_t      cino;
+  tanto_file_t  nfile;
+
+  ytrace_msg(YTRACE_LEVEL1, "convert [%s] -> %llx\n", 
+             path, (unsigned long long)ino);
+
+  strcpy(nfile.path, path);
+
+  nfile.ino        = ino;
+  nfile.gen        = tanto_ctx.path_gen;
+  nfile.keyl       = tanto_stat_key(nfile.key, ino);
+  nfile.fobj       = *fobj;
+  nfile.fobj.nlink = 1;
+  nfile.fobj.bsize = 0;        /* never recorded, the slot holds stack bytes */
+
+  if (S_ISDIR(fobj->mode))
   {
-    keyl = tanto_data_key(key, dfile->path, ind);
+    if ((buf = malloc(TANTO_OLD_BUCKET_SIZE)) == NULL)
+      return -1;
 
-    if (redis_get(tanto_redis_ctx(), key, keyl, 
-                  (void *)data, sizeof(data)) < 0)
-    {
-      ytrace_msg(YTRACE_LEVEL1, "block read failed\n");
-      return -ENOENT;
-    }
+    nfile.fobj.flags   = TANTO_FOBJ_HASHDIR | TANTO_FOBJ_PACKDIR;
+    nfile.fobj.nblocks = 0;
 
-    dobj = (tanto_dobj_t *)data;
-    
-    for (ind2 = 0; ind2 < TANTO_BLOCK_DIR_MAX; ind2++)
+    for (ind = 0; ind < fobj->nblocks && ret == 0; ind++)
     {
-      if (dobj[ind2].name[0] == '\0')                          /* free entry */
+      if ((len = tanto_old_dir_read(path, fobj, ind, buf)) < 0)
         continue;
 
-      if (strcmp(dobj[ind2].name, path) == 0)
+      for (pos = 0; ret == 0 && tanto_old_dir_next(fobj, buf, len, &pos, name);)
       {
-        ytrace_msg(YTRACE_LEVEL1, "removing file %s in dir %s\n",
-	           path, dfile->path);
+        snprintf(cpath, sizeof(cpath), "%s/%s", 
+                 strcmp(path, "/") ? path : "", name);
+
+        keyl = tanto_old_stat_key(key, cpath);
 
-	dobj[ind2].name[0] = 0;
-	dobj[ind2].flags = 0;
-	dobj[ind2].seqno = 0;
+        memset(&cfobj, 0, sizeof(cfobj));
 
-        /* Sync back to backend */
-        redis_set(tanto_redis_ctx(), key, keyl, (void *)data, sizeof(data));
+        if (tengine_get(tanto_engine(), key, keyl, 
+                      (void *)&cfobj, sizeof(cfobj)) < 0)
+          continue;                                      /* dangling entry */
 
-	return 0;             
+        if (tanto_ino_alloc(&cino) < 0 ||
+            tanto_convert_obj(cpath, &cfobj, cino) < 0 ||
+            tanto_dir_insert(&nfile, name, cino, IFTODT(cfobj.mode)) < 0)
+          ret = -1;
       }
+
+      if (fobj->flags & TANTO_FOBJ_PACKDIR)
+        keyl = tanto_old_dent_key(key, path, ind);
+      else if (fobj->flags & TANTO_FOBJ_HASHDIR)
+        keyl = tanto_old_hdir_key(key, path, ind);
+      else
+        keyl = tanto_old_data_key(key, path, ind);
+
+      if (ret == 0)
+        tengine_del(tanto_engine(), key, keyl);
     }
+
+    free(buf);
+  }
+  else
+  {
+    for (ind = 0; ind < fobj->nblocks; ind++)  /* unwritten blocks fail, ok */
+    {
+      keyl = tanto_old_data_key(key, path, ind);
+
+      tengine_rename(tanto_engine(), key, keyl, nkey, 
+                   tanto_data_key(nkey, ino, ind));
+    }
+  }
+
+  if (ret < 0 || 
+      tengine_set(tanto_engine(), nfile.key, nfile.keyl, 
+                (void *)&nfile.fobj, sizeof(tanto_fobj_t)) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "convert [%s] failed\n", path);
+    return -1;
   }
 
-  ytrace_msg(YTRACE_LEVEL1, "file %s not found in dir %s\n", path, dfile->path);
+  keyl = tanto_old_stat_key(key, path);
+
+  tengine_del(tanto_engine(), key, keyl);
 
-  return -ENOENT;
+  return 0;
 }
 
-int tanto_split_name(const char *path, char *dir, int dirl, 
-                     char *base, int basel)
+/* Convert a path keyed tree if there is one, returns 1 if there was none */
+static int tanto_convert(void)
 {
-  const char *bp;
-  const char *lp;
+  char          key[TANTO_KEY_MAXLEN];
+  int           keyl;
+  tanto_fobj_t  fobj;
 
-  bp = lp = path;
+  keyl = tanto_old_stat_key(key, "/");
 
-  while (*bp)
+  memset(&fobj, 0, sizeof(fobj));
+
+  if (tengine_get(tanto_engine(), key, keyl, 
+                (void *)&fobj, sizeof(fobj)) < 0)
+    return 1;
+
+  ytrace_msg(YTRACE_DEFAULT, "converting path keyed tree to inodes\n");
+
+  return tanto_convert_obj("/", &fobj, TANTO_INO_ROOT);
+}
+
+/*
+ * The data block size is fixed when the root is created, from block_size,
+ * and kept in the bsize field of the root object, 0 means TANTO_BLOCK_SIZE.
+ * Path keyed trees always used TANTO_BLOCK_SIZE but left uninitialised 
+ * bytes in that field, tanto_convert_obj clears it.
+ */
+static int tanto_block_size_ok(size_t bsize)
+{
+  return bsize >= TANTO_BLOCK_SIZE && bsize <= TANTO_BLOCK_MAX && 
+         (bsize & (bsize - 1)) == 0;
+}
+
+/* 
+ * Open the storage engine and load the root, converting an older tree or 
+ * creating a new one. Sets the block size of the tree.
+ */
+static int tanto_mount(void)
+{
+  int             ret;
+  const char     *step = "load the root";
+  tanto_file_t    file;
+  tengine_conf_t  conf;
+
+  conf.host      = tanto_opt.redis_host;
+  conf.port      = tanto_opt.redis_port;
+  conf.pool_size = tanto_opt.pool_size;
+  conf.nodelay   = tanto_opt.tcp_nodelay;
+  conf.keepalive = tanto_opt.tcp_keepalive;
+  conf.sndbuf    = tanto_opt.sock_sndbuf;
+  conf.rcvbuf    = tanto_opt.sock_rcvbuf;
+  conf.path      = tanto_opt.path;
+  conf.sync_ms   = tanto_opt.sync_ms;
+
+  if (tengine_open(tanto_engine(), tanto_opt.engine, &conf) < 0)
   {
-    if (*bp == '/')
+    ytrace_msg(YTRACE_ERROR, "%s engine init failed\n", 
+               tanto_opt.engine ? tanto_opt.engine : "redis");
+    return -1;
+  }
+
+  if ((ret = tanto_file_load(&file, TANTO_INO_ROOT)) < 0)
+  {
+    step = "convert the path keyed tree";
+
+    if ((ret = tanto_convert()) == 0)
+      ret = tanto_file_load(&file, TANTO_INO_ROOT);
+    else if (ret > 0)                                          /* new tree */
     {
-      if (bp[1])                              /* assume normalized file name */
-        lp = bp + 1;
-    }
+      step = "create the root";
 
-    bp++;
-  }
+      if ((ret = tanto_add_obj(&file, TANTO_INO_ROOT, 
+                               S_IFDIR|0755, 0, 0)) == 0)
+      {
+        strcpy(file.path, "/");
+        file.gen        = tanto_ctx.path_gen;
+        file.fobj.bsize = tanto_opt.block_size;
 
-  dirl = lp - path;
+        ret = tanto_file_sync(&file);
+      }
+    }
+  }
 
-  strncpy(dir, path, dirl);
-  dir[dirl] = 0;
+  if (ret < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "%s engine : failed to %s\n",
+               tanto_engine()->ops->name, step);
+    tengine_close(tanto_engine());
+    return -1;
+  }
 
-  if (dirl > 1 && dir[dirl - 1] == '/')
-    dir[dirl - 1] = 0;
+  tanto_ctx.bsize = file.fobj.bsize ? file.fobj.bsize : TANTO_BLOCK_SIZE;
 
-  strncpy(base, &path[dirl], basel);
+  if (!tanto_block_size_ok(tanto_ctx.bsize))
+  {
+    ytrace_msg(YTRACE_ERROR, "bad block size %lu in root\n", 
+               (unsigned long)tanto_ctx.bsize);
+    tengine_close(tanto_engine());
+    return -1;
+  }
 
-  ytrace_msg(YTRACE_LEVEL1, "tanto_split_name : [%s] [%s] [%s]\n", 
-             path, dir, base);
+  return 0;
 }
 
 static void tanto_init()
 {
-  tanto_file_t file;
+  int             ind;
 
-  if (redis_connect(tanto_redis_ctx(), NULL, 0) < 0)
-  {
-    ytrace_msg(YTRACE_LEVEL1, "thread [%ld] : redis connect failed\n",
-               (long int)pthread_self());
+  for (ind = 0; ind < TANTO_LOCK_STRIPES; ind++)
+    pthread_mutex_init(&tanto_ctx.locks[ind], NULL);
+
+  tanto_acache_init();
+  tanto_amap_init();
+  tanto_fh_init();
+  tanto_zero_init();
+
+  pthread_mutex_init(&tanto_ctx.reclaim_lock, NULL);
+  pthread_cond_init(&tanto_ctx.reclaim_cond, NULL);
+
+  if (tanto_mount() < 0)
     exit(0);
-  }
 
-  if (tanto_file_get(&file, "/") < 0)
-    tanto_add_obj("/", S_IFDIR|0755, 0, 0);
+  ytrace_msg(YTRACE_DEFAULT, "block size = %lu\n", 
+             (unsigned long)tanto_ctx.bsize);
+
+  /* 
+   * Checked here so that errors reach the terminal, then closed: engine
+   * connections, files and locks are not to be carried over the fork of
+   * fuse_main, tanto_start opens the engine again in the daemon.
+   */
+  tengine_close(tanto_engine());
+
+  tanto_bcache_init();
 }
 
 
@@ -469,6 +3528,24 @@ static void tanto_init()
  *                            FUSE CALLBACKS                                 *
  *---------------------------------------------------------------------------*/
 
+/* Grow size to the end of writes buffered in handles open on inode ino */
+static size_t tanto_fh_size(uint64_t ino, size_t size)
+{
+  tanto_fh_t *fh;
+
+  pthread_mutex_lock(&tanto_ctx.fh_lock);
+
+  for (fh = tanto_ctx.fh_list.next; fh != &tanto_ctx.fh_list; fh = fh->next)
+  {
+    if (fh->file.ino == ino && fh->size > size)
+      size = fh->size;
+  }
+
+  pthread_mutex_unlock(&tanto_ctx.fh_lock);
+
+  return size;
+}
+
 static int tanto_getattr(const char *path, struct stat *stbuf)
 {
   tanto_fobj_t *fobj;
@@ -487,36 +3564,81 @@ static int tanto_getattr(const char *path, struct stat *stbuf)
   fobj = &file.fobj;
 
   stbuf->st_dev   = 0x12345678;
-  stbuf->st_ino   = fobj->seqno;
-  stbuf->st_nlink = 1;
+  stbuf->st_ino   = file.ino;
+  stbuf->st_nlink = fobj->nlink;
   stbuf->st_mode  = fobj->mode;
   stbuf->st_uid   = fobj->uid;
   stbuf->st_gid   = fobj->gid;
-  stbuf->st_size  = fobj->nblocks * TANTO_BLOCK_SIZE;
-  stbuf->st_blksize = TANTO_BLOCK_SIZE;
-  stbuf->st_blocks  = fobj->nblocks;
+  stbuf->st_size  = tanto_file_size(fobj);
+  stbuf->st_blksize = tanto_bsize();
+  stbuf->st_blocks  = fobj->nblocks * (tanto_bsize() / 512);
+
+  if (S_ISREG(fobj->mode))
+    stbuf->st_size = tanto_fh_size(file.ino, stbuf->st_size);
 
   tanto_ns2timespec(&stbuf->st_atim, fobj->actime);
   tanto_ns2timespec(&stbuf->st_mtim, fobj->modtime);
   tanto_ns2timespec(&stbuf->st_ctim, fobj->ctime);
 
   ytrace_msg(YTRACE_LEVEL1, "seq = %d : mode = %o : size = %lu = actime = %lu\n",
-             fobj->seqno, fobj->mode, fobj->nblocks * TANTO_BLOCK_SIZE,
+             fobj->seqno, fobj->mode, (unsigned long)stbuf->st_size,
 	     fobj->actime);
 
   return 0;
 }
 
-static int tanto_getdir(const char *path, fuse_dirh_t h, fuse_dirfil_t filler)
+/*
+ * Directory offsets are cursors that deletes do not move : bucket + 1 in 
+ * the upper bits, the name hash of the last entry listed and a low bit set
+ * when more names of that hash are left in the bucket. Buckets are listed
+ * in hash order and a call resumes past the hash of the cursor, or at it 
+ * if the bit is set. A split moves entries to a later bucket, so they can
+ * be listed twice but never skipped.
+ */
+#define TANTO_DIR_OFF(ind, hash, more) \
+        ((((off_t)(ind) + 1) << 33) | ((off_t)(hash) << 1) | (more))
+
+#define TANTO_DIR_ENTS_MAX \
+        (TANTO_DIR_BUCKET_SIZE / (sizeof(tanto_dirent_t) + 1))
+
+struct tanto_dirpos_t
 {
-  int           ind;
-  int           ind2;
-  char          data[TANTO_BLOCK_SIZE];
-  tanto_file_t  file;
-  tanto_fobj_t *fobj;
-  tanto_dobj_t *dobj;
+  uint32_t  hash;
+  int       off;                                       /* entry in bucket */
+};
+typedef struct tanto_dirpos_t tanto_dirpos_t;
 
-  ytrace_msg(YTRACE_LEVEL1, "path = %s\n", path);
+static int tanto_dirpos_cmp(const void *a, const void *b)
+{
+  const tanto_dirpos_t *x = a;
+  const tanto_dirpos_t *y = b;
+
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+
+  return x->off - y->off;
+}
+
+static int tanto_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *finfo)
+{
+  int             ind;
+  int             ent;
+  int             cnt;
+  int             off;
+  int             len;
+  int             more;
+  int             from = offset != 0;             /* resuming from cursor */
+  uint32_t        hash = (offset >> 1) & 0xffffffff;
+  char            name[TANTO_NAME_MAX];
+  char            data[TANTO_DIR_BUCKET_SIZE];
+  tanto_file_t    file;
+  tanto_dirent_t *de;
+  tanto_dirpos_t  pos[TANTO_DIR_ENTS_MAX];
+  struct stat     st;
+
+  ytrace_msg(YTRACE_LEVEL1, "path = %s : offset = %lld\n", 
+             path, (long long)offset);
 
   if (tanto_file_get(&file, path) < 0)
   {
@@ -524,29 +3646,50 @@ static int tanto_getdir(const char *path, fuse_dirh_t h, fuse_dirfil_t filler)
     return -ENOENT;
   }
 
-  fobj = &file.fobj;
+  ind = from ? (offset >> 33) - 1 : 0;
 
-  ytrace_msg(YTRACE_LEVEL1, "Number of blocks = %d\n", fobj->nblocks);
+  memset(&st, 0, sizeof(st));
 
-  for (ind = 0; ind < fobj->nblocks; ind++)
+  for (; ind < file.fobj.nblocks; ind++, from = 0)
   {
-    if (tanto_file_read(&file, ind, (void *)data, sizeof(data)) < 0)
+    if ((len = tanto_dir_read_bucket(&file, ind, data)) < 0)
     {
-      ytrace_msg(YTRACE_LEVEL1, "dir block read failed\n");
+      ytrace_msg(YTRACE_LEVEL1, "dir bucket read failed\n");
       return -ENOENT;
     }
 
-    dobj = (tanto_dobj_t *)data;
-    
-    for (ind2 = 0; ind2 < TANTO_BLOCK_DIR_MAX; ind2++)
+    for (off = sizeof(tanto_dirblk_t), cnt = 0; off < len; 
+         off += tanto_dirent_size(de), cnt++)
     {
-      if (dobj[ind2].name[0] == '\0')                     /* skip free entry */
-        continue;
+      de = (tanto_dirent_t *)&data[off];
+
+      memcpy(name, de->name, de->namel);
+      name[de->namel] = 0;
+
+      pos[cnt].hash = tanto_hash(name);
+      pos[cnt].off  = off;
+    }
 
-      ytrace_msg(YTRACE_LEVEL1, "returning file (%d %d) : %s\n",
-                 ind, ind2, dobj[ind2].name);
+    qsort(pos, cnt, sizeof(*pos), tanto_dirpos_cmp);
 
-      filler(h, dobj[ind2].name, S_IFREG, dobj[ind2].seqno);
+    for (ent = 0; ent < cnt; ent++)
+    {
+      if (from && (pos[ent].hash < hash || 
+                   (pos[ent].hash == hash && !(offset & 1))))
+        continue;                                      /* listed already */
+
+      de = (tanto_dirent_t *)&data[pos[ent].off];
+
+      memcpy(name, de->name, de->namel);
+      name[de->namel] = 0;
+
+      st.st_ino  = de->ino;
+      st.st_mode = DTTOIF(de->type);
+
+      more = ent + 1 < cnt && pos[ent + 1].hash == pos[ent].hash;
+
+      if (filler(buf, name, &st, TANTO_DIR_OFF(ind, pos[ent].hash, more)))
+        return 0;                                             /* buf is full */
     }
   }
 
@@ -555,9 +3698,12 @@ static int tanto_getdir(const char *path, fuse_dirh_t h, fuse_dirfil_t filler)
 
 static int tanto_mknod(const char *path, mode_t mode, dev_t rdev)
 {
+  int          ret;
   char         base[TANTO_PATH_MAXLEN];
   char         dir[TANTO_PATH_MAXLEN];
   tanto_file_t file;
+  tanto_file_t dfile;
+  pthread_mutex_t     *lock;
   struct fuse_context *fctx = fuse_get_context();
 
   tanto_split_name(path, dir, sizeof(dir), base, sizeof(base));
@@ -565,26 +3711,38 @@ static int tanto_mknod(const char *path, mode_t mode, dev_t rdev)
   ytrace_msg(YTRACE_LEVEL1, "path = %s %o %d [base = %s]\n", 
              path, mode, (int)rdev, base);
 
+  if (strlen(base) >= TANTO_NAME_MAX)         /* namel of tanto_dirent_t */
+    return -ENAMETOOLONG;
+
+  /* Add the object first, a failure below leaves no dangling entry */
+  if (tanto_add_obj(&file, 0, mode, fctx->uid, fctx->gid) < 0)
+  {
+    ytrace_msg(YTRACE_LEVEL1, "tanto_mknod : add new path failed \n");
+    return -ENOMEM;
+  }
+
   /* Check if directory exists */
-  if (tanto_file_get(&file, dir) < 0)
+  if ((lock = tanto_file_lock(&dfile, dir)) == NULL)
   {
     ytrace_msg(YTRACE_LEVEL1, "tanto_mknod : dir obj get failed\n");
+    tanto_file_del(&file);
     return -ENOENT;
   }
 
-  /* Add a file entry first into directory */
-  if (tanto_dir_add_file(&file, base) < 0)
+  __sync_fetch_and_add(&tanto_ctx.create_gen, 1);   /* see tanto_file_get */
+
+  ret = tanto_dir_add_file(&dfile, base, file.ino, mode);
+
+  tanto_unlock(lock);
+
+  if (ret < 0)
   {
     ytrace_msg(YTRACE_LEVEL1, "tanto_mknod : add new path to dir failed \n");
-    return -ENOMEM;
+    tanto_file_del(&file);
+    return ret;
   }
 
-  /* Add the file object for new element */
-  if (tanto_add_obj(path, mode, fctx->uid, fctx->gid) < 0)
-  {
-    ytrace_msg(YTRACE_LEVEL1, "tanto_mknod : add new path failed \n");
-    return -ENOMEM;
-  }
+  tanto_acache_put(path, file.ino, &file.fobj, dfile.gen);
 
   ytrace_msg(YTRACE_LEVEL1, "path = %s done \n", path);
   return 0;
@@ -601,120 +3759,266 @@ static int tanto_mkdir(const char *path, mode_t mode)
   return ret;
 }
 
-static int tanto_unlink(const char *path)
+/* Remove the entry of path, then drop the link it held */
+static int tanto_remove(const char *path, int isdir)
 {
-  tanto_file_t file;
-  tanto_file_t dfile;
-  char         base[TANTO_PATH_MAXLEN];
-  char         dir[TANTO_PATH_MAXLEN];
+  int              ret;
+  tanto_file_t     file;
+  tanto_file_t     dfile;
+  char             base[TANTO_PATH_MAXLEN];
+  char             dir[TANTO_PATH_MAXLEN];
+  pthread_mutex_t *lock;
 
   tanto_split_name(path, dir, sizeof(dir), base, sizeof(base));
 
   if (tanto_file_get(&file, path) < 0)
     return -ENOENT;
 
-  if (tanto_file_get(&dfile, dir) < 0)
+  if (isdir != !!S_ISDIR(file.fobj.mode))
+    return isdir ? -ENOTDIR : -EISDIR;
+
+  if (isdir && !tanto_dir_empty(&file))
+    return -ENOTEMPTY;
+
+  if ((lock = tanto_file_lock(&dfile, dir)) == NULL)
     return -ENOENT;
-  
-  if (tanto_dir_del_file(&dfile, base) < 0)
-    return -EINVAL;
 
-  if (tanto_file_del(&file) < 0)
+  ret = tanto_dir_del_file(&dfile, base);
+
+  tanto_unlock(lock);
+
+  if (ret < 0)
     return -ENOENT;
 
-  ytrace_msg(YTRACE_LEVEL1, "unlinked = %s\n", path);
+  tanto_acache_put(path, 0, NULL, dfile.gen);
 
-  return 0;
+  return tanto_file_unref(&file);
 }
 
-static int tanto_rmdir(const char *path)
+static int tanto_unlink(const char *path)
 {
-  tanto_file_t file;
-  tanto_file_t dfile;
-  char         base[TANTO_PATH_MAXLEN];
-  char         dir[TANTO_PATH_MAXLEN];
+  int ret;
 
-  ytrace_msg(YTRACE_LEVEL1, "rmdir = %s\n", path);
+  ret = tanto_remove(path, 0);
 
-  tanto_split_name(path, dir, sizeof(dir), base, sizeof(base));
+  ytrace_msg(YTRACE_LEVEL1, "unlinked = %s : ret = %d\n", path, ret);
 
-  if (tanto_file_get(&file, path) < 0)
-    return -ENOENT;
+  return ret;
+}
 
-  if (tanto_file_get(&dfile, dir) < 0)
-    return -ENOENT;
-  
-  if (tanto_dir_del_file(&dfile, base) < 0)
-    return -EINVAL;
+static int tanto_rmdir(const char *path)
+{
+  int ret;
 
-  if (tanto_file_del(&file) < 0)
-    return -ENOENT;
+  ret = tanto_remove(path, 1);
 
-  ytrace_msg(YTRACE_LEVEL1, "rmdir done = %s\n", path);
+  ytrace_msg(YTRACE_LEVEL1, "rmdir done = %s : ret = %d\n", path, ret);
 
-  return 0;
+  return ret;
 }
 
 static int tanto_symlink(const char *from, const char *to)
 {
-  char         data[TANTO_BLOCK_SIZE];
+  int          ret;
   mode_t       mode = 0777;
   tanto_file_t file;
 
   ytrace_msg(YTRACE_LEVEL1, "from = %s to = %s\n", from, to);
 
-  if (tanto_mknod(to, S_IFLNK|mode, 0) < 0)
-    return -EPERM;
+  if ((ret = tanto_mknod(to, S_IFLNK|mode, 0)) < 0)
+    return ret == -ENAMETOOLONG ? ret : -EPERM;
 
   if (tanto_file_get(&file, to) < 0)
     return -ENOENT;
 
-  strcpy(data, from);
-
-  if (tanto_file_write(&file, data, sizeof(data), 0) < 0)
+  if (tanto_file_write(&file, (void *)from, strlen(from), 0) < 0)
     return -ENOMEM;
 
   return 0;
 }
 
+/* The target is stored with its exact length, without a NUL */
 static int tanto_readlink(const char *path, char *buf, size_t size)
 {
+  size_t       len;
   char         data[TANTO_BLOCK_SIZE];
   tanto_file_t file;
 
   ytrace_msg(YTRACE_LEVEL1, "path = %s\n", path);
 
+  if (size == 0)
+    return -EINVAL;
+
   if (tanto_file_get(&file, path) < 0)
     return -ENOENT;
 
   if (tanto_file_read(&file, 0, data, sizeof(data)) < 0)
     return -EINVAL;
 
-  strncpy(buf, data, size);
+  len = tanto_file_size(&file.fobj);
+
+  if (len > sizeof(data))
+    len = sizeof(data);
+
+  if (len > size - 1)
+    len = size - 1;
+
+  memcpy(buf, data, len);
+  buf[len] = 0;
 
   ytrace_msg(YTRACE_LEVEL1, "link = %.*s\n", size, buf);
 
   return 0;
 }
 
+/*
+ * Objects are named by directory entries only, so a rename adds the new
+ * entry and removes the old one whatever lies below. The new entry goes
+ * in first, a crash in between leaves the object reachable from both.
+ */
 static int tanto_rename(const char *from, const char *to)
 {
-  /* TANTO : TODO */
-  ytrace_msg(YTRACE_LEVEL1, "path = %s\n", from);
-  return -ENOENT;
+  int              ret;
+  int              fromlen = strlen(from);
+  uint64_t         ino;
+  char             fbase[TANTO_PATH_MAXLEN];
+  char             fdir[TANTO_PATH_MAXLEN];
+  char             tbase[TANTO_PATH_MAXLEN];
+  char             tdir[TANTO_PATH_MAXLEN];
+  tanto_file_t     file;
+  tanto_file_t     victim;
+  tanto_file_t     fdfile;
+  tanto_file_t     tdfile;
+  tanto_file_t    *tdp;
+  pthread_mutex_t *lock1;
+  pthread_mutex_t *lock2;
+
+  ytrace_msg(YTRACE_LEVEL1, "from = %s to = %s\n", from, to);
+
+  if (tanto_file_get(&file, from) < 0)
+    return -ENOENT;
+
+  if (strncmp(to, from, fromlen) == 0 && to[fromlen] == '/')
+    return -EINVAL;                              /* into its own subtree */
+
+  tanto_split_name(from, fdir, sizeof(fdir), fbase, sizeof(fbase));
+  tanto_split_name(to,   tdir, sizeof(tdir), tbase, sizeof(tbase));
+
+  if (strlen(tbase) >= TANTO_NAME_MAX)
+    return -ENAMETOOLONG;
+
+  if (tanto_file_get(&fdfile, fdir) < 0 || tanto_file_get(&tdfile, tdir) < 0)
+    return -ENOENT;
+
+  tanto_lock2(fdfile.ino, tdfile.ino, &lock1, &lock2);
+
+  tdp = fdfile.ino == tdfile.ino ? &fdfile : &tdfile;
+
+  victim.ino = 0;
+
+  if (tanto_file_reget(&fdfile) < 0 || 
+      (tdp == &tdfile && tanto_file_reget(&tdfile) < 0))
+  {
+    ret = -ENOENT;
+    goto out;
+  }
+
+  if ((ret = tanto_dir_lookup(tdp, tbase, &ino)) == 0)   /* target exists */
+  {
+    if (ino == file.ino)
+      goto out;
+
+    if (tanto_file_load(&victim, ino) == 0)
+    {
+      if (S_ISDIR(victim.fobj.mode) && !S_ISDIR(file.fobj.mode))
+        ret = -EISDIR;
+      else if (!S_ISDIR(victim.fobj.mode) && S_ISDIR(file.fobj.mode))
+        ret = -ENOTDIR;
+      else if (S_ISDIR(victim.fobj.mode) && !tanto_dir_empty(&victim))
+        ret = -ENOTEMPTY;
+
+      if (ret < 0)
+        goto out;
+    }
+
+    if ((ret = tanto_dir_del_file(tdp, tbase)) < 0)
+      goto out;
+  }
+
+  if ((ret = tanto_dir_add_file(tdp, tbase, file.ino, file.fobj.mode)) < 0 ||
+      (ret = tanto_dir_del_file(&fdfile, fbase)) < 0)
+    goto out;
+
+  tanto_path_gen_bump();               /* cached paths below from are stale */
+
+out:
+  tanto_unlock2(lock1, lock2);
+
+  if (ret == 0 && victim.ino)
+  {
+    strcpy(victim.path, to);
+    tanto_file_unref(&victim);
+  }
+
+  return ret;
 }
 
 static int tanto_link(const char *from, const char *to)
 {
-  /* TANTO : TODO */
-  return -ENOENT;
+  int              ret;
+  char             base[TANTO_PATH_MAXLEN];
+  char             dir[TANTO_PATH_MAXLEN];
+  tanto_file_t     file;
+  tanto_file_t     dfile;
+  pthread_mutex_t *lock;
+
+  ytrace_msg(YTRACE_LEVEL1, "from = %s to = %s\n", from, to);
+
+  if (tanto_file_get(&file, from) < 0)
+    return -ENOENT;
+
+  if (S_ISDIR(file.fobj.mode))
+    return -EPERM;
+
+  tanto_split_name(to, dir, sizeof(dir), base, sizeof(base));
+
+  if (strlen(base) >= TANTO_NAME_MAX)
+    return -ENAMETOOLONG;
+
+  /* Count the link first, a failure below only leaves a high count */
+  if ((lock = tanto_file_lock(&file, from)) == NULL)
+    return -ENOENT;
+
+  file.fobj.nlink++;
+
+  ret = tanto_file_sync(&file);
+
+  tanto_unlock(lock);
+
+  if (ret < 0)
+    return -EIO;
+
+  if ((lock = tanto_file_lock(&dfile, dir)) == NULL)
+    ret = -ENOENT;
+  else
+  {
+    ret = tanto_dir_add_file(&dfile, base, file.ino, file.fobj.mode);
+
+    tanto_unlock(lock);
+  }
+
+  if (ret < 0)
+    tanto_file_unref(&file);
+
+  return ret;
 }
 
 static int tanto_chmod(const char *path, mode_t mode)
 {
-  tanto_file_t  file;
+  tanto_file_t     file;
+  pthread_mutex_t *lock;
 
-  if (tanto_file_get(&file, path) < 0)
+  if ((lock = tanto_file_lock(&file, path)) == NULL)
     return -ENOENT;
 
   ytrace_msg(YTRACE_LEVEL1, "path = %s %o %o\n", path, mode, file.fobj.mode);
@@ -723,20 +4027,28 @@ static int tanto_chmod(const char *path, mode_t mode)
 
   tanto_file_sync(&file);
 
+  tanto_unlock(lock);
+
   return 0;
 }
 
 static int tanto_chown(const char *path, uid_t uid, gid_t gid)
 {
-  tanto_file_t  file;
+  int              ret;
+  tanto_file_t     file;
+  pthread_mutex_t *lock;
 
-  if (tanto_file_get(&file, path) < 0)
+  if ((lock = tanto_file_lock(&file, path)) == NULL)
     return -ENOENT;
 
   file.fobj.uid = uid;
   file.fobj.gid = gid;
 
-  if (tanto_file_sync(&file) < 0)
+  ret = tanto_file_sync(&file);
+
+  tanto_unlock(lock);
+
+  if (ret < 0)
     return -EINVAL;
 
   ytrace_msg(YTRACE_LEVEL1, "path = %s : %d %d \n", path, uid, gid);
@@ -744,31 +4056,145 @@ static int tanto_chown(const char *path, uid_t uid, gid_t gid)
   return 0;
 }
 
+/*
+ * Cut file to size bytes, caller holds its lock. The object update, zeroes
+ * for the rest of a partial last block and a reclaim entry for the blocks
+ * past the end all go in one round trip.
+ */
+static int tanto_file_cut(tanto_file_t *file, size_t size)
+{
+  int              n      = 0;
+  int              queued = 0;
+  char            *kptr[3];
+  int              klen[3];
+  void            *vptr[3];
+  int              vlen[3];
+  long             voff[3];
+  char             key[TANTO_KEY_MAXLEN];
+  char             obj[sizeof(tanto_fobj_t) + TANTO_INLINE_MAX];
+  void            *zero  = NULL;
+  size_t           bsize = tanto_bsize();
+  size_t           nblocks = tanto_block_align(size) / bsize;
+  size_t           blk = size / bsize;
+  size_t           off = size % bsize;
+  tanto_fobj_t    *fobj  = &file->fobj;
+  tanto_reclaim_t  rec;
+
+  if (off && size < tanto_file_size(fobj) && blk < fobj->nblocks &&
+      tanto_amap_test(file, blk) != 0)         /* bytes past the end read 0 */
+  {
+    if ((zero = calloc(1, bsize - off)) == NULL)
+      return -ENOMEM;
+
+    kptr[n] = key;
+    klen[n] = tanto_data_key(key, file->ino, blk);
+    vptr[n] = zero;
+    vlen[n] = bsize - off;
+    voff[n] = off;
+    n++;
+  }
+
+  if (fobj->nblocks > nblocks)
+  {
+    memset(&rec, 0, sizeof(rec));
+
+    rec.ino   = file->ino;
+    rec.from  = nblocks;
+    rec.to    = fobj->nblocks > fobj->tblocks ? fobj->nblocks : fobj->tblocks;
+    rec.flags = fobj->flags & TANTO_FOBJ_AMAP ? TANTO_RECLAIM_AMAP : 0;
+
+    kptr[n] = TANTO_RECLAIM_KEY;
+    klen[n] = strlen(TANTO_RECLAIM_KEY);
+    vptr[n] = &rec;
+    vlen[n] = sizeof(rec);
+    voff[n] = TENGINE_PUT_RPUSH;
+    n++;
+
+    queued = 1;
+
+    tanto_bcache_inval(file->ino, nblocks, fobj->nblocks);
+
+    fobj->tblocks = rec.to;
+    fobj->nblocks = nblocks;
+  }
+  else if (tanto_file_grow(file, nblocks) < 0)
+    return -EIO;
+
+  tanto_file_resize(fobj, size);
+
+  kptr[n] = file->key;
+  klen[n] = file->keyl;
+  vptr[n] = obj;
+  vlen[n] = tanto_file_pack(file, obj);
+  voff[n] = TENGINE_PUT_SET;
+
+  if (vlen[n++] < 0 ||
+      tengine_mput(tanto_engine(), kptr, klen, vptr, vlen, voff, n,
+                 NULL, NULL, NULL, NULL, 0) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "redis truncate [%s] failed\n", file->path);
+    tanto_acache_del(file->path);
+    tanto_bcache_inval(file->ino, blk, blk + 1);
+    free(zero);
+    return -EIO;
+  }
+
+  if (zero)
+    tanto_bcache_patch(file->ino, blk, off, zero, bsize - off);
+
+  free(zero);
+
+  tanto_file_synced(file);
+
+  if (queued)
+    tanto_reclaim_kick();
+
+  return 0;
+}
+
 static int tanto_truncate(const char *path, off_t size)
 {
   int           ret;
-  size_t        nblocks;
   tanto_file_t  file;
   tanto_fobj_t *fobj;
+  pthread_mutex_t *lock;
   
   ytrace_msg(YTRACE_LEVEL1, "path = %s : size = %ld\n", path, (long)size);
 
-  size    = tanto_block_align(size);
-  nblocks = size / TANTO_BLOCK_SIZE;
-
   if (tanto_file_get(&file, path) < 0)
     return -ENOENT;
 
+  tanto_fh_discard(file.ino, size);
+
+  if ((lock = tanto_file_lock(&file, path)) == NULL)
+    return -ENOENT;
+
   fobj = &file.fobj;
 
-  if (fobj->nblocks > nblocks)
+  if ((fobj->flags & TANTO_FOBJ_INLINE) && size > tanto_opt.inline_max &&
+      tanto_file_spill(&file) < 0)
+  {
+    tanto_unlock(lock);
+    return -EIO;
+  }
+
+  if (fobj->flags & TANTO_FOBJ_INLINE)
   {
-    /* TODO : release blocks */
+    if (size > fobj->ilen)
+      memset(&file.idata[fobj->ilen], 0, size - fobj->ilen);
+
+    fobj->ilen = size;
+
+    tanto_file_resize(fobj, size);
+
+    ret = tanto_file_sync(&file);
   }
+  else
+    ret = tanto_file_cut(&file, size);
 
-  fobj->nblocks = nblocks;
+  tanto_unlock(lock);
 
-  if (tanto_file_sync(&file) < 0)
+  if (ret < 0)
   {
     ytrace_msg(YTRACE_LEVEL1, "%s: file sync failed\n", __func__);
     return -ENOMEM;
@@ -799,24 +4225,34 @@ static int tanto_open(const char *path, struct fuse_file_info *finfo)
 {
   int          ret;
   tanto_file_t file;
+  tanto_fh_t  *fh;
 
   ret = tanto_file_get(&file, path);
 
   ytrace_msg(YTRACE_LEVEL1, "path = %s : ret = %d\n", path, ret);
 
-  return ret;
+  if (ret < 0 || tanto_opt.wbuf_blocks <= 0)
+    return ret;
+
+  if ((fh = tanto_fh_open(&file)) == NULL)
+    return -ENOMEM;
+
+  finfo->fh = (uint64_t)(uintptr_t)fh;
+
+  return 0;
 }
 
 static int tanto_read(const char *path, char *buf, size_t size, off_t offset, 
                       struct fuse_file_info *finfo)
 {
   int          ret;
-  int          ind;
-  size_t       blk_ind;
   size_t       blk_cnt;
   size_t       blk_off;
-  char        *blk_bp;
+  size_t       fsize;
+  size_t       bsize = tanto_bsize();
+  char        *bp    = buf;
   tanto_file_t file;
+  tanto_fh_t  *fh;
 
   if (tanto_file_get(&file, path) < 0)
   {
@@ -824,30 +4260,80 @@ static int tanto_read(const char *path, char *buf, size_t size, off_t offset,
     return -ENOENT;
   }
 
-  if ((size != tanto_block_align(size)) ||
-      (offset != tanto_block_align(offset)))
+  if (size == 0)
+    return 0;
+
+  if (file.fobj.flags & TANTO_FOBJ_INLINE)           /* one GET, or none */
   {
-    ytrace_msg(YTRACE_LEVEL1, "alignment issue %ld : %ld : %d\n", 
-               (long)size, (long)offset, TANTO_BLOCK_SIZE);
-    return -EINVAL;
+    if (tanto_file_idata(&file) < 0)
+      return -EIO;
+
+    if (offset >= file.fobj.ilen)
+      return 0;
+
+    if (size > file.fobj.ilen - offset)
+      size = file.fobj.ilen - offset;
+
+    memcpy(buf, &file.idata[offset], size);
+
+    return size;
   }
 
-  blk_cnt = size   / TANTO_BLOCK_SIZE;
-  blk_off = offset / TANTO_BLOCK_SIZE;
-  
   ytrace_msg(YTRACE_LEVEL1, "path = %s : size =%ld : offset = %ld\n", 
              path, (long)size, (long)offset);
 
-  for (ind = 0; ind < blk_cnt; ind++)
+  if ((fh = tanto_fh_get(finfo)) != NULL)         /* see buffered writes */
+    pthread_mutex_lock(&fh->lock);
+
+  fsize = tanto_file_size(&file.fobj);
+
+  if (fh != NULL && fh->size > fsize)
+    fsize = fh->size;
+
+  if (offset >= fsize)                                       /* short read */
   {
-    blk_bp = &buf[ind * TANTO_BLOCK_SIZE];
+    if (fh != NULL)
+      pthread_mutex_unlock(&fh->lock);
+
+    return 0;
+  }
 
-    if (tanto_file_read(&file, blk_off + ind, 
-                        (void *)blk_bp, TANTO_BLOCK_SIZE) < 0)
+  if (size > fsize - offset)
+    size = fsize - offset;
+
+  blk_off = offset / bsize;
+  blk_cnt = (offset + size - 1) / bsize - blk_off + 1;
+
+  if (blk_cnt == 1 && bsize > TANTO_BLOCK_SIZE &&    /* page sized, big blocks */
+      size * 4 <= bsize)
+    ret = tanto_file_read_range(&file, blk_off, offset % bsize, buf, size);
+  else if (offset % bsize || size % bsize)
+  {
+    if ((bp = malloc(blk_cnt * bsize)) == NULL)
+      ret = -ENOMEM;
+    else
     {
-      memset(blk_bp, 0, TANTO_BLOCK_SIZE);
+      ret = tanto_file_read_blocks(&file, blk_off, blk_cnt, bp);
+
+      memcpy(buf, &bp[offset % bsize], size);
+      free(bp);
     }
   }
+  else
+    ret = tanto_file_read_blocks(&file, blk_off, blk_cnt, buf);
+
+  if (fh != NULL)
+  {
+    tanto_fh_overlay(fh, offset, size, buf);
+
+    pthread_mutex_unlock(&fh->lock);
+  }
+
+  if (ret == -ENOMEM)
+    return ret;
+
+  if (ret < 0)
+    return -EIO;
 
   ytrace_msg(YTRACE_LEVEL1, "%s: read completed successfully\n", __func__);
 
@@ -857,18 +4343,36 @@ static int tanto_read(const char *path, char *buf, size_t size, off_t offset,
 static int tanto_write(const char *path, const char *buf, size_t size,
                        off_t offset, struct fuse_file_info *finfo)
 {
-  tanto_file_t file;
+  int              ret;
+  tanto_file_t     file;
+  tanto_fh_t      *fh;
+  pthread_mutex_t *lock;
 
   ytrace_msg(YTRACE_LEVEL1, "path = %s : size =%ld : offset = %ld\n", 
              path, (long)size, (long)offset);
 
-  if (tanto_file_get(&file, path) < 0)
+  if ((fh = tanto_fh_get(finfo)) != NULL)
+  {
+    pthread_mutex_lock(&fh->lock);
+
+    ret = tanto_fh_write(fh, buf, size, offset);
+
+    pthread_mutex_unlock(&fh->lock);
+
+    return ret < 0 ? ret : size;
+  }
+
+  if ((lock = tanto_file_lock(&file, path)) == NULL)
   {
     ytrace_msg(YTRACE_LEVEL1, "%s: file get failed\n", __func__);
     return -ENOENT;
   }
 
-  if (tanto_file_write(&file, (void *)buf, size, offset) < 0)
+  ret = tanto_file_write(&file, (void *)buf, size, offset);
+
+  tanto_unlock(lock);
+
+  if (ret < 0)
       return -EINVAL;
 
   ytrace_msg(YTRACE_LEVEL1, "write completed successfully\n");
@@ -878,44 +4382,182 @@ static int tanto_write(const char *path, const char *buf, size_t size,
 
 static int tanto_statfs(const char *path, struct statvfs *fst)
 {
-  fst->f_bsize  = TANTO_BLOCK_SIZE;
-  fst->f_frsize = TANTO_BLOCK_SIZE;
+  fst->f_bsize  = tanto_bsize();
+  fst->f_frsize = tanto_bsize();
   fst->f_blocks = -1;
   fst->f_bfree  = -1;
   fst->f_bavail = -1;
   fst->f_files  = -1;
   fst->f_ffree  = -1;
   fst->f_favail = -1;
-  fst->f_namemax = TANTO_NAME_MAX;
+  fst->f_namemax = TANTO_NAME_MAX - 1;
   return 0;
 }
 
+static int tanto_flush(const char *path, struct fuse_file_info *finfo)
+{
+  int          ret = 0;
+  tanto_fh_t  *fh;
+
+  ytrace_msg(YTRACE_LEVEL1, "%s: path = %s\n", __func__, path);
+
+  if ((fh = tanto_fh_get(finfo)) != NULL)
+  {
+    pthread_mutex_lock(&fh->lock);
+
+    ret = tanto_fh_flush(fh);
+
+    pthread_mutex_unlock(&fh->lock);
+  }
+
+  return ret;
+}
+
 static int tanto_release(const char *path, struct fuse_file_info *finfo)
 {
-    /* Just a stub.  This method is optional and can safely be left
-       unimplemented */
+  int          ret;
+  tanto_fh_t  *fh;
 
-    (void) path;
-    (void) finfo;
+  if ((fh = tanto_fh_get(finfo)) == NULL)
     return 0;
+
+  ret = tanto_flush(path, finfo);
+
+  tanto_fh_close(fh);
+
+  finfo->fh = 0;
+
+  return ret;
 }
 
 static int tanto_fsync(const char *path, int isdatasync,
                        struct fuse_file_info *finfo)
 {
-    /* Just a stub.  This method is optional and can safely be left
-       unimplemented */
+  ytrace_msg(YTRACE_LEVEL1, "%s: path = %s\n", __func__, path);
+
+  (void) isdatasync;
+
+  return tanto_flush(path, finfo);
+}
+
+static int tanto_ftruncate(const char *path, off_t size,
+                           struct fuse_file_info *finfo)
+{
+  return tanto_truncate(path, size);
+}
 
-    ytrace_msg(YTRACE_LEVEL1, "%s: path = %s\n", __func__, path);
-    (void) path;
-    (void) isdatasync;
-    return 0;
+#define TANTO_STATS_FIELD(field) { #field, offsetof(tanto_stats_t, field) }
+
+static struct
+{
+  const char *name;
+  size_t      offset;
+} tanto_stats_fields[] =
+{
+  TANTO_STATS_FIELD(acache_hits),
+  TANTO_STATS_FIELD(acache_misses),
+  TANTO_STATS_FIELD(ncache_hits),
+  TANTO_STATS_FIELD(bcache_hits),
+  TANTO_STATS_FIELD(bcache_misses),
+  TANTO_STATS_FIELD(wbuf_writes),
+  TANTO_STATS_FIELD(wbuf_flushes),
+  TANTO_STATS_FIELD(ino_ranges),
+  TANTO_STATS_FIELD(amap_holes),
+  TANTO_STATS_FIELD(zero_blocks),
+  TANTO_STATS_FIELD(range_reads),
+  TANTO_STATS_FIELD(range_writes),
+  TANTO_STATS_FIELD(reclaim_blocks),
+  { NULL, 0 }
+};
+
+static int tanto_stats_format(char *buf, size_t size)
+{
+  int       ind;
+  int       len = 0;
+  uint64_t  hits;
+  uint64_t  total;
+
+  for (ind = 0; tanto_stats_fields[ind].name; ind++)
+  {
+    len += snprintf(&buf[len], size - len, "%s %llu\n", 
+                    tanto_stats_fields[ind].name, 
+                    (unsigned long long)*(uint64_t *)
+                    ((char *)&tanto_ctx.stats + tanto_stats_fields[ind].offset));
+
+    if (len >= size)
+      len = size - 1;
+  }
+
+  hits  = tanto_ctx.stats.bcache_hits;
+  total = hits + tanto_ctx.stats.bcache_misses;
+
+  len += snprintf(&buf[len], size - len, "bcache_hit_ratio %.4f\n",
+                  total ? (double)hits / total : 0.0);
+
+  if (len >= size)
+    len = size - 1;
+
+  return len;
+}
+
+/*
+ * Runtime counters are published as a virtual xattr on every path :
+ *   getfattr -n user.tanto.stats <mount point>
+ */
+static int tanto_getxattr(const char *path, const char *name, 
+                          char *value, size_t size)
+{
+  int  len;
+  char buf[1024];
+
+  if (strcmp(name, TANTO_STATS_XATTR) != 0)
+    return -ENODATA;
+
+  len = tanto_stats_format(buf, sizeof(buf));
+
+  if (size == 0)
+    return len;
+
+  if (size < len)
+    return -ERANGE;
+
+  memcpy(value, buf, len);
+
+  return len;
+}
+
+/* Runs once mounted, after fuse_main forked into the background */
+static void *tanto_start(struct fuse_conn_info *conn)
+{
+  if (tanto_mount() < 0)
+    exit(0);
+
+  if (tengine_start(tanto_engine()) < 0)
+    ytrace_msg(YTRACE_ERROR, "%s engine start failed\n", 
+               tanto_engine()->ops->name);
+
+  tanto_reclaim_start();
+
+  return NULL;
+}
+
+static void tanto_destroy(void *private_data)
+{
+  char buf[1024];
+
+  tanto_reclaim_stop();
+
+  tanto_stats_format(buf, sizeof(buf));
+
+  ytrace_msg(YTRACE_DEFAULT, "stats :\n%s", buf);
+
+  tengine_close(tanto_engine());
 }
 
 static struct fuse_operations tanto_oper = {
     .getattr	= tanto_getattr,
     .readlink	= tanto_readlink,
-    .getdir	= tanto_getdir,
+    .readdir	= tanto_readdir,
     .mknod	= tanto_mknod,
     .mkdir	= tanto_mkdir,
     .symlink	= tanto_symlink,
@@ -931,16 +4573,42 @@ static struct fuse_operations tanto_oper = {
     .read	= tanto_read,
     .write	= tanto_write,
     .statfs	= tanto_statfs,
+    .flush	= tanto_flush,
     .release	= tanto_release,
-    .fsync	= tanto_fsync
-    
+    .fsync	= tanto_fsync,
+    .ftruncate	= tanto_ftruncate,
+    .getxattr	= tanto_getxattr,
+    .init	= tanto_start,
+    .destroy	= tanto_destroy
+
 };
 
 int main(int argc, char *argv[])
 {
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+  if (fuse_opt_parse(&args, &tanto_opt, tanto_opts, NULL) < 0)
+    return 1;
+
+  if (!tanto_block_size_ok(tanto_opt.block_size))
+  {
+    ytrace_msg(YTRACE_ERROR, "block_size must be a power of 2, %d - %d\n",
+               TANTO_BLOCK_SIZE, TANTO_BLOCK_MAX);
+    return 1;
+  }
+
+  if (tanto_opt.inline_max < 0 || tanto_opt.inline_max > TANTO_INLINE_MAX)
+  {
+    ytrace_msg(YTRACE_ERROR, "inline_max must be 0 - %d\n", 
+               TANTO_INLINE_MAX);
+    return 1;
+  }
+
   tanto_init();
 
-  fuse_main(argc, argv, &tanto_oper, NULL);
+  fuse_main(args.argc, args.argv, &tanto_oper, NULL);
+
+  fuse_opt_free_args(&args);
 
   return 0;
 }
@@ -0,0 +1,1342 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tanto benchmarks. Runs against a live redis server; point it at a remote
+ * host (or a local one behind netem) to see the effect of network latency.
+ *
+ *   tantobench [-h ip] [-p port] [-u socket] [-b blocks] [-r reqblocks]
+ *              [-n ops] [-d dir] [-e engine] [-s sync_ms] [-j] <test>
+ *
+ * Tests:
+ *   seqread  - sequential read of a blocks * 4K object, reqblocks per
+ *              request, one GET per block vs one pipelined batch.
+ *   seqwrite - sequential write of the same object, one SET per block vs
+ *              one pipelined batch of SETs per request.
+ *   scale    - ops 4K SET+GET pairs per thread through a connection pool,
+ *              at 1, 2, 4, 8 and 16 threads.
+ *   async    - ops 4K GETs, blocking vs the async client with up to 
+ *              reqblocks requests outstanding.
+ *   append   - ops 100 byte appends to a file under -d dir, a tanto mount
+ *              point. Run it with and without -o wbuf_blocks=0.
+ *   meta     - metadata storm: create, stat and unlink ops files in one
+ *              directory under -d dir.
+ *   parse    - reply parsing, no server needed: ops batches of reqblocks
+ *              16 byte and 4K GET replies through the header parser alone
+ *              and through redis_mget over a socket pair.
+ *   latency  - ops 64 byte GETs one at a time over TCP, with and without
+ *              TCP_NODELAY, and over the unix socket given with -u.
+ *   engine   - seqwrite and seqread through each storage engine (or just
+ *              -e engine), one call per block vs one mput/mget per 
+ *              request. log and sqlite keep their data under -d dir
+ *              (default /tmp) and flush it every -s sync_ms.
+ *   micro    - redis_set, redis_get and redis_del of 64 byte to 4 MiB 
+ *              values, 1, 16 and 64 keys per call and 1, 4 and 16 
+ *              threads, with p50/p99/p999 latency per call; -j prints 
+ *              one JSON object per line to diff against a baseline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <pthread.h>
+#include <redislib.h>
+#include <redisasync.h>
+#include <tengine.h>
+#include <ytrace.h>
+
+#define BENCH_BLOCK_SIZE  (4 * 1024)
+#define BENCH_KEY_MAXLEN  (64)
+#define BENCH_APPEND_SIZE (100)
+
+struct bench_opt_t
+{
+  char  *ip;
+  int    port;
+  int    blocks;                                       /* object size */
+  int    reqblocks;                                    /* blocks / request */
+  int    ops;                                          /* ops per thread */
+  char  *dir;                                       /* tanto mount point */
+  char  *sock;                                /* redis unix socket path */
+  char  *engine;                        /* engine test, NULL runs them all */
+  int    sync_ms;
+  int    json;                       /* micro results as JSON, one a line */
+};
+typedef struct bench_opt_t bench_opt_t;
+
+static bench_opt_t bench_opt = 
+{ 
+  NULL, 0, 4096, 32, 10000, NULL, NULL, NULL, TENGINE_SYNC_MS, 0 
+};
+
+static redis_ctx_t bench_ctx;
+
+#define bench_data_key(key, ind) \
+        sprintf(key, "tantobench@data::%d", (int)(ind))
+
+static void bench_report(const char *test, const char *mode, 
+                         size_t bytes, size_t usec)
+{
+  printf("%-10s %-12s %10.2f MB/s  %10.2f ms\n", test, mode,
+         usec ? (double)bytes / usec : 0.0, usec / 1000.0);
+}
+
+static void bench_report_ops(const char *test, const char *mode, 
+                             size_t ops, size_t usec)
+{
+  printf("%-10s %-12s %10.0f op/s  %10.2f ms\n", test, mode,
+         usec ? ops * 1000000.0 / usec : 0.0, usec / 1000.0);
+}
+
+static int bench_fill(void)
+{
+  int   ind;
+  int   keyl;
+  char  key[BENCH_KEY_MAXLEN];
+  char  data[BENCH_BLOCK_SIZE];
+
+  memset(data, 'x', sizeof(data));
+
+  for (ind = 0; ind < bench_opt.blocks; ind++)
+  {
+    keyl = bench_data_key(key, ind);
+
+    if (redis_set(&bench_ctx, key, keyl, data, sizeof(data)) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int bench_seqread(void)
+{
+  int     ind;
+  int     ind2;
+  int     cnt = bench_opt.reqblocks;
+  char  (*keys)[BENCH_KEY_MAXLEN];
+  char  **kptr;
+  int    *klen;
+  void  **vptr;
+  int    *vlen;
+  char   *buf;
+  size_t  start;
+  size_t  bytes = (size_t)bench_opt.blocks * BENCH_BLOCK_SIZE;
+
+  if (bench_fill() < 0)
+    return -1;
+
+  keys = malloc(cnt * sizeof(*keys));
+  kptr = malloc(cnt * sizeof(*kptr));
+  klen = malloc(cnt * sizeof(*klen));
+  vptr = malloc(cnt * sizeof(*vptr));
+  vlen = malloc(cnt * sizeof(*vlen));
+  buf  = malloc(cnt * BENCH_BLOCK_SIZE);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.blocks; ind++)
+  {
+    ind2 = bench_data_key(keys[0], ind);
+
+    if (redis_get(&bench_ctx, keys[0], ind2, buf, BENCH_BLOCK_SIZE) < 0)
+      return -1;
+  }
+
+  bench_report("seqread", "serial", bytes, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.blocks; ind += cnt)
+  {
+    for (ind2 = 0; ind2 < cnt; ind2++)
+    {
+      kptr[ind2] = keys[ind2];
+      klen[ind2] = bench_data_key(keys[ind2], ind + ind2);
+      vptr[ind2] = &buf[ind2 * BENCH_BLOCK_SIZE];
+      vlen[ind2] = BENCH_BLOCK_SIZE;
+    }
+
+    if (redis_mget(&bench_ctx, kptr, klen, vptr, vlen, cnt) < 0)
+      return -1;
+  }
+
+  bench_report("seqread", "pipelined", bytes, ytime_get() - start);
+
+  free(keys);
+  free(kptr);
+  free(klen);
+  free(vptr);
+  free(vlen);
+  free(buf);
+
+  return 0;
+}
+
+static int bench_seqwrite(void)
+{
+  int     ind;
+  int     ind2;
+  int     cnt = bench_opt.reqblocks;
+  char  (*keys)[BENCH_KEY_MAXLEN];
+  char  **kptr;
+  int    *klen;
+  void  **vptr;
+  int    *vlen;
+  char   *buf;
+  size_t  start;
+  size_t  bytes = (size_t)bench_opt.blocks * BENCH_BLOCK_SIZE;
+
+  keys = malloc(cnt * sizeof(*keys));
+  kptr = malloc(cnt * sizeof(*kptr));
+  klen = malloc(cnt * sizeof(*klen));
+  vptr = malloc(cnt * sizeof(*vptr));
+  vlen = malloc(cnt * sizeof(*vlen));
+  buf  = malloc(cnt * BENCH_BLOCK_SIZE);
+
+  memset(buf, 'w', cnt * BENCH_BLOCK_SIZE);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.blocks; ind++)
+  {
+    ind2 = bench_data_key(keys[0], ind);
+
+    if (redis_set(&bench_ctx, keys[0], ind2, buf, BENCH_BLOCK_SIZE) < 0)
+      return -1;
+  }
+
+  bench_report("seqwrite", "serial", bytes, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.blocks; ind += cnt)
+  {
+    for (ind2 = 0; ind2 < cnt; ind2++)
+    {
+      kptr[ind2] = keys[ind2];
+      klen[ind2] = bench_data_key(keys[ind2], ind + ind2);
+      vptr[ind2] = &buf[ind2 * BENCH_BLOCK_SIZE];
+      vlen[ind2] = BENCH_BLOCK_SIZE;
+    }
+
+    if (redis_mset(&bench_ctx, kptr, klen, vptr, vlen, cnt) < 0)
+      return -1;
+  }
+
+  bench_report("seqwrite", "pipelined", bytes, ytime_get() - start);
+
+  free(keys);
+  free(kptr);
+  free(klen);
+  free(vptr);
+  free(vlen);
+  free(buf);
+
+  return 0;
+}
+
+#define BENCH_THREAD_MAX (16)
+
+static redis_pool_t bench_pool;
+
+static void *bench_scale_thread(void *arg)
+{
+  int     ind;
+  int     keyl;
+  long    tid = (long)arg;
+  char    key[BENCH_KEY_MAXLEN];
+  char    data[BENCH_BLOCK_SIZE];
+  redis_ctx_t *ctx = redis_pool_get(&bench_pool);
+
+  memset(data, 's', sizeof(data));
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    keyl = sprintf(key, "tantobench@scale::%ld::%d", tid, ind % 1024);
+
+    if (redis_set(ctx, key, keyl, data, sizeof(data)) < 0 ||
+        redis_get(ctx, key, keyl, data, sizeof(data)) < 0)
+      return (void *)-1L;
+  }
+
+  return NULL;
+}
+
+static int bench_scale(void)
+{
+  long       ind;
+  int        nthreads;
+  int        ret = 0;
+  void      *tret;
+  size_t     start;
+  size_t     usec;
+  pthread_t  threads[BENCH_THREAD_MAX];
+
+  for (nthreads = 1; nthreads <= BENCH_THREAD_MAX; nthreads *= 2)
+  {
+    if (redis_pool_init(&bench_pool, bench_opt.ip, bench_opt.port, 
+                        nthreads) < 0)
+      return -1;
+
+    start = ytime_get();
+
+    for (ind = 0; ind < nthreads; ind++)
+      pthread_create(&threads[ind], NULL, bench_scale_thread, (void *)ind);
+
+    for (ind = 0; ind < nthreads; ind++)
+    {
+      pthread_join(threads[ind], &tret);
+
+      if (tret != NULL)
+        ret = -1;
+    }
+
+    usec = ytime_get() - start;
+
+    printf("scale      threads = %-3d %10.0f ops/s\n", nthreads, 
+           usec ? 2.0 * nthreads * bench_opt.ops * 1000000 / usec : 0.0);
+
+    redis_pool_close(&bench_pool);
+  }
+
+  return ret;
+}
+
+static int bench_async(void)
+{
+  int            ind;
+  int            slot;
+  int            ret = 0;
+  int            keyl;
+  int            window = bench_opt.reqblocks;
+  char           key[BENCH_KEY_MAXLEN];
+  char          *buf;
+  size_t         start;
+  redis_areq_t  *reqs;
+  redis_actx_t   actx;
+
+  if (bench_fill() < 0)
+    return -1;
+
+  if (redis_async_connect(&actx, bench_opt.ip, bench_opt.port) < 0)
+    return -1;
+
+  reqs = calloc(window, sizeof(redis_areq_t));
+  buf  = malloc(window * BENCH_BLOCK_SIZE);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    keyl = bench_data_key(key, ind % bench_opt.blocks);
+
+    if (redis_get(&bench_ctx, key, keyl, buf, BENCH_BLOCK_SIZE) < 0)
+      ret = -1;
+  }
+
+  bench_report("async", "blocking", 
+               (size_t)bench_opt.ops * BENCH_BLOCK_SIZE, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    slot = ind % window;
+
+    if (ind >= window && redis_async_wait(&actx, &reqs[slot]) < 0)
+      ret = -1;
+
+    redis_areq_init(&reqs[slot], NULL, NULL);
+
+    keyl = bench_data_key(key, ind % bench_opt.blocks);
+
+    if (redis_async_get(&actx, &reqs[slot], key, keyl, 
+                        &buf[slot * BENCH_BLOCK_SIZE], BENCH_BLOCK_SIZE) < 0)
+      ret = -1;
+  }
+
+  for (ind = bench_opt.ops - window; ind < bench_opt.ops; ind++)
+  {
+    if (ind >= 0 && redis_async_wait(&actx, &reqs[ind % window]) < 0)
+      ret = -1;
+  }
+
+  bench_report("async", "async", 
+               (size_t)bench_opt.ops * BENCH_BLOCK_SIZE, ytime_get() - start);
+
+  redis_async_close(&actx);
+
+  free(reqs);
+  free(buf);
+
+  return ret;
+}
+
+static int bench_append(void)
+{
+  int     fd;
+  int     ind;
+  int     ret = 0;
+  char    path[1024];
+  char    data[BENCH_APPEND_SIZE];
+  size_t  start;
+
+  if (bench_opt.dir == NULL)
+  {
+    printf("append needs -d <tanto mount point>\n");
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "%s/tantobench.append", bench_opt.dir);
+
+  memset(data, 'a', sizeof(data));
+
+  if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644)) < 0)
+    return -1;
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    if (write(fd, data, sizeof(data)) != sizeof(data))
+    {
+      ret = -1;
+      break;
+    }
+  }
+
+  bench_report("append", "write", 
+               (size_t)bench_opt.ops * BENCH_APPEND_SIZE, ytime_get() - start);
+
+  if (fsync(fd) < 0 || close(fd) < 0)
+    ret = -1;
+
+  bench_report("append", "write+close", 
+               (size_t)bench_opt.ops * BENCH_APPEND_SIZE, ytime_get() - start);
+
+  unlink(path);
+
+  return ret;
+}
+
+static int bench_meta(void)
+{
+  int          fd;
+  int          ind;
+  int          ret = 0;
+  char         dir[1024];
+  char         path[1100];
+  size_t       start;
+  struct stat  st;
+
+  if (bench_opt.dir == NULL)
+  {
+    printf("meta needs -d <tanto mount point>\n");
+    return -1;
+  }
+
+  snprintf(dir, sizeof(dir), "%s/tantobench.meta", bench_opt.dir);
+
+  if (mkdir(dir, 0755) < 0)
+    return -1;
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    snprintf(path, sizeof(path), "%s/f%d", dir, ind);
+
+    if ((fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0)
+      ret = -1;
+    else
+      close(fd);
+  }
+
+  bench_report_ops("meta", "create", bench_opt.ops, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    snprintf(path, sizeof(path), "%s/f%d", dir, ind);
+
+    if (stat(path, &st) < 0)
+      ret = -1;
+  }
+
+  bench_report_ops("meta", "stat", bench_opt.ops, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    snprintf(path, sizeof(path), "%s/f%d", dir, ind);
+
+    if (unlink(path) < 0)
+      ret = -1;
+  }
+
+  bench_report_ops("meta", "unlink", bench_opt.ops, ytime_get() - start);
+
+  rmdir(dir);
+
+  return ret;
+}
+
+#define BENCH_SMALL_SIZE (64)
+
+static int bench_cmp_nsec(const void *a, const void *b)
+{
+  size_t x = *(const size_t *)a;
+  size_t y = *(const size_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static size_t bench_nsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ops small GETs on a fresh connection to ip, one at a time */
+static int bench_latency_run(const char *mode, char *ip, int port)
+{
+  int          ind;
+  int          ret = 0;
+  int          keyl;
+  char         key[BENCH_KEY_MAXLEN];
+  char         data[BENCH_SMALL_SIZE];
+  size_t       start;
+  size_t       total = 0;
+  size_t      *lat;
+  redis_ctx_t *ctx;
+
+  ctx = malloc(sizeof(*ctx));
+  lat = malloc(bench_opt.ops * sizeof(*lat));
+
+  memset(data, 'x', sizeof(data));
+
+  keyl = sprintf(key, "tantobench@small");
+
+  if (redis_connect(ctx, ip, port) < 0 || 
+      redis_set(ctx, key, keyl, data, sizeof(data)) < 0)
+  {
+    free(lat);
+    free(ctx);
+    return -1;
+  }
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    start = bench_nsec();
+
+    if (redis_get(ctx, key, keyl, data, sizeof(data)) < 0)
+      ret = -1;
+
+    lat[ind] = bench_nsec() - start;
+    total   += lat[ind];
+  }
+
+  qsort(lat, bench_opt.ops, sizeof(*lat), bench_cmp_nsec);
+
+  printf("%-10s %-12s %10.0f op/s  p50 %7.1f us  p99 %7.1f us\n", 
+         "latency", mode, total ? bench_opt.ops * 1e9 / total : 0.0,
+         lat[bench_opt.ops / 2] / 1000.0, 
+         lat[(size_t)bench_opt.ops * 99 / 100] / 1000.0);
+
+  redis_close(ctx);
+
+  free(lat);
+  free(ctx);
+
+  return ret;
+}
+
+static int bench_latency(void)
+{
+  int ret;
+
+  ret = bench_latency_run("tcp", bench_opt.ip, bench_opt.port);
+
+  redis_tune.nodelay = 0;
+
+  if (bench_latency_run("tcp-delay", bench_opt.ip, bench_opt.port) < 0)
+    ret = -1;
+
+  redis_tune.nodelay = 1;
+
+  if (bench_opt.sock && bench_latency_run("unix", bench_opt.sock, 0) < 0)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * redislib micro benchmark: GET, SET and DEL of each value size, one call
+ * per key or pipelined depth keys per call, from 1 to BENCH_THREAD_MAX 
+ * threads with a connection each. Latency is per call, kept in a log 
+ * bucketed histogram (BENCH_HIST_SUB buckets per power of two, about 6%
+ * wide) so millions of samples cost no memory and threads merge cheaply.
+ */
+#define BENCH_HIST_SUB    (16)
+#define BENCH_HIST_LEN    (60 * BENCH_HIST_SUB)
+#define BENCH_MICRO_DATA  (256 * 1024 * 1024)     /* per run, all threads */
+#define BENCH_MICRO_KEYS  (1024)                      /* per thread, most */
+#define BENCH_MICRO_MAX   (4 * 1024 * 1024)              /* largest value */
+
+static const int bench_micro_sizes[]  = { 64, 1024, 4096, 65536, 1048576, 
+                                          BENCH_MICRO_MAX, 0 };
+static const int bench_micro_depths[] = { 1, 16, 64, 0 };
+static const int bench_micro_threads[] = { 1, 4, 16, 0 };
+
+enum { BENCH_MICRO_SET, BENCH_MICRO_GET, BENCH_MICRO_DEL };
+
+static const char *bench_micro_ops[] = { "set", "get", "del" };
+
+struct bench_hist_t
+{
+  size_t  count[BENCH_HIST_LEN];
+  size_t  n;
+};
+typedef struct bench_hist_t bench_hist_t;
+
+static void bench_hist_add(bench_hist_t *hist, size_t nsec)
+{
+  int exp;
+  int ind;
+
+  if (nsec < BENCH_HIST_SUB)
+    ind = nsec;
+  else
+  {
+    exp = 63 - __builtin_clzll(nsec);           /* 2^exp <= nsec, exp >= 4 */
+    ind = (exp - 3) * BENCH_HIST_SUB + ((nsec >> (exp - 4)) & 15);
+  }
+
+  hist->count[ind < BENCH_HIST_LEN ? ind : BENCH_HIST_LEN - 1]++;
+  hist->n++;
+}
+
+/* Lower bound of bucket ind in nsec */
+static size_t bench_hist_value(int ind)
+{
+  if (ind < BENCH_HIST_SUB)
+    return ind;
+
+  return (size_t)(BENCH_HIST_SUB + ind % BENCH_HIST_SUB) << 
+         (ind / BENCH_HIST_SUB - 1);
+}
+
+/* The q quantile in usec, the middle of its bucket */
+static double bench_hist_quantile(bench_hist_t *hist, double q)
+{
+  int    ind;
+  size_t seen = 0;
+  size_t rank = (size_t)(q * hist->n + 0.5);
+
+  if (rank == 0)
+    rank = 1;
+
+  for (ind = 0; ind < BENCH_HIST_LEN - 1; ind++)
+  {
+    if ((seen += hist->count[ind]) >= rank)
+      break;
+  }
+
+  return (bench_hist_value(ind) + bench_hist_value(ind + 1)) / 2000.0;
+}
+
+struct bench_micro_t
+{
+  pthread_t     thread;
+  int           id;
+  int           op;
+  int           size;
+  int           depth;
+  int           nkeys;                     /* keys of this thread, SET first */
+  int           ops;                          /* calls, depth keys each */
+  char         *buf;
+  int           ret;
+  bench_hist_t  hist;
+};
+typedef struct bench_micro_t bench_micro_t;
+
+static void *bench_micro_thread(void *arg)
+{
+  int             ind;
+  int             ind2;
+  int             rc = 0;
+  int             key = 0;
+  char          (*keys)[BENCH_KEY_MAXLEN];
+  char          **kptr;
+  int            *klen;
+  void          **vptr;
+  int            *vlen;
+  size_t          start;
+  bench_micro_t  *run = arg;
+  redis_ctx_t    *ctx = redis_pool_get(&bench_pool);
+
+  keys = malloc(run->depth * sizeof(*keys));
+  kptr = malloc(run->depth * sizeof(*kptr));
+  klen = malloc(run->depth * sizeof(*klen));
+  vptr = malloc(run->depth * sizeof(*vptr));
+  vlen = malloc(run->depth * sizeof(*vlen));
+
+  for (ind = 0; rc >= 0 && ind < run->ops; ind++)
+  {
+    for (ind2 = 0; ind2 < run->depth; ind2++, key = (key + 1) % run->nkeys)
+    {
+      kptr[ind2] = keys[ind2];
+      klen[ind2] = sprintf(keys[ind2], "tantobench@micro::%d::%d", 
+                           run->id, key);
+      vptr[ind2] = run->op == BENCH_MICRO_DEL ? NULL : run->buf;
+      vlen[ind2] = run->size;                 /* GETs share one buffer */
+    }
+
+    start = bench_nsec();
+
+    if (run->depth == 1 && run->op == BENCH_MICRO_SET)
+      rc = redis_set(ctx, kptr[0], klen[0], run->buf, run->size);
+    else if (run->depth == 1 && run->op == BENCH_MICRO_GET)
+      rc = redis_get(ctx, kptr[0], klen[0], run->buf, run->size);
+    else if (run->depth == 1)
+      rc = redis_del(ctx, kptr[0], klen[0]);
+    else if (run->op == BENCH_MICRO_GET)
+      rc = redis_mget(ctx, kptr, klen, vptr, vlen, run->depth);
+    else
+      rc = redis_mput(ctx, kptr, klen, vptr, vlen, NULL, run->depth, 
+                      NULL, NULL, NULL, NULL, 0);
+
+    bench_hist_add(&run->hist, bench_nsec() - start);
+  }
+
+  run->ret = rc < 0 ? -1 : 0;
+
+  free(keys);
+  free(kptr);
+  free(klen);
+  free(vptr);
+  free(vlen);
+
+  return NULL;
+}
+
+static void bench_micro_report(int op, int size, int depth, int nthreads, 
+                               bench_hist_t *hist, size_t usec)
+{
+  double ops = usec ? hist->n * 1e6 / usec : 0.0;       /* calls per sec */
+
+  if (bench_opt.json)
+  {
+    printf("{\"test\":\"micro\",\"op\":\"%s\",\"size\":%d,\"depth\":%d,"
+           "\"threads\":%d,\"calls\":%zu,\"keys_per_sec\":%.0f,"
+           "\"mb_per_sec\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f,"
+           "\"p999_us\":%.2f}\n", bench_micro_ops[op], size, depth, 
+           nthreads, hist->n, ops * depth, 
+           op == BENCH_MICRO_DEL ? 0.0 : ops * depth * size / 1e6,
+           bench_hist_quantile(hist, 0.5), bench_hist_quantile(hist, 0.99),
+           bench_hist_quantile(hist, 0.999));
+    return;
+  }
+
+  printf("%-6s %3s %8d %5d %3d %12.0f key/s %9.2f MB/s  p50 %9.1f us  "
+         "p99 %9.1f us  p999 %9.1f us\n", "micro", bench_micro_ops[op], 
+         size, depth, nthreads, ops * depth, 
+         op == BENCH_MICRO_DEL ? 0.0 : ops * depth * size / 1e6,
+         bench_hist_quantile(hist, 0.5), bench_hist_quantile(hist, 0.99),
+         bench_hist_quantile(hist, 0.999));
+}
+
+/* One op at one size, depth and thread count; SET fills the keys for GET */
+static int bench_micro_run(bench_micro_t *runs, int op, int size, int depth,
+                           int nthreads)
+{
+  int           ind;
+  int           bkt;
+  int           ret = 0;
+  int           nkeys;
+  int           ops;
+  size_t        start;
+  size_t        usec;
+  bench_hist_t  hist;
+
+  nkeys = BENCH_MICRO_DATA / nthreads / size;
+
+  if (nkeys > BENCH_MICRO_KEYS)
+    nkeys = BENCH_MICRO_KEYS;
+
+  nkeys -= nkeys % depth;                      /* calls never wrap a key */
+
+  ops = (bench_opt.ops + depth - 1) / depth;
+
+  if (op == BENCH_MICRO_DEL || (op == BENCH_MICRO_SET && ops < nkeys / depth)
+      || (size_t)ops * depth * size > BENCH_MICRO_DATA / nthreads)
+    ops = nkeys / depth;           /* each key once, SET all GET will read */
+
+  if (redis_pool_init(&bench_pool, bench_opt.ip, bench_opt.port, 
+                      nthreads) < 0)
+    return -1;
+
+  for (ind = 0; ind < nthreads; ind++)
+  {
+    memset(&runs[ind].hist, 0, sizeof(runs[ind].hist));
+
+    runs[ind].id    = ind;
+    runs[ind].op    = op;
+    runs[ind].size  = size;
+    runs[ind].depth = depth;
+    runs[ind].nkeys = nkeys;
+    runs[ind].ops   = ops;
+  }
+
+  start = ytime_get();
+
+  for (ind = 0; ind < nthreads; ind++)
+    pthread_create(&runs[ind].thread, NULL, bench_micro_thread, &runs[ind]);
+
+  memset(&hist, 0, sizeof(hist));
+
+  for (ind = 0; ind < nthreads; ind++)
+  {
+    pthread_join(runs[ind].thread, NULL);
+
+    if (runs[ind].ret < 0)
+      ret = -1;
+  }
+
+  usec = ytime_get() - start;
+
+  for (ind = 0; ind < nthreads; ind++)                 /* merge histograms */
+  {
+    for (bkt = 0; bkt < BENCH_HIST_LEN; bkt++)
+      hist.count[bkt] += runs[ind].hist.count[bkt];
+
+    hist.n += runs[ind].hist.n;
+  }
+
+  redis_pool_close(&bench_pool);
+
+  if (ret == 0)
+    bench_micro_report(op, size, depth, nthreads, &hist, usec);
+
+  return ret;
+}
+
+static int bench_micro(void)
+{
+  int            ind;
+  int            op;
+  int            ret = 0;
+  const int     *size;
+  const int     *depth;
+  const int     *nthreads;
+  bench_micro_t *runs;
+
+  runs = calloc(BENCH_THREAD_MAX, sizeof(*runs));
+
+  for (ind = 0; ind < BENCH_THREAD_MAX; ind++)
+  {
+    if ((runs[ind].buf = malloc(BENCH_MICRO_MAX)) == NULL)
+      return -1;
+
+    memset(runs[ind].buf, 'm', BENCH_MICRO_MAX);
+  }
+
+  if (!bench_opt.json)
+    printf("%-6s %3s %8s %5s %3s\n", "test", "op", "size", "depth", "thr");
+
+  for (size = bench_micro_sizes; *size && ret == 0; size++)
+  {
+    for (depth = bench_micro_depths; *depth && ret == 0; depth++)
+    {
+      for (nthreads = bench_micro_threads; *nthreads && ret == 0; nthreads++)
+      {
+        if (BENCH_MICRO_DATA / *nthreads / *size < *depth)
+          continue;                            /* would not fit the cap */
+
+        for (op = BENCH_MICRO_SET; op <= BENCH_MICRO_DEL && ret == 0; op++)
+          ret = bench_micro_run(runs, op, *size, *depth, *nthreads);
+      }
+    }
+  }
+
+  for (ind = 0; ind < BENCH_THREAD_MAX; ind++)
+    free(runs[ind].buf);
+
+  free(runs);
+
+  return ret;
+}
+
+/*
+ * Reply parsing without a server: a thread answers each pipelined batch of
+ * reqblocks GETs with canned replies on one end of a socket pair and the
+ * client parses them off the other.
+ */
+struct bench_feed_t
+{
+  int     fd;
+  char   *buf;                                     /* replies to one batch */
+  size_t  len;
+  size_t  clen;                                   /* commands of one batch */
+  int     reps;
+};
+typedef struct bench_feed_t bench_feed_t;
+
+static void *bench_feed_thread(void *arg)
+{
+  int           ind;
+  size_t        off;
+  size_t        got = 0;
+  ssize_t       rc;
+  char          cmd[BENCH_BLOCK_SIZE];
+  bench_feed_t *feed = arg;
+
+  for (ind = 0; ind < feed->reps; ind++)
+  {
+    while (got < feed->clen)
+    {
+      if ((rc = read(feed->fd, cmd, sizeof(cmd))) <= 0)
+        return NULL;
+
+      got += rc;
+    }
+
+    got -= feed->clen;
+
+    for (off = 0; off < feed->len; off += rc)
+    {
+      if ((rc = send(feed->fd, &feed->buf[off], feed->len - off, 
+                     MSG_NOSIGNAL)) <= 0)
+        return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+static int bench_parse_size(int vsize)
+{
+  int            ind;
+  int            ret = 0;
+  int            cnt = bench_opt.reqblocks;
+  int            sv[2];
+  char           hdr[32];
+  char          *kptr[1] = { "k" };
+  int            klen[1] = { 1 };
+  char         **keys;
+  int           *klens;
+  void         **vptr;
+  int           *vlen;
+  char          *vals;
+  size_t         off;
+  size_t         start;
+  size_t         usec;
+  char           mode[32];
+  bench_feed_t   feed;
+  redis_parse_t  p;
+  redis_ctx_t   *ctx;
+  pthread_t      feeder;
+
+  sprintf(hdr, "$%d\r\n", vsize);
+
+  feed.len  = (size_t)cnt * (strlen(hdr) + vsize + 2);
+  feed.buf  = malloc(feed.len);
+  feed.reps = bench_opt.ops;
+
+  for (ind = 0, off = 0; ind < cnt; ind++)
+  {
+    memcpy(&feed.buf[off], hdr, strlen(hdr));
+    off += strlen(hdr);
+    memset(&feed.buf[off], 'x', vsize);
+    off += vsize;
+    memcpy(&feed.buf[off], "\r\n", 2);
+    off += 2;
+  }
+
+  start = ytime_get();                        /* the header parser alone */
+
+  for (ind = 0; ind < bench_opt.ops; ind++)
+  {
+    for (off = 0; off < feed.len; off += p.num + 2)
+    {
+      redis_parse_init(&p);
+      off += redis_parse(&p, &feed.buf[off], feed.len - off);
+    }
+  }
+
+  sprintf(mode, "hdr-%d", vsize);
+  bench_report_ops("parse", mode, (size_t)bench_opt.ops * cnt, 
+                   ytime_get() - start);
+
+  keys  = malloc(cnt * sizeof(*keys));
+  klens = malloc(cnt * sizeof(*klens));
+  vptr  = malloc(cnt * sizeof(*vptr));
+  vlen  = malloc(cnt * sizeof(*vlen));
+  vals  = malloc((size_t)cnt * vsize);
+  ctx   = malloc(sizeof(*ctx));
+
+  for (ind = 0; ind < cnt; ind++)
+  {
+    keys[ind]  = kptr[0];
+    klens[ind] = klen[0];
+    vptr[ind]  = &vals[(size_t)ind * vsize];
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    return -1;
+
+  redis_attach(ctx, sv[0]);
+
+  feed.fd   = sv[1];
+  feed.clen = cnt * strlen("*2\r\n$3\r\nGET\r\n$1\r\nk\r\n");
+
+  pthread_create(&feeder, NULL, bench_feed_thread, &feed);
+
+  start = ytime_get();
+
+  for (ind = 0; ind < bench_opt.ops && ret == 0; ind++)
+  {
+    for (off = 0; off < cnt; off++)
+      vlen[off] = vsize;
+
+    if (redis_mget(ctx, keys, klens, vptr, vlen, cnt) < 0)
+      ret = -1;
+  }
+
+  usec = ytime_get() - start;
+
+  sprintf(mode, "mget-%d", vsize);
+  bench_report("parse", mode, feed.len * bench_opt.ops, usec);
+  bench_report_ops("parse", mode, (size_t)bench_opt.ops * cnt, usec);
+
+  redis_close(ctx);                           /* ends the feed thread */
+
+  pthread_join(feeder, NULL);
+
+  close(sv[1]);
+
+  free(ctx);
+  free(vals);
+  free(vlen);
+  free(vptr);
+  free(klens);
+  free(keys);
+  free(feed.buf);
+
+  return ret;
+}
+
+static int bench_parse(void)
+{
+  if (bench_parse_size(16) < 0)
+    return -1;
+
+  return bench_parse_size(BENCH_BLOCK_SIZE);
+}
+
+static const char *bench_engines[] = { "redis", "mem", "log", "sqlite", NULL };
+
+/* Remove what a local engine left at path, a log directory or a database */
+static void bench_engine_clean(const char *path)
+{
+  DIR           *dir;
+  struct dirent *de;
+  char           name[PATH_MAX];
+
+  if ((dir = opendir(path)) != NULL)
+  {
+    while ((de = readdir(dir)) != NULL)
+    {
+      snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+      unlink(name);
+    }
+
+    closedir(dir);
+    rmdir(path);
+    return;
+  }
+
+  unlink(path);
+
+  snprintf(name, sizeof(name), "%s-wal", path);
+  unlink(name);
+
+  snprintf(name, sizeof(name), "%s-shm", path);
+  unlink(name);
+}
+
+/* seqwrite then seqread of the blocks object through the engine name */
+static int bench_engine_run(const char *name)
+{
+  int             ind;
+  int             ind2;
+  int             ret = 0;
+  int             cnt = bench_opt.reqblocks;
+  char          (*keys)[BENCH_KEY_MAXLEN];
+  char          **kptr;
+  int            *klen;
+  void          **vptr;
+  int            *vlen;
+  char           *buf;
+  char            mode[32];
+  char            path[PATH_MAX];
+  size_t          start;
+  size_t          bytes = (size_t)bench_opt.blocks * BENCH_BLOCK_SIZE;
+  tengine_t       eng;
+  tengine_conf_t  conf;
+
+  snprintf(path, sizeof(path), "%s/tantobench.%s", 
+           bench_opt.dir ? bench_opt.dir : "/tmp", name);
+
+  memset(&conf, 0, sizeof(conf));
+
+  conf.host      = bench_opt.ip;
+  conf.port      = bench_opt.port;
+  conf.pool_size = 1;
+  conf.nodelay   = 1;
+  conf.keepalive = REDIS_KEEPALIVE_DEFAULT;
+  conf.path      = path;
+  conf.sync_ms   = bench_opt.sync_ms;
+
+  bench_engine_clean(path);
+
+  if (tengine_open(&eng, name, &conf) < 0)
+    return -1;
+
+  keys = malloc(cnt * sizeof(*keys));
+  kptr = malloc(cnt * sizeof(*kptr));
+  klen = malloc(cnt * sizeof(*klen));
+  vptr = malloc(cnt * sizeof(*vptr));
+  vlen = malloc(cnt * sizeof(*vlen));
+  buf  = malloc(cnt * BENCH_BLOCK_SIZE);
+
+  memset(buf, 'w', cnt * BENCH_BLOCK_SIZE);
+
+  start = ytime_get();
+
+  for (ind = 0; ret == 0 && ind < bench_opt.blocks; ind++)
+  {
+    ind2 = bench_data_key(keys[0], ind);
+    ret  = tengine_set(&eng, keys[0], ind2, buf, BENCH_BLOCK_SIZE);
+  }
+
+  sprintf(mode, "%s-set", name);
+  bench_report("engine", mode, bytes, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ret == 0 && ind < bench_opt.blocks; ind += cnt)
+  {
+    for (ind2 = 0; ind2 < cnt; ind2++)
+    {
+      kptr[ind2] = keys[ind2];
+      klen[ind2] = bench_data_key(keys[ind2], ind + ind2);
+      vptr[ind2] = &buf[ind2 * BENCH_BLOCK_SIZE];
+      vlen[ind2] = BENCH_BLOCK_SIZE;
+    }
+
+    ret = tengine_mput(&eng, kptr, klen, vptr, vlen, NULL, cnt, 
+                       NULL, NULL, NULL, NULL, 0);
+  }
+
+  sprintf(mode, "%s-mput", name);
+  bench_report("engine", mode, bytes, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ret == 0 && ind < bench_opt.blocks; ind++)
+  {
+    ind2 = bench_data_key(keys[0], ind);
+
+    if (tengine_get(&eng, keys[0], ind2, buf, BENCH_BLOCK_SIZE) < 0)
+      ret = -1;
+  }
+
+  sprintf(mode, "%s-get", name);
+  bench_report("engine", mode, bytes, ytime_get() - start);
+
+  start = ytime_get();
+
+  for (ind = 0; ret == 0 && ind < bench_opt.blocks; ind += cnt)
+  {
+    for (ind2 = 0; ind2 < cnt; ind2++)
+    {
+      kptr[ind2] = keys[ind2];
+      klen[ind2] = bench_data_key(keys[ind2], ind + ind2);
+      vptr[ind2] = &buf[ind2 * BENCH_BLOCK_SIZE];
+      vlen[ind2] = BENCH_BLOCK_SIZE;
+    }
+
+    ret = tengine_mget(&eng, kptr, klen, vptr, vlen, cnt);
+  }
+
+  sprintf(mode, "%s-mget", name);
+  bench_report("engine", mode, bytes, ytime_get() - start);
+
+  for (ind = 0; ind < bench_opt.blocks; ind++)
+  {
+    ind2 = bench_data_key(keys[0], ind);
+    tengine_del(&eng, keys[0], ind2);
+  }
+
+  tengine_close(&eng);
+
+  bench_engine_clean(path);
+
+  free(keys);
+  free(kptr);
+  free(klen);
+  free(vptr);
+  free(vlen);
+  free(buf);
+
+  return ret;
+}
+
+/* One engine after the other, a failing one (no redis) does not stop it */
+static int bench_engine(void)
+{
+  int          ret = 0;
+  const char **name;
+
+  if (bench_opt.engine)
+    return bench_engine_run(bench_opt.engine);
+
+  for (name = bench_engines; *name; name++)
+  {
+    if (bench_engine_run(*name) < 0)
+    {
+      printf("%-10s %-12s failed\n", "engine", *name);
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
+
+struct bench_test_t
+{
+  const char  *name;
+  int        (*run)(void);
+  int          local;                          /* needs no redis server */
+};
+typedef struct bench_test_t bench_test_t;
+
+static bench_test_t bench_tests[] = 
+{
+  { "seqread",  bench_seqread,  0 },
+  { "seqwrite", bench_seqwrite, 0 },
+  { "scale",    bench_scale,    0 },
+  { "async",    bench_async,    0 },
+  { "append",   bench_append,   0 },
+  { "meta",     bench_meta,     0 },
+  { "parse",    bench_parse,    1 },
+  { "latency",  bench_latency,  0 },
+  { "engine",   bench_engine,   1 },
+  { "micro",    bench_micro,    0 },
+  { NULL,       NULL,           0 }
+};
+
+static void bench_usage(void)
+{
+  bench_test_t *test;
+
+  printf("usage: tantobench [-h ip] [-p port] [-u socket] [-b blocks] "
+         "[-r reqblocks] [-n ops] [-d dir] [-e engine] [-s sync_ms] "
+         "[-j] <test>\n");
+  printf("tests:");
+
+  for (test = bench_tests; test->name; test++)
+    printf(" %s", test->name);
+
+  printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int           opt;
+  int           ret;
+  bench_test_t *test;
+
+  ytrace_level = YTRACE_DEFAULT;
+
+  while ((opt = getopt(argc, argv, "h:p:u:b:r:n:d:e:s:j")) != -1)
+  {
+    switch (opt)
+    {
+      case 'h': bench_opt.ip        = optarg;       break;
+      case 'p': bench_opt.port      = atoi(optarg); break;
+      case 'u': bench_opt.sock      = optarg;       break;
+      case 'b': bench_opt.blocks    = atoi(optarg); break;
+      case 'r': bench_opt.reqblocks = atoi(optarg); break;
+      case 'n': bench_opt.ops       = atoi(optarg); break;
+      case 'd': bench_opt.dir       = optarg;       break;
+      case 'e': bench_opt.engine    = optarg;       break;
+      case 's': bench_opt.sync_ms   = atoi(optarg); break;
+      case 'j': bench_opt.json      = 1;            break;
+      default : bench_usage(); return 1;
+    }
+  }
+
+  if (optind >= argc || bench_opt.blocks <= 0 || bench_opt.reqblocks <= 0)
+  {
+    bench_usage();
+    return 1;
+  }
+
+  if (bench_opt.blocks % bench_opt.reqblocks)
+    bench_opt.blocks -= bench_opt.blocks % bench_opt.reqblocks;
+
+  for (test = bench_tests; test->name; test++)
+  {
+    if (strcmp(test->name, argv[optind]) == 0)
+      break;
+  }
+
+  if (test->name == NULL)
+  {
+    bench_usage();
+    return 1;
+  }
+
+  if (!test->local && 
+      redis_connect(&bench_ctx, bench_opt.ip, bench_opt.port) < 0)
+  {
+    printf("redis connect failed\n");
+    return 1;
+  }
+
+  if ((ret = test->run()) < 0)
+    printf("%s failed\n", test->name);
+
+  redis_close(&bench_ctx);
+
+  return ret < 0 ? 1 : 0;
+}
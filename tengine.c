@@ -0,0 +1,83 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <ytrace.h>
+#include <tengine.h>
+
+extern tengine_ops_t tengine_redis_ops;
+extern tengine_ops_t tengine_mem_ops;
+extern tengine_ops_t tengine_log_ops;
+extern tengine_ops_t tengine_sqlite_ops;
+
+static tengine_ops_t *tengine_list[] = 
+{
+  &tengine_redis_ops,
+  &tengine_mem_ops,
+  &tengine_log_ops,
+  &tengine_sqlite_ops,
+  NULL
+};
+
+/* Open the engine called name, redis if name is NULL */
+int tengine_open(tengine_t *eng, const char *name, tengine_conf_t *conf)
+{
+  tengine_ops_t **ops;
+
+  if (name == NULL)
+    name = tengine_list[0]->name;
+
+  for (ops = tengine_list; *ops; ops++)
+  {
+    if (strcmp((*ops)->name, name) == 0)
+      break;
+  }
+
+  if (*ops == NULL)
+  {
+    ytrace_msg(YTRACE_ERROR, "unknown engine %s\n", name);
+    return -1;
+  }
+
+  eng->ops  = *ops;
+  eng->priv = NULL;
+
+  return eng->ops->open(eng, conf);
+}
+
+/* 
+ * Threads do not survive the fork of a daemonizing fuse_main, engines 
+ * start theirs here, once the process that serves requests runs.
+ */
+int tengine_start(tengine_t *eng)
+{
+  if (eng->ops->start == NULL)
+    return 0;
+
+  return eng->ops->start(eng);
+}
+
+void tengine_close(tengine_t *eng)
+{
+  if (eng->ops)
+    eng->ops->close(eng);
+
+  eng->ops  = NULL;
+  eng->priv = NULL;
+}
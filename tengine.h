@@ -0,0 +1,144 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _TENGINE_H
+
+#include <stddef.h>
+
+#define _TENGINE_H
+
+/*
+ * Storage engine interface. tanto keeps everything as values under string
+ * keys and calls the engine through these operations, with the semantics
+ * of the redis commands they are named after; values are strings, except
+ * the lists that tengine_mput pushes to. The redis engine sends them to a
+ * redis server, the others implement them in process.
+ */
+
+#define TENGINE_PUT_SET      (-1)                    /* tengine_mput voffs[] */
+#define TENGINE_PUT_APPEND   (-2)
+#define TENGINE_PUT_RPUSH    (-3)
+
+#define TENGINE_SYNC_MS      (100)                   /* tengine_conf_t sync_ms */
+
+typedef struct tengine_t tengine_t;
+
+/* Called for each key tengine_scan finds, a non 0 return stops the scan */
+typedef int (*tengine_scan_cb_t)(char *key, int klen, void *arg);
+
+/* Mount time settings, each engine uses the ones that apply to it */
+struct tengine_conf_t
+{
+  char  *host;                    /* redis address, host or socket path */
+  int    port;
+  int    pool_size;                             /* connections or handles */
+  int    nodelay;                                 /* redis socket tuning */
+  int    keepalive;
+  int    sndbuf;
+  int    rcvbuf;
+  char  *path;                           /* where local engines keep data */
+  int    sync_ms;       /* local engines: fsync batching window, 0 is none */
+};
+typedef struct tengine_conf_t tengine_conf_t;
+
+struct tengine_ops_t
+{
+  const char  *name;
+  int        (*open)(tengine_t *eng, tengine_conf_t *conf);
+  void       (*close)(tengine_t *eng);
+
+  /* Start background threads, in the process that serves, NULL if none */
+  int        (*start)(tengine_t *eng);
+
+  /* value length copied, -1 if there is no key */
+  int        (*get)(tengine_t *eng, char *key, int klen, void *val, int vlen);
+  int        (*set)(tengine_t *eng, char *key, int klen, void *val, int vlen);
+  int        (*del)(tengine_t *eng, char *key, int klen);
+
+  /* vlens[i] is set to the length copied, -1 if there is no key */
+  int        (*mget)(tengine_t *eng, char *keys[], int klens[], 
+                     void *vals[], int vlens[], int n);
+
+  /*
+   * SET, APPEND or RPUSH vals[i] at keys[i], or SETRANGE it at offset 
+   * voffs[i], as voffs[i] says; DEL keys[i] if vals[i] is NULL. Then set 
+   * bit boffs[j] (bit 0 is the high bit of byte 0) of bkeys[j] to bvals[j].
+   */
+  int        (*mput)(tengine_t *eng, char *keys[], int klens[], 
+                     void *vals[], int vlens[], long voffs[], int n, 
+                     char *bkeys[], int bklens[], size_t boffs[], 
+                     int bvals[], int nb);
+
+  /* *vlen bytes from start in, *vlen out is what there was */
+  int        (*getrange)(tengine_t *eng, char *key, int klen, 
+                         long start, void *val, int *vlen);
+  int        (*unlink)(tengine_t *eng, char *keys[], int klens[], int n);
+
+  /* *vlen is -1 past the end of the list */
+  int        (*lindex)(tengine_t *eng, char *key, int klen, 
+                       long index, void *val, int *vlen);
+  int        (*lrem)(tengine_t *eng, char *key, int klen, 
+                     void *val, int vlen);
+  int        (*incrby)(tengine_t *eng, char *key, int klen, 
+                       long long incr, long long *val);
+  int        (*rename)(tengine_t *eng, char *key, int klen, 
+                       char *nkey, int nklen);
+
+  /* Keys matching the glob pattern pat, all keys if pat is NULL */
+  int        (*scan)(tengine_t *eng, char *pat, int plen, 
+                     tengine_scan_cb_t cb, void *arg);
+};
+typedef struct tengine_ops_t tengine_ops_t;
+
+struct tengine_t
+{
+  const tengine_ops_t  *ops;
+  void                 *priv;                          /* engine's state */
+};
+
+int  tengine_open(tengine_t *eng, const char *name, tengine_conf_t *conf);
+int  tengine_start(tengine_t *eng);
+void tengine_close(tengine_t *eng);
+
+#define tengine_get(eng, key, klen, val, vlen) \
+        (eng)->ops->get(eng, key, klen, val, vlen)
+#define tengine_set(eng, key, klen, val, vlen) \
+        (eng)->ops->set(eng, key, klen, val, vlen)
+#define tengine_del(eng, key, klen) \
+        (eng)->ops->del(eng, key, klen)
+#define tengine_mget(eng, keys, klens, vals, vlens, n) \
+        (eng)->ops->mget(eng, keys, klens, vals, vlens, n)
+#define tengine_mput(eng, keys, klens, vals, vlens, voffs, n, \
+                     bkeys, bklens, boffs, bvals, nb) \
+        (eng)->ops->mput(eng, keys, klens, vals, vlens, voffs, n, \
+                         bkeys, bklens, boffs, bvals, nb)
+#define tengine_getrange(eng, key, klen, start, val, vlen) \
+        (eng)->ops->getrange(eng, key, klen, start, val, vlen)
+#define tengine_unlink(eng, keys, klens, n) \
+        (eng)->ops->unlink(eng, keys, klens, n)
+#define tengine_lindex(eng, key, klen, index, val, vlen) \
+        (eng)->ops->lindex(eng, key, klen, index, val, vlen)
+#define tengine_lrem(eng, key, klen, val, vlen) \
+        (eng)->ops->lrem(eng, key, klen, val, vlen)
+#define tengine_incrby(eng, key, klen, incr, val) \
+        (eng)->ops->incrby(eng, key, klen, incr, val)
+#define tengine_rename(eng, key, klen, nkey, nklen) \
+        (eng)->ops->rename(eng, key, klen, nkey, nklen)
+#define tengine_scan(eng, pat, plen, cb, arg) \
+        (eng)->ops->scan(eng, pat, plen, cb, arg)
+
+#endif /* tengine.h */
@@ -0,0 +1,1402 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <ytrace.h>
+#include <tengine.h>
+
+/*
+ * The log engine keeps objects in local segment files, with no server.
+ * Every update appends a record with the whole new value to the active 
+ * segment; an in-memory hash index maps each key to its latest record and
+ * is rebuilt at open by replaying the segments oldest first. Deletes 
+ * append a tombstone. Partial updates (SETRANGE, APPEND, RPUSH, bits) read
+ * the current value, change it and append the result.
+ *
+ * Writes reach the page cache at once and a background thread fdatasyncs
+ * the active segment every sync_ms, so one sync covers all the writes of
+ * that window; with sync_ms 0 every update is synced before it returns.
+ * The same thread compacts segments that are mostly superseded records:
+ * the live ones are copied to the active segment and the file removed.
+ */
+
+#define TENGINE_LOG_SEG_MAX    (64 * 1024 * 1024)      /* then a new segment */
+#define TENGINE_LOG_DEAD_PCT   (50)      /* compact segments this superseded */
+#define TENGINE_LOG_BUCKETS    (65536)                  /* initial, grows */
+#define TENGINE_LOG_KEY_MAX    (4096)
+#define TENGINE_LOG_VAL_MAX    (1U << 30)
+
+#define TENGINE_LOG_DEL        (0x1)                            /* tombstone */
+#define TENGINE_LOG_LIST       (0x2)       /* value is a list, see lindex */
+
+/* Record header, followed by klen key bytes and vlen value bytes */
+struct tengine_log_rec_t
+{
+  uint32_t                    sum;            /* FNV-1a of all that follows */
+  uint32_t                    flags;
+  uint32_t                    klen;
+  uint32_t                    vlen;
+};
+typedef struct tengine_log_rec_t tengine_log_rec_t;
+
+#define TENGINE_LOG_REC_SIZE(klen, vlen) \
+        (sizeof(tengine_log_rec_t) + (klen) + (vlen))
+
+struct tengine_log_seg_t
+{
+  struct tengine_log_seg_t   *next;                  /* newer segment */
+  uint32_t                    id;
+  int                         fd;
+  uint64_t                    size;
+  uint64_t                    dead;               /* superseded record bytes */
+};
+typedef struct tengine_log_seg_t tengine_log_seg_t;
+
+struct tengine_log_ent_t
+{
+  struct tengine_log_ent_t   *next;                          /* hash chain */
+  uint32_t                    hash;
+  uint32_t                    flags;                  /* of the record */
+  tengine_log_seg_t          *seg;
+  uint64_t                    off;                    /* record start */
+  uint32_t                    vlen;
+  int                         klen;
+  char                        key[];
+};
+typedef struct tengine_log_ent_t tengine_log_ent_t;
+
+struct tengine_log_t
+{
+  pthread_rwlock_t            lock;         /* index and segments, appends */
+  char                        dir[PATH_MAX];
+  int                         sync_ms;
+  int                         dirty;        /* active not synced since write */
+  tengine_log_seg_t          *segs;                        /* oldest first */
+  tengine_log_seg_t          *active;                         /* the newest */
+  tengine_log_ent_t         **buckets;
+  size_t                      nbuckets;
+  size_t                      count;
+  pthread_t                   thread;             /* sync and compaction */
+  pthread_mutex_t             tlock;
+  pthread_cond_t              tcond;
+  int                         stop;
+};
+typedef struct tengine_log_t tengine_log_t;
+
+static uint32_t tengine_log_sum(uint32_t hash, const void *buf, size_t len)
+{
+  const unsigned char *bp = buf;
+
+  while (len--)
+  {
+    hash ^= *bp++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+#define tengine_log_hash(key, klen) tengine_log_sum(2166136261u, key, klen)
+
+static tengine_log_ent_t **tengine_log_slot(tengine_log_t *log, 
+                                            char *key, int klen, 
+                                            uint32_t hash)
+{
+  tengine_log_ent_t **pent = &log->buckets[hash & (log->nbuckets - 1)];
+
+  for (; *pent; pent = &(*pent)->next)
+  {
+    if ((*pent)->hash == hash && (*pent)->klen == klen && 
+        memcmp((*pent)->key, key, klen) == 0)
+      break;
+  }
+
+  return pent;
+}
+
+/* The entry of a key that is there, not deleted */
+static tengine_log_ent_t *tengine_log_find(tengine_log_t *log, 
+                                           char *key, int klen)
+{
+  tengine_log_ent_t *ent;
+
+  ent = *tengine_log_slot(log, key, klen, tengine_log_hash(key, klen));
+
+  return (ent && !(ent->flags & TENGINE_LOG_DEL)) ? ent : NULL;
+}
+
+static void tengine_log_grow(tengine_log_t *log)
+{
+  size_t               ind;
+  size_t               nbuckets = log->nbuckets * 2;
+  tengine_log_ent_t  **buckets;
+  tengine_log_ent_t   *ent;
+  tengine_log_ent_t   *next;
+
+  if ((buckets = calloc(nbuckets, sizeof(*buckets))) == NULL)
+    return;
+
+  for (ind = 0; ind < log->nbuckets; ind++)
+  {
+    for (ent = log->buckets[ind]; ent; ent = next)
+    {
+      next = ent->next;
+
+      ent->next = buckets[ent->hash & (nbuckets - 1)];
+      buckets[ent->hash & (nbuckets - 1)] = ent;
+    }
+  }
+
+  free(log->buckets);
+
+  log->buckets  = buckets;
+  log->nbuckets = nbuckets;
+}
+
+/*
+ * Point key at the record at off of seg. The record it replaces, if any,
+ * becomes dead space of its segment.
+ */
+static int tengine_log_index(tengine_log_t *log, char *key, int klen, 
+                             uint32_t flags, tengine_log_seg_t *seg, 
+                             uint64_t off, uint32_t vlen)
+{
+  uint32_t             hash = tengine_log_hash(key, klen);
+  tengine_log_ent_t  **pent = tengine_log_slot(log, key, klen, hash);
+  tengine_log_ent_t   *ent  = *pent;
+
+  if (ent)
+    ent->seg->dead += TENGINE_LOG_REC_SIZE(klen, ent->vlen);
+  else if (flags & TENGINE_LOG_DEL)        /* nothing older to hide */
+    return 0;
+  else
+  {
+    if ((ent = malloc(sizeof(*ent) + klen)) == NULL)
+      return -1;
+
+    memcpy(ent->key, key, klen);
+
+    ent->klen = klen;
+    ent->hash = hash;
+    ent->next = *pent;
+    *pent     = ent;
+
+    if (++log->count >= log->nbuckets * 2)
+      tengine_log_grow(log);
+  }
+
+  ent->flags = flags;
+  ent->seg   = seg;
+  ent->off   = off;
+  ent->vlen  = vlen;
+
+  return 0;
+}
+
+static void tengine_log_unindex(tengine_log_t *log, tengine_log_ent_t *ent)
+{
+  tengine_log_ent_t **pent;
+
+  pent = tengine_log_slot(log, ent->key, ent->klen, ent->hash);
+
+  *pent = ent->next;
+
+  log->count--;
+
+  free(ent);
+}
+
+static void tengine_log_seg_path(tengine_log_t *log, uint32_t id, 
+                                 char *path, size_t size)
+{
+  snprintf(path, size, "%s/%08u.log", log->dir, id);
+}
+
+static tengine_log_seg_t *tengine_log_seg_open(tengine_log_t *log, 
+                                               uint32_t id, int create)
+{
+  char               path[PATH_MAX + 16];
+  struct stat        st;
+  tengine_log_seg_t *seg;
+
+  if ((seg = calloc(1, sizeof(*seg))) == NULL)
+    return NULL;
+
+  tengine_log_seg_path(log, id, path, sizeof(path));
+
+  if ((seg->fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 
+                      0644)) < 0 || fstat(seg->fd, &st) < 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "log segment %s : %s\n", path, strerror(errno));
+
+    if (seg->fd >= 0)
+      close(seg->fd);
+
+    free(seg);
+    return NULL;
+  }
+
+  seg->id   = id;
+  seg->size = st.st_size;
+
+  return seg;
+}
+
+/* Seal the active segment and start the next one */
+static int tengine_log_rotate(tengine_log_t *log)
+{
+  tengine_log_seg_t *seg;
+
+  if ((seg = tengine_log_seg_open(log, log->active->id + 1, 1)) == NULL)
+    return -1;
+
+  fdatasync(log->active->fd);
+
+  log->active->next = seg;
+  log->active       = seg;
+  log->dirty        = 0;
+
+  return 0;
+}
+
+/*
+ * Append a record for key with the value gathered from iov, and index it.
+ * Called with the lock held for writing.
+ */
+static int tengine_log_append(tengine_log_t *log, char *key, int klen, 
+                              uint32_t flags, struct iovec *val, int nval)
+{
+  int                ind;
+  uint32_t           vlen = 0;
+  uint64_t           off;
+  ssize_t            rc;
+  tengine_log_rec_t  rec;
+  struct iovec       iov[8];
+
+  if (nval > 6)
+    return -1;
+
+  if (log->active->size >= TENGINE_LOG_SEG_MAX && tengine_log_rotate(log) < 0)
+    return -1;
+
+  for (ind = 0; ind < nval; ind++)
+    vlen += val[ind].iov_len;
+
+  rec.flags = flags;
+  rec.klen  = klen;
+  rec.vlen  = vlen;
+
+  rec.sum = tengine_log_sum(2166136261u, &rec.flags, 
+                            sizeof(rec) - sizeof(rec.sum));
+  rec.sum = tengine_log_sum(rec.sum, key, klen);
+
+  for (ind = 0; ind < nval; ind++)
+    rec.sum = tengine_log_sum(rec.sum, val[ind].iov_base, val[ind].iov_len);
+
+  iov[0].iov_base = &rec;
+  iov[0].iov_len  = sizeof(rec);
+
+  iov[1].iov_base = key;
+  iov[1].iov_len  = klen;
+
+  if (nval)
+    memcpy(&iov[2], val, nval * sizeof(*val));
+
+  off = log->active->size;
+
+  rc = pwritev(log->active->fd, iov, nval + 2, off);
+
+  if (rc != (ssize_t)TENGINE_LOG_REC_SIZE(klen, vlen))
+  {
+    ytrace_msg(YTRACE_ERROR, "log append failed : %s\n", 
+               rc < 0 ? strerror(errno) : "short write");
+    return -1;              /* the next append overwrites the partial one */
+  }
+
+  log->active->size += rc;
+  log->dirty         = 1;
+
+  return tengine_log_index(log, key, klen, flags, log->active, off, vlen);
+}
+
+/* 
+ * Make the appends so far durable now, or leave them to the sync thread.
+ * Until tengine_log_start runs there is no thread, every commit syncs.
+ */
+static int tengine_log_commit(tengine_log_t *log)
+{
+  if ((log->sync_ms > 0 && log->thread) || !log->dirty)
+    return 0;
+
+  log->dirty = 0;
+
+  return fdatasync(log->active->fd);
+}
+
+static int tengine_log_read(tengine_log_ent_t *ent, size_t from, 
+                            void *buf, size_t len)
+{
+  ssize_t rc;
+
+  rc = pread(ent->seg->fd, buf, len, 
+             ent->off + sizeof(tengine_log_rec_t) + ent->klen + from);
+
+  return rc == (ssize_t)len ? 0 : -1;
+}
+
+/* Copy of the value of ent, in a buffer of at least cap bytes */
+static char *tengine_log_load(tengine_log_ent_t *ent, size_t cap)
+{
+  char *buf;
+
+  if (cap < ent->vlen)
+    cap = ent->vlen;
+
+  if ((buf = malloc(cap ? cap : 1)) == NULL)
+    return NULL;
+
+  if (tengine_log_read(ent, 0, buf, ent->vlen) < 0)
+  {
+    free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+/* Replay one segment into the index, up to the first bad record */
+static int tengine_log_replay(tengine_log_t *log, tengine_log_seg_t *seg)
+{
+  uint64_t           off;
+  uint32_t           sum;
+  char              *buf = NULL;
+  char              *nbuf;
+  size_t             cap = 0;
+  size_t             len;
+  tengine_log_rec_t  rec;
+
+  for (off = 0; off + sizeof(rec) <= seg->size; off += sizeof(rec) + len)
+  {
+    if (pread(seg->fd, &rec, sizeof(rec), off) != sizeof(rec) ||
+        rec.klen == 0 || rec.klen > TENGINE_LOG_KEY_MAX || 
+        rec.vlen > TENGINE_LOG_VAL_MAX)
+      break;
+
+    len = rec.klen + rec.vlen;
+
+    if (len > cap)
+    {
+      if ((nbuf = realloc(buf, len)) == NULL)
+        break;
+
+      buf = nbuf;
+      cap = len;
+    }
+
+    if (pread(seg->fd, buf, len, off + sizeof(rec)) != (ssize_t)len)
+      break;
+
+    sum = tengine_log_sum(2166136261u, &rec.flags, 
+                          sizeof(rec) - sizeof(rec.sum));
+
+    if (tengine_log_sum(sum, buf, len) != rec.sum)
+      break;
+
+    if (tengine_log_index(log, buf, rec.klen, rec.flags, seg, 
+                          off, rec.vlen) < 0)
+    {
+      free(buf);
+      return -1;
+    }
+  }
+
+  free(buf);
+
+  if (off != seg->size)                 /* torn write at a crash, or worse */
+  {
+    ytrace_msg(YTRACE_ERROR, "log segment %u : %llu bad bytes at %llu\n", 
+               seg->id, (unsigned long long)(seg->size - off), 
+               (unsigned long long)off);
+
+    seg->dead += seg->size - off;
+
+    if (seg->next == NULL && ftruncate(seg->fd, off) == 0)
+    {
+      seg->dead -= seg->size - off;
+      seg->size  = off;
+    }
+  }
+
+  return 0;
+}
+
+static int tengine_log_cmp_id(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Open the segments in log->dir oldest first, and build the index */
+static int tengine_log_load_segs(tengine_log_t *log)
+{
+  int                 ind;
+  int                 cnt = 0;
+  int                 cap = 0;
+  uint32_t           *ids = NULL;
+  uint32_t           *nids;
+  unsigned int        id;
+  char                tail;
+  DIR                *dir;
+  struct dirent      *dent;
+  tengine_log_seg_t  *seg;
+  tengine_log_seg_t **pseg = &log->segs;
+
+  if ((dir = opendir(log->dir)) == NULL)
+    return -1;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if (sscanf(dent->d_name, "%u.lo%c", &id, &tail) != 2 || tail != 'g')
+      continue;
+
+    if (cnt == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+
+      if ((nids = realloc(ids, cap * sizeof(*ids))) == NULL)
+      {
+        closedir(dir);
+        free(ids);
+        return -1;
+      }
+
+      ids = nids;
+    }
+
+    ids[cnt++] = id;
+  }
+
+  closedir(dir);
+
+  qsort(ids, cnt, sizeof(*ids), tengine_log_cmp_id);
+
+  for (ind = 0; ind < cnt; ind++)
+  {
+    if ((seg = tengine_log_seg_open(log, ids[ind], 0)) == NULL)
+    {
+      free(ids);
+      return -1;
+    }
+
+    *pseg       = seg;
+    pseg        = &seg->next;
+    log->active = seg;
+  }
+
+  free(ids);
+
+  for (seg = log->segs; seg; seg = seg->next)
+  {
+    if (tengine_log_replay(log, seg) < 0)
+      return -1;
+  }
+
+  if (log->active == NULL &&
+      (log->segs = log->active = tengine_log_seg_open(log, 1, 1)) == NULL)
+    return -1;
+
+  return 0;
+}
+
+/*
+ * Copy the live records of a sealed segment to the active one and remove 
+ * it. Tombstones are dropped when nothing older than seg is left, as there
+ * is then no record for them to hide.
+ */
+static int tengine_log_compact(tengine_log_t *log, tengine_log_seg_t *seg)
+{
+  uint64_t            off;
+  size_t              len;
+  char               *buf = NULL;
+  char               *nbuf;
+  size_t              cap = 0;
+  char                path[PATH_MAX + 16];
+  tengine_log_rec_t   rec;
+  tengine_log_ent_t  *ent;
+  tengine_log_seg_t **pseg;
+  struct iovec        iov;
+  int                 ret = 0;
+
+  for (off = 0; off < seg->size && ret == 0; off += sizeof(rec) + len)
+  {
+    len = 0;
+
+    if (pread(seg->fd, &rec, sizeof(rec), off) != sizeof(rec) ||
+        rec.klen == 0 || rec.klen > TENGINE_LOG_KEY_MAX ||      /* bad tail */
+        rec.vlen > TENGINE_LOG_VAL_MAX)
+      break;
+
+    len = rec.klen + rec.vlen;
+
+    if (len > cap)
+    {
+      if ((nbuf = realloc(buf, len)) == NULL)
+      {
+        ret = -1;
+        break;
+      }
+
+      buf = nbuf;
+      cap = len;
+    }
+
+    if (pread(seg->fd, buf, len, off + sizeof(rec)) != (ssize_t)len)
+    {
+      ret = -1;
+      break;
+    }
+
+    pthread_rwlock_wrlock(&log->lock);
+
+    ent = *tengine_log_slot(log, buf, rec.klen, 
+                            tengine_log_hash(buf, rec.klen));
+
+    if (ent && ent->seg == seg && ent->off == off)     /* still the latest */
+    {
+      iov.iov_base = &buf[rec.klen];
+      iov.iov_len  = rec.vlen;
+
+      if ((rec.flags & TENGINE_LOG_DEL) && log->segs == seg)
+        tengine_log_unindex(log, ent);
+      else if (tengine_log_append(log, buf, rec.klen, rec.flags, 
+                                  &iov, 1) < 0)
+        ret = -1;
+    }
+
+    pthread_rwlock_unlock(&log->lock);
+  }
+
+  free(buf);
+
+  if (ret < 0)
+    return -1;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  if (log->dirty)                /* copies are durable before seg goes */
+  {
+    fdatasync(log->active->fd);
+    log->dirty = 0;
+  }
+
+  for (pseg = &log->segs; *pseg != seg; pseg = &(*pseg)->next)
+    ;
+
+  *pseg = seg->next;
+
+  close(seg->fd);
+
+  tengine_log_seg_path(log, seg->id, path, sizeof(path));
+  unlink(path);
+
+  pthread_rwlock_unlock(&log->lock);
+
+  ytrace_msg(YTRACE_LEVEL1, "log segment %u compacted\n", seg->id);
+
+  free(seg);
+
+  return 0;
+}
+
+static void *tengine_log_main(void *arg)
+{
+  int                fd;
+  tengine_log_t     *log = arg;
+  tengine_log_seg_t *seg;
+  tengine_log_seg_t *cand;
+  struct timeval     now;
+  struct timespec    ts;
+  int                wait = log->sync_ms > 0 ? log->sync_ms : 1000;
+
+  pthread_mutex_lock(&log->tlock);
+
+  while (!log->stop)
+  {
+    gettimeofday(&now, NULL);
+
+    ts.tv_sec  = now.tv_sec + wait / 1000;
+    ts.tv_nsec = now.tv_usec * 1000 + (long)(wait % 1000) * 1000000;
+
+    if (ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(&log->tcond, &log->tlock, &ts);
+
+    if (log->stop)
+      break;
+
+    pthread_mutex_unlock(&log->tlock);
+
+    fd = -1;
+
+    pthread_rwlock_wrlock(&log->lock);
+
+    if (log->dirty)              /* sync on a dup, writers carry on meanwhile */
+    {
+      fd         = dup(log->active->fd);
+      log->dirty = 0;
+    }
+
+    for (seg = log->segs; seg != log->active; seg = seg->next)
+    {
+      if (seg->dead * 100 >= seg->size * TENGINE_LOG_DEAD_PCT)
+        break;
+    }
+
+    cand = seg != log->active ? seg : NULL;
+
+    pthread_rwlock_unlock(&log->lock);
+
+    if (fd >= 0)
+    {
+      fdatasync(fd);
+      close(fd);
+    }
+
+    if (cand && tengine_log_compact(log, cand) < 0)
+      ytrace_msg(YTRACE_ERROR, "log segment %u compaction failed\n", 
+                 cand->id);
+
+    pthread_mutex_lock(&log->tlock);
+  }
+
+  pthread_mutex_unlock(&log->tlock);
+
+  return NULL;
+}
+
+static void tengine_log_close(tengine_t *eng)
+{
+  size_t              ind;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+  tengine_log_ent_t  *next;
+  tengine_log_seg_t  *seg;
+
+  if (log->thread)
+  {
+    pthread_mutex_lock(&log->tlock);
+    log->stop = 1;
+    pthread_cond_signal(&log->tcond);
+    pthread_mutex_unlock(&log->tlock);
+
+    pthread_join(log->thread, NULL);
+  }
+
+  if (log->active && log->dirty)
+    fdatasync(log->active->fd);
+
+  while ((seg = log->segs) != NULL)
+  {
+    log->segs = seg->next;
+
+    close(seg->fd);
+    free(seg);
+  }
+
+  for (ind = 0; log->buckets && ind < log->nbuckets; ind++)
+  {
+    for (ent = log->buckets[ind]; ent; ent = next)
+    {
+      next = ent->next;
+      free(ent);
+    }
+  }
+
+  free(log->buckets);
+
+  pthread_rwlock_destroy(&log->lock);
+  pthread_mutex_destroy(&log->tlock);
+  pthread_cond_destroy(&log->tcond);
+
+  free(log);
+}
+
+static int tengine_log_open(tengine_t *eng, tengine_conf_t *conf)
+{
+  tengine_log_t *log;
+
+  if (conf->path == NULL)
+  {
+    ytrace_msg(YTRACE_ERROR, "the log engine needs a path\n");
+    return -1;
+  }
+
+  if (mkdir(conf->path, 0755) < 0 && errno != EEXIST)
+  {
+    ytrace_msg(YTRACE_ERROR, "log dir %s : %s\n", conf->path, 
+               strerror(errno));
+    return -1;
+  }
+
+  if ((log = calloc(1, sizeof(*log))) == NULL)
+    return -1;
+
+  snprintf(log->dir, sizeof(log->dir), "%s", conf->path);
+
+  log->sync_ms  = conf->sync_ms;
+  log->nbuckets = TENGINE_LOG_BUCKETS;
+  log->buckets  = calloc(log->nbuckets, sizeof(*log->buckets));
+
+  pthread_rwlock_init(&log->lock, NULL);
+  pthread_mutex_init(&log->tlock, NULL);
+  pthread_cond_init(&log->tcond, NULL);
+
+  eng->priv = log;
+
+  if (log->buckets == NULL || tengine_log_load_segs(log) < 0)
+  {
+    tengine_log_close(eng);
+    return -1;
+  }
+
+  ytrace_msg(YTRACE_LEVEL1, "log engine %s : %zu keys\n", log->dir, 
+             log->count);
+
+  return 0;
+}
+
+/* The sync and compaction thread */
+static int tengine_log_start(tengine_t *eng)
+{
+  tengine_log_t *log = eng->priv;
+  int            rc;
+
+  if (log->thread)
+    return 0;
+
+  pthread_rwlock_wrlock(&log->lock);           /* commit reads log->thread */
+
+  if ((rc = pthread_create(&log->thread, NULL, tengine_log_main, log)) != 0)
+    log->thread = 0;
+
+  pthread_rwlock_unlock(&log->lock);
+
+  if (rc != 0)
+  {
+    ytrace_msg(YTRACE_ERROR, "log sync thread : %s\n", strerror(rc));
+    return -1;
+  }
+
+  return 0;
+}
+
+static int tengine_log_get(tengine_t *eng, char *key, int klen, 
+                           void *val, int vlen)
+{
+  int                 ret = -1;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+
+  pthread_rwlock_rdlock(&log->lock);
+
+  if ((ent = tengine_log_find(log, key, klen)) && 
+      !(ent->flags & TENGINE_LOG_LIST))
+  {
+    ret = ent->vlen < vlen ? ent->vlen : vlen;
+
+    if (tengine_log_read(ent, 0, val, ret) < 0)
+      ret = -1;
+  }
+
+  pthread_rwlock_unlock(&log->lock);
+
+  return ret;
+}
+
+static int tengine_log_put_one(tengine_log_t *log, char *key, int klen, 
+                               void *val, int vlen)
+{
+  struct iovec iov;
+
+  iov.iov_base = val;
+  iov.iov_len  = vlen;
+
+  return tengine_log_append(log, key, klen, 0, &iov, 1);
+}
+
+static int tengine_log_set(tengine_t *eng, char *key, int klen, 
+                           void *val, int vlen)
+{
+  int            ret;
+  tengine_log_t *log = eng->priv;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  if ((ret = tengine_log_put_one(log, key, klen, val, vlen)) == 0)
+    ret = tengine_log_commit(log);
+
+  pthread_rwlock_unlock(&log->lock);
+
+  return ret;
+}
+
+static int tengine_log_remove(tengine_log_t *log, char *key, int klen)
+{
+  if (tengine_log_find(log, key, klen) == NULL)
+    return 0;
+
+  return tengine_log_append(log, key, klen, TENGINE_LOG_DEL, NULL, 0);
+}
+
+static int tengine_log_del(tengine_t *eng, char *key, int klen)
+{
+  int            ret;
+  tengine_log_t *log = eng->priv;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  if ((ret = tengine_log_remove(log, key, klen)) == 0)
+    ret = tengine_log_commit(log);
+
+  pthread_rwlock_unlock(&log->lock);
+
+  return ret;
+}
+
+static int tengine_log_mget(tengine_t *eng, char *keys[], int klens[], 
+                            void *vals[], int vlens[], int n)
+{
+  int                 ind;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+
+  pthread_rwlock_rdlock(&log->lock);
+
+  for (ind = 0; ind < n; ind++)
+  {
+    if ((ent = tengine_log_find(log, keys[ind], klens[ind])) == NULL ||
+        (ent->flags & TENGINE_LOG_LIST))
+    {
+      vlens[ind] = -1;
+      continue;
+    }
+
+    if (ent->vlen < vlens[ind])
+      vlens[ind] = ent->vlen;
+
+    if (tengine_log_read(ent, 0, vals[ind], vlens[ind]) < 0)
+      vlens[ind] = -1;
+  }
+
+  pthread_rwlock_unlock(&log->lock);
+
+  return 0;
+}
+
+/* SETRANGE or APPEND val to the string at key */
+static int tengine_log_patch(tengine_log_t *log, char *key, int klen, 
+                             void *val, int vlen, long voff)
+{
+  int                 ret;
+  char               *buf;
+  size_t              len = 0;
+  size_t              off;
+  tengine_log_ent_t  *ent = tengine_log_find(log, key, klen);
+  struct iovec        iov[3];
+
+  if (ent && (ent->flags & TENGINE_LOG_LIST))
+    return -1;
+
+  len = ent ? ent->vlen : 0;
+  off = voff == TENGINE_PUT_APPEND ? len : (size_t)voff;
+
+  if (ent == NULL && off == 0)                   /* nothing to read first */
+    return tengine_log_put_one(log, key, klen, val, vlen);
+
+  if (ent == NULL)
+    buf = calloc(1, off + vlen);
+  else
+    buf = tengine_log_load(ent, off + vlen);
+
+  if (buf == NULL)
+    return -1;
+
+  if (off > len)
+    memset(&buf[len], 0, off - len);
+
+  iov[0].iov_base = buf;                        /* head, val, old tail */
+  iov[0].iov_len  = off;
+  iov[1].iov_base = val;
+  iov[1].iov_len  = vlen;
+  iov[2].iov_base = &buf[off + vlen < len ? off + vlen : len];
+  iov[2].iov_len  = off + vlen < len ? len - off - vlen : 0;
+
+  ret = tengine_log_append(log, key, klen, 0, iov, 3);
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_log_rpush(tengine_log_t *log, char *key, int klen, 
+                             void *val, int vlen)
+{
+  int                 ret;
+  char               *buf = NULL;
+  uint32_t            ilen = vlen;
+  tengine_log_ent_t  *ent = tengine_log_find(log, key, klen);
+  struct iovec        iov[3];
+
+  if (ent && !(ent->flags & TENGINE_LOG_LIST))
+    return -1;
+
+  if (ent && (buf = tengine_log_load(ent, 0)) == NULL)
+    return -1;
+
+  iov[0].iov_base = buf;                  /* items are a length and bytes */
+  iov[0].iov_len  = ent ? ent->vlen : 0;
+  iov[1].iov_base = &ilen;
+  iov[1].iov_len  = sizeof(ilen);
+  iov[2].iov_base = val;
+  iov[2].iov_len  = vlen;
+
+  ret = tengine_log_append(log, key, klen, TENGINE_LOG_LIST, iov, 3);
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_log_setbit(tengine_log_t *log, char *key, int klen, 
+                              size_t bit, int on)
+{
+  int                 ret;
+  char               *buf;
+  size_t              len;
+  tengine_log_ent_t  *ent = tengine_log_find(log, key, klen);
+  struct iovec        iov;
+
+  if (ent && (ent->flags & TENGINE_LOG_LIST))
+    return -1;
+
+  len = ent && ent->vlen > bit / 8 ? ent->vlen : bit / 8 + 1;
+  buf = ent ? tengine_log_load(ent, len) : calloc(1, len);
+
+  if (buf == NULL)
+    return -1;
+
+  if (ent && ent->vlen < len)
+    memset(&buf[ent->vlen], 0, len - ent->vlen);
+
+  if (on)
+    buf[bit / 8] |= 0x80 >> (bit % 8);
+  else
+    buf[bit / 8] &= ~(0x80 >> (bit % 8));
+
+  iov.iov_base = buf;
+  iov.iov_len  = len;
+
+  ret = tengine_log_append(log, key, klen, 0, &iov, 1);
+
+  free(buf);
+
+  return ret;
+}
+
+/* The whole batch is appended under one lock hold and committed once */
+static int tengine_log_mput(tengine_t *eng, char *keys[], int klens[], 
+                            void *vals[], int vlens[], long voffs[], int n,
+                            char *bkeys[], int bklens[], size_t boffs[], 
+                            int bvals[], int nb)
+{
+  int            ind;
+  int            rc;
+  int            ret  = 0;
+  long           voff;
+  tengine_log_t *log  = eng->priv;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  for (ind = 0; ind < n; ind++)
+  {
+    voff = voffs ? voffs[ind] : TENGINE_PUT_SET;
+
+    if (vals[ind] == NULL)
+      rc = tengine_log_remove(log, keys[ind], klens[ind]);
+    else if (voff == TENGINE_PUT_SET)
+      rc = tengine_log_put_one(log, keys[ind], klens[ind], 
+                               vals[ind], vlens[ind]);
+    else if (voff == TENGINE_PUT_RPUSH)
+      rc = tengine_log_rpush(log, keys[ind], klens[ind], 
+                             vals[ind], vlens[ind]);
+    else
+      rc = tengine_log_patch(log, keys[ind], klens[ind], 
+                             vals[ind], vlens[ind], voff);
+
+    if (rc < 0)
+      ret = -1;
+  }
+
+  for (ind = 0; ind < nb; ind++)
+  {
+    if (tengine_log_setbit(log, bkeys[ind], bklens[ind], 
+                           boffs[ind], bvals[ind]) < 0)
+      ret = -1;
+  }
+
+  if (tengine_log_commit(log) < 0)
+    ret = -1;
+
+  pthread_rwlock_unlock(&log->lock);
+
+  return ret;
+}
+
+static int tengine_log_getrange(tengine_t *eng, char *key, int klen, 
+                                long start, void *val, int *vlen)
+{
+  int                 ret = 0;
+  int                 len = 0;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+
+  pthread_rwlock_rdlock(&log->lock);
+
+  if ((ent = tengine_log_find(log, key, klen)) && 
+      (ent->flags & TENGINE_LOG_LIST))
+    ret = -1;
+  else if (ent && start >= 0 && (size_t)start < ent->vlen)
+  {
+    len = ent->vlen - start < (size_t)*vlen ? ent->vlen - start : *vlen;
+
+    if (tengine_log_read(ent, start, val, len) < 0)
+      ret = -1;
+  }
+
+  pthread_rwlock_unlock(&log->lock);
+
+  *vlen = len;
+
+  return ret;
+}
+
+static int tengine_log_unlink(tengine_t *eng, char *keys[], int klens[], 
+                              int n)
+{
+  int            ind;
+  int            ret = 0;
+  tengine_log_t *log = eng->priv;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  for (ind = 0; ind < n; ind++)
+  {
+    if (tengine_log_remove(log, keys[ind], klens[ind]) < 0)
+      ret = -1;
+  }
+
+  if (tengine_log_commit(log) < 0)
+    ret = -1;
+
+  pthread_rwlock_unlock(&log->lock);
+
+  return ret;
+}
+
+/*
+ * Find item index of the list in buf, or the first item equal to val if
+ * val is given. Returns its offset in buf, -1 if there is none.
+ */
+static long tengine_log_item(char *buf, uint32_t len, long index, 
+                             void *val, int vlen, uint32_t *ilen)
+{
+  uint32_t off;
+  uint32_t cnt = 0;
+
+  if (index < 0 && val == NULL)                   /* count from the end */
+  {
+    for (off = 0; off + sizeof(*ilen) <= len; cnt++)
+    {
+      memcpy(ilen, &buf[off], sizeof(*ilen));
+      off += sizeof(*ilen) + *ilen;
+    }
+
+    if ((index += cnt) < 0)
+      return -1;
+  }
+
+  for (off = 0, cnt = 0; off + sizeof(*ilen) <= len; cnt++)
+  {
+    memcpy(ilen, &buf[off], sizeof(*ilen));
+
+    if (val ? (*ilen == vlen && 
+               memcmp(&buf[off + sizeof(*ilen)], val, vlen) == 0) 
+            : cnt == index)
+      return off;
+
+    off += sizeof(*ilen) + *ilen;
+  }
+
+  return -1;
+}
+
+static int tengine_log_lindex(tengine_t *eng, char *key, int klen, 
+                              long index, void *val, int *vlen)
+{
+  int                 ret = 0;
+  long                off = -1;
+  char               *buf = NULL;
+  uint32_t            ilen;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+
+  pthread_rwlock_rdlock(&log->lock);
+
+  if ((ent = tengine_log_find(log, key, klen)) && 
+      !(ent->flags & TENGINE_LOG_LIST))
+    ret = -1;
+  else if (ent && (buf = tengine_log_load(ent, 0)) == NULL)
+    ret = -1;
+  else if (ent)
+    off = tengine_log_item(buf, ent->vlen, index, NULL, 0, &ilen);
+
+  pthread_rwlock_unlock(&log->lock);
+
+  if (off < 0)
+    *vlen = -1;
+  else
+  {
+    *vlen = ilen < *vlen ? ilen : *vlen;
+    memcpy(val, &buf[off + sizeof(ilen)], *vlen);
+  }
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_log_lrem(tengine_t *eng, char *key, int klen, 
+                            void *val, int vlen)
+{
+  int                 ret = 0;
+  long                off = -1;
+  char               *buf = NULL;
+  uint32_t            ilen;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+  struct iovec        iov[2];
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  if ((ent = tengine_log_find(log, key, klen)) && 
+      !(ent->flags & TENGINE_LOG_LIST))
+    ret = -1;
+  else if (ent && (buf = tengine_log_load(ent, 0)) == NULL)
+    ret = -1;
+  else if (ent)
+    off = tengine_log_item(buf, ent->vlen, 0, val, vlen, &ilen);
+
+  if (off >= 0)
+  {
+    iov[0].iov_base = buf;
+    iov[0].iov_len  = off;
+    iov[1].iov_base = &buf[off + sizeof(ilen) + ilen];
+    iov[1].iov_len  = ent->vlen - off - sizeof(ilen) - ilen;
+
+    if (iov[0].iov_len + iov[1].iov_len == 0)  /* empty lists do not exist */
+      ret = tengine_log_remove(log, key, klen);
+    else
+      ret = tengine_log_append(log, key, klen, TENGINE_LOG_LIST, iov, 2);
+
+    if (ret == 0)
+      ret = tengine_log_commit(log);
+  }
+
+  pthread_rwlock_unlock(&log->lock);
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_log_incrby(tengine_t *eng, char *key, int klen, 
+                              long long incr, long long *val)
+{
+  int                 ret = -1;
+  long long           num = 0;
+  char                buf[32];
+  char               *ep  = buf;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  buf[0] = 0;
+
+  if ((ent = tengine_log_find(log, key, klen)) && 
+      ((ent->flags & TENGINE_LOG_LIST) || ent->vlen >= sizeof(buf) || 
+       tengine_log_read(ent, 0, buf, ent->vlen) < 0))
+    goto out;
+
+  if (ent)
+  {
+    buf[ent->vlen] = 0;
+
+    errno = 0;
+    num   = strtoll(buf, &ep, 10);
+
+    if (errno || *ep || ep == buf)                     /* not an integer */
+      goto out;
+  }
+
+  num += incr;
+
+  sprintf(buf, "%lld", num);
+
+  if ((ret = tengine_log_put_one(log, key, klen, buf, strlen(buf))) == 0 &&
+      (ret = tengine_log_commit(log)) == 0)
+    *val = num;
+
+out:
+  pthread_rwlock_unlock(&log->lock);
+
+  return ret;
+}
+
+static int tengine_log_rename(tengine_t *eng, char *key, int klen, 
+                              char *nkey, int nklen)
+{
+  int                 ret = -1;
+  char               *buf = NULL;
+  tengine_log_t      *log = eng->priv;
+  tengine_log_ent_t  *ent;
+  struct iovec        iov;
+
+  pthread_rwlock_wrlock(&log->lock);
+
+  if ((ent = tengine_log_find(log, key, klen)) == NULL ||
+      (buf = tengine_log_load(ent, 0)) == NULL)
+    goto out;
+
+  iov.iov_base = buf;
+  iov.iov_len  = ent->vlen;
+
+  if (klen == nklen && memcmp(key, nkey, klen) == 0)
+    ret = 0;
+  else if ((ret = tengine_log_append(log, nkey, nklen, ent->flags, 
+                                     &iov, 1)) == 0 &&
+           (ret = tengine_log_remove(log, key, klen)) == 0)
+    ret = tengine_log_commit(log);
+
+out:
+  pthread_rwlock_unlock(&log->lock);
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_log_scan(tengine_t *eng, char *pat, int plen, 
+                            tengine_scan_cb_t cb, void *arg)
+{
+  int                 ret = 0;
+  size_t              ind;
+  size_t              cnt = 0;
+  char              **keys;
+  char               *patz = NULL;
+  tengine_log_t      *log  = eng->priv;
+  tengine_log_ent_t  *ent;
+
+  if (pat && (patz = strndup(pat, plen)) == NULL)
+    return -1;
+
+  pthread_rwlock_rdlock(&log->lock);
+
+  if ((keys = malloc((log->count + 1) * sizeof(*keys))) == NULL)
+    ret = -1;
+
+  for (ind = 0; ret == 0 && ind < log->nbuckets; ind++)
+  {
+    for (ent = log->buckets[ind]; ent && ret == 0; ent = ent->next)
+    {
+      if (ent->flags & TENGINE_LOG_DEL)
+        continue;
+
+      if ((keys[cnt] = strndup(ent->key, ent->klen)) == NULL)
+        ret = -1;
+      else if (patz && fnmatch(patz, keys[cnt], 0) != 0)
+        free(keys[cnt]);
+      else
+        cnt++;
+    }
+  }
+
+  pthread_rwlock_unlock(&log->lock);
+
+  for (ind = 0; ind < cnt; ind++)          /* cb may use the engine */
+  {
+    if (ret == 0 && cb(keys[ind], strlen(keys[ind]), arg))
+      ret = 1;
+
+    free(keys[ind]);
+  }
+
+  free(keys);
+  free(patz);
+
+  return ret < 0 ? -1 : 0;
+}
+
+tengine_ops_t tengine_log_ops = 
+{
+  "log",
+  tengine_log_open,
+  tengine_log_close,
+  tengine_log_start,
+  tengine_log_get,
+  tengine_log_set,
+  tengine_log_del,
+  tengine_log_mget,
+  tengine_log_mput,
+  tengine_log_getrange,
+  tengine_log_unlink,
+  tengine_log_lindex,
+  tengine_log_lrem,
+  tengine_log_incrby,
+  tengine_log_rename,
+  tengine_log_scan
+};
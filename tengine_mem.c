@@ -0,0 +1,825 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+
+#include <tengine.h>
+
+/*
+ * The in-memory engine, a hash table split into locked shards. Nothing
+ * survives an unmount; it is there to run tanto without a server and to
+ * measure tanto itself without backend round trips.
+ */
+
+#define TENGINE_MEM_SHARDS   (64)
+#define TENGINE_MEM_BUCKETS  (1024)             /* initial, per shard */
+
+struct tengine_mem_item_t
+{
+  char                       *data;
+  int                         len;
+};
+typedef struct tengine_mem_item_t tengine_mem_item_t;
+
+struct tengine_mem_obj_t
+{
+  struct tengine_mem_obj_t   *next;                          /* hash chain */
+  uint32_t                    hash;
+  int                         klen;
+  char                       *key;
+  char                       *val;                       /* string value */
+  size_t                      len;
+  size_t                      cap;
+  int                         list;                   /* a list, not a string */
+  tengine_mem_item_t         *items;
+  int                         nitems;
+  int                         icap;
+};
+typedef struct tengine_mem_obj_t tengine_mem_obj_t;
+
+struct tengine_mem_shard_t
+{
+  pthread_mutex_t             lock;
+  tengine_mem_obj_t         **buckets;
+  size_t                      nbuckets;
+  size_t                      count;
+};
+typedef struct tengine_mem_shard_t tengine_mem_shard_t;
+
+struct tengine_mem_t
+{
+  tengine_mem_shard_t         shards[TENGINE_MEM_SHARDS];
+};
+typedef struct tengine_mem_t tengine_mem_t;
+
+static uint32_t tengine_mem_hash(const char *key, int klen)
+{
+  uint32_t hash = 2166136261u;                                 /* FNV-1a */
+
+  while (klen--)
+  {
+    hash ^= (unsigned char)*key++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+#define tengine_mem_shard(eng, hash) \
+        (&((tengine_mem_t *)(eng)->priv)->shards[(hash) % TENGINE_MEM_SHARDS])
+
+static tengine_mem_obj_t **tengine_mem_slot(tengine_mem_shard_t *shard, 
+                                            char *key, int klen, 
+                                            uint32_t hash)
+{
+  tengine_mem_obj_t **pobj;
+
+  pobj = &shard->buckets[(hash / TENGINE_MEM_SHARDS) & (shard->nbuckets - 1)];
+
+  for (; *pobj; pobj = &(*pobj)->next)
+  {
+    if ((*pobj)->hash == hash && (*pobj)->klen == klen && 
+        memcmp((*pobj)->key, key, klen) == 0)
+      break;
+  }
+
+  return pobj;
+}
+
+static tengine_mem_obj_t *tengine_mem_find(tengine_mem_shard_t *shard, 
+                                           char *key, int klen, 
+                                           uint32_t hash)
+{
+  return *tengine_mem_slot(shard, key, klen, hash);
+}
+
+static void tengine_mem_grow(tengine_mem_shard_t *shard)
+{
+  size_t               ind;
+  size_t               nbuckets = shard->nbuckets * 2;
+  tengine_mem_obj_t  **buckets;
+  tengine_mem_obj_t   *obj;
+  tengine_mem_obj_t   *next;
+
+  if ((buckets = calloc(nbuckets, sizeof(*buckets))) == NULL)
+    return;                                    /* keep the longer chains */
+
+  for (ind = 0; ind < shard->nbuckets; ind++)
+  {
+    for (obj = shard->buckets[ind]; obj; obj = next)
+    {
+      next = obj->next;
+
+      obj->next = buckets[(obj->hash / TENGINE_MEM_SHARDS) & (nbuckets - 1)];
+      buckets[(obj->hash / TENGINE_MEM_SHARDS) & (nbuckets - 1)] = obj;
+    }
+  }
+
+  free(shard->buckets);
+
+  shard->buckets  = buckets;
+  shard->nbuckets = nbuckets;
+}
+
+static void tengine_mem_insert(tengine_mem_shard_t *shard, 
+                               tengine_mem_obj_t *obj)
+{
+  tengine_mem_obj_t **pobj;
+
+  if (shard->count >= shard->nbuckets * 2)
+    tengine_mem_grow(shard);
+
+  pobj = &shard->buckets[(obj->hash / TENGINE_MEM_SHARDS) & 
+                         (shard->nbuckets - 1)];
+
+  obj->next = *pobj;
+  *pobj     = obj;
+
+  shard->count++;
+}
+
+static tengine_mem_obj_t *tengine_mem_create(tengine_mem_shard_t *shard, 
+                                             char *key, int klen, 
+                                             uint32_t hash, int list)
+{
+  tengine_mem_obj_t *obj;
+
+  if ((obj = calloc(1, sizeof(*obj))) == NULL)
+    return NULL;
+
+  if ((obj->key = malloc(klen)) == NULL)
+  {
+    free(obj);
+    return NULL;
+  }
+
+  memcpy(obj->key, key, klen);
+
+  obj->klen = klen;
+  obj->hash = hash;
+  obj->list = list;
+
+  tengine_mem_insert(shard, obj);
+
+  return obj;
+}
+
+static void tengine_mem_free(tengine_mem_obj_t *obj)
+{
+  int ind;
+
+  for (ind = 0; ind < obj->nitems; ind++)
+    free(obj->items[ind].data);
+
+  free(obj->items);
+  free(obj->val);
+  free(obj->key);
+  free(obj);
+}
+
+static int tengine_mem_remove(tengine_mem_shard_t *shard, 
+                              char *key, int klen, uint32_t hash)
+{
+  tengine_mem_obj_t **pobj = tengine_mem_slot(shard, key, klen, hash);
+  tengine_mem_obj_t  *obj  = *pobj;
+
+  if (obj == NULL)
+    return 0;
+
+  *pobj = obj->next;
+
+  shard->count--;
+
+  tengine_mem_free(obj);
+
+  return 1;
+}
+
+/* Make room for len bytes of string value, zero filling any gap */
+static int tengine_mem_reserve(tengine_mem_obj_t *obj, size_t len)
+{
+  char   *val;
+  size_t  cap;
+
+  if (len > obj->cap)
+  {
+    cap = obj->cap ? obj->cap : 64;
+
+    while (cap < len)
+      cap *= 2;
+
+    if ((val = realloc(obj->val, cap)) == NULL)
+      return -1;
+
+    obj->val = val;
+    obj->cap = cap;
+  }
+
+  if (len > obj->len)
+  {
+    memset(&obj->val[obj->len], 0, len - obj->len);
+    obj->len = len;
+  }
+
+  return 0;
+}
+
+/* The string at key for writing, created empty if missing */
+static tengine_mem_obj_t *tengine_mem_string(tengine_mem_shard_t *shard, 
+                                             char *key, int klen, 
+                                             uint32_t hash)
+{
+  tengine_mem_obj_t *obj = tengine_mem_find(shard, key, klen, hash);
+
+  if (obj == NULL)
+    return tengine_mem_create(shard, key, klen, hash, 0);
+
+  return obj->list ? NULL : obj;                             /* WRONGTYPE */
+}
+
+static int tengine_mem_open(tengine_t *eng, tengine_conf_t *conf)
+{
+  int             ind;
+  tengine_mem_t  *mem;
+
+  (void) conf;
+
+  if ((mem = calloc(1, sizeof(*mem))) == NULL)
+    return -1;
+
+  for (ind = 0; ind < TENGINE_MEM_SHARDS; ind++)
+  {
+    pthread_mutex_init(&mem->shards[ind].lock, NULL);
+
+    mem->shards[ind].nbuckets = TENGINE_MEM_BUCKETS;
+    mem->shards[ind].buckets  = calloc(TENGINE_MEM_BUCKETS, 
+                                       sizeof(tengine_mem_obj_t *));
+
+    if (mem->shards[ind].buckets == NULL)
+    {
+      eng->priv = mem;
+      eng->ops->close(eng);
+      return -1;
+    }
+  }
+
+  eng->priv = mem;
+
+  return 0;
+}
+
+static void tengine_mem_close(tengine_t *eng)
+{
+  int                  ind;
+  size_t               ind2;
+  tengine_mem_t       *mem = eng->priv;
+  tengine_mem_obj_t   *obj;
+  tengine_mem_obj_t   *next;
+
+  for (ind = 0; ind < TENGINE_MEM_SHARDS; ind++)
+  {
+    for (ind2 = 0; mem->shards[ind].buckets && 
+                   ind2 < mem->shards[ind].nbuckets; ind2++)
+    {
+      for (obj = mem->shards[ind].buckets[ind2]; obj; obj = next)
+      {
+        next = obj->next;
+        tengine_mem_free(obj);
+      }
+    }
+
+    free(mem->shards[ind].buckets);
+    pthread_mutex_destroy(&mem->shards[ind].lock);
+  }
+
+  free(mem);
+}
+
+static int tengine_mem_get(tengine_t *eng, char *key, int klen, 
+                           void *val, int vlen)
+{
+  int                  ret = -1;
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+  tengine_mem_obj_t   *obj;
+
+  pthread_mutex_lock(&shard->lock);
+
+  if ((obj = tengine_mem_find(shard, key, klen, hash)) && !obj->list)
+  {
+    ret = obj->len < vlen ? obj->len : vlen;
+    memcpy(val, obj->val, ret);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return ret;
+}
+
+static int tengine_mem_set_locked(tengine_mem_shard_t *shard, 
+                                  char *key, int klen, uint32_t hash,
+                                  void *val, int vlen)
+{
+  tengine_mem_obj_t *obj = tengine_mem_find(shard, key, klen, hash);
+
+  if (obj && obj->list)                     /* SET replaces a list as well */
+  {
+    tengine_mem_remove(shard, key, klen, hash);
+    obj = NULL;
+  }
+
+  if (obj == NULL && 
+      (obj = tengine_mem_create(shard, key, klen, hash, 0)) == NULL)
+    return -1;
+
+  obj->len = 0;
+
+  if (tengine_mem_reserve(obj, vlen) < 0)
+    return -1;
+
+  memcpy(obj->val, val, vlen);
+
+  return 0;
+}
+
+static int tengine_mem_set(tengine_t *eng, char *key, int klen, 
+                           void *val, int vlen)
+{
+  int                  ret;
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+
+  pthread_mutex_lock(&shard->lock);
+
+  ret = tengine_mem_set_locked(shard, key, klen, hash, val, vlen);
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return ret;
+}
+
+static int tengine_mem_del(tengine_t *eng, char *key, int klen)
+{
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+
+  pthread_mutex_lock(&shard->lock);
+
+  tengine_mem_remove(shard, key, klen, hash);
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return 0;
+}
+
+static int tengine_mem_mget(tengine_t *eng, char *keys[], int klens[], 
+                            void *vals[], int vlens[], int n)
+{
+  int ind;
+
+  for (ind = 0; ind < n; ind++)
+    vlens[ind] = tengine_mem_get(eng, keys[ind], klens[ind], 
+                                 vals[ind], vlens[ind]);
+
+  return 0;
+}
+
+static int tengine_mem_put(tengine_mem_shard_t *shard, char *key, int klen,
+                           uint32_t hash, void *val, int vlen, long voff)
+{
+  tengine_mem_obj_t   *obj;
+  tengine_mem_item_t  *items;
+  int                  icap;
+  size_t               off;
+
+  if (val == NULL)
+  {
+    tengine_mem_remove(shard, key, klen, hash);
+    return 0;
+  }
+
+  if (voff == TENGINE_PUT_SET)
+    return tengine_mem_set_locked(shard, key, klen, hash, val, vlen);
+
+  if (voff == TENGINE_PUT_RPUSH)
+  {
+    obj = tengine_mem_find(shard, key, klen, hash);
+
+    if (obj == NULL)
+      obj = tengine_mem_create(shard, key, klen, hash, 1);
+
+    if (obj == NULL || !obj->list)
+      return -1;
+
+    if (obj->nitems == obj->icap)
+    {
+      icap = obj->icap ? obj->icap * 2 : 16;
+
+      if ((items = realloc(obj->items, icap * sizeof(*items))) == NULL)
+        return -1;
+
+      obj->items = items;
+      obj->icap  = icap;
+    }
+
+    if ((obj->items[obj->nitems].data = malloc(vlen ? vlen : 1)) == NULL)
+      return -1;
+
+    memcpy(obj->items[obj->nitems].data, val, vlen);
+    obj->items[obj->nitems++].len = vlen;
+
+    return 0;
+  }
+
+  if ((obj = tengine_mem_string(shard, key, klen, hash)) == NULL)
+    return -1;
+
+  off = voff == TENGINE_PUT_APPEND ? obj->len : (size_t)voff;
+
+  if (vlen && tengine_mem_reserve(obj, off + vlen) < 0)
+    return -1;
+
+  memcpy(&obj->val[off], val, vlen);
+
+  return 0;
+}
+
+static int tengine_mem_setbit(tengine_mem_shard_t *shard, char *key, 
+                              int klen, uint32_t hash, size_t bit, int on)
+{
+  tengine_mem_obj_t *obj;
+
+  if ((obj = tengine_mem_string(shard, key, klen, hash)) == NULL ||
+      tengine_mem_reserve(obj, bit / 8 + 1) < 0)
+    return -1;
+
+  if (on)
+    obj->val[bit / 8] |= 0x80 >> (bit % 8);
+  else
+    obj->val[bit / 8] &= ~(0x80 >> (bit % 8));
+
+  return 0;
+}
+
+static int tengine_mem_mput(tengine_t *eng, char *keys[], int klens[], 
+                            void *vals[], int vlens[], long voffs[], int n,
+                            char *bkeys[], int bklens[], size_t boffs[], 
+                            int bvals[], int nb)
+{
+  int                  ind;
+  int                  ret = 0;
+  uint32_t             hash;
+  tengine_mem_shard_t *shard;
+
+  for (ind = 0; ind < n; ind++)
+  {
+    hash  = tengine_mem_hash(keys[ind], klens[ind]);
+    shard = tengine_mem_shard(eng, hash);
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (tengine_mem_put(shard, keys[ind], klens[ind], hash, vals[ind], 
+                        vlens[ind], voffs ? voffs[ind] : TENGINE_PUT_SET) < 0)
+      ret = -1;
+
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  for (ind = 0; ind < nb; ind++)
+  {
+    hash  = tengine_mem_hash(bkeys[ind], bklens[ind]);
+    shard = tengine_mem_shard(eng, hash);
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (tengine_mem_setbit(shard, bkeys[ind], bklens[ind], hash, 
+                           boffs[ind], bvals[ind]) < 0)
+      ret = -1;
+
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  return ret;
+}
+
+static int tengine_mem_getrange(tengine_t *eng, char *key, int klen, 
+                                long start, void *val, int *vlen)
+{
+  int                  ret   = 0;
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+  tengine_mem_obj_t   *obj;
+  size_t               len   = 0;
+
+  pthread_mutex_lock(&shard->lock);
+
+  if ((obj = tengine_mem_find(shard, key, klen, hash)) && obj->list)
+    ret = -1;
+  else if (obj && start >= 0 && (size_t)start < obj->len)
+  {
+    len = obj->len - start < (size_t)*vlen ? obj->len - start : *vlen;
+    memcpy(val, &obj->val[start], len);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  *vlen = len;
+
+  return ret;
+}
+
+static int tengine_mem_unlink(tengine_t *eng, char *keys[], int klens[], 
+                              int n)
+{
+  int ind;
+
+  for (ind = 0; ind < n; ind++)
+    tengine_mem_del(eng, keys[ind], klens[ind]);
+
+  return 0;
+}
+
+static int tengine_mem_lindex(tengine_t *eng, char *key, int klen, 
+                              long index, void *val, int *vlen)
+{
+  int                  ret   = 0;
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+  tengine_mem_obj_t   *obj;
+  tengine_mem_item_t  *item;
+
+  pthread_mutex_lock(&shard->lock);
+
+  obj = tengine_mem_find(shard, key, klen, hash);
+
+  if (obj && !obj->list)
+    ret = -1;
+  else if (obj && index < 0)
+    index += obj->nitems;
+
+  if (obj == NULL || ret < 0 || index < 0 || index >= obj->nitems)
+    *vlen = -1;
+  else
+  {
+    item  = &obj->items[index];
+    *vlen = item->len < *vlen ? item->len : *vlen;
+    memcpy(val, item->data, *vlen);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return ret;
+}
+
+static int tengine_mem_lrem(tengine_t *eng, char *key, int klen, 
+                            void *val, int vlen)
+{
+  int                  ind;
+  int                  ret   = 0;
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+  tengine_mem_obj_t   *obj;
+
+  pthread_mutex_lock(&shard->lock);
+
+  if ((obj = tengine_mem_find(shard, key, klen, hash)) && !obj->list)
+    ret = -1;
+
+  for (ind = 0; obj && ret == 0 && ind < obj->nitems; ind++)
+  {
+    if (obj->items[ind].len != vlen || 
+        memcmp(obj->items[ind].data, val, vlen) != 0)
+      continue;
+
+    free(obj->items[ind].data);
+
+    memmove(&obj->items[ind], &obj->items[ind + 1], 
+            (obj->nitems - ind - 1) * sizeof(obj->items[0]));
+
+    if (--obj->nitems == 0)                 /* empty lists do not exist */
+      tengine_mem_remove(shard, key, klen, hash);
+
+    break;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return ret;
+}
+
+static int tengine_mem_incrby(tengine_t *eng, char *key, int klen, 
+                              long long incr, long long *val)
+{
+  int                  ret   = -1;
+  uint32_t             hash  = tengine_mem_hash(key, klen);
+  tengine_mem_shard_t *shard = tengine_mem_shard(eng, hash);
+  tengine_mem_obj_t   *obj;
+  long long            num   = 0;
+  char                 buf[32];
+  char                *ep;
+
+  pthread_mutex_lock(&shard->lock);
+
+  if ((obj = tengine_mem_string(shard, key, klen, hash)) && 
+      obj->len < sizeof(buf))
+  {
+    memcpy(buf, obj->val, obj->len);
+    buf[obj->len] = 0;
+
+    errno = 0;
+
+    if (obj->len)
+      num = strtoll(buf, &ep, 10);
+
+    if (obj->len == 0 || (errno == 0 && *ep == 0))     /* not an integer */
+    {
+      num += incr;
+
+      sprintf(buf, "%lld", num);
+
+      obj->len = 0;
+
+      if (tengine_mem_reserve(obj, strlen(buf)) == 0)
+      {
+        memcpy(obj->val, buf, strlen(buf));
+
+        *val = num;
+        ret  = 0;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return ret;
+}
+
+static int tengine_mem_rename(tengine_t *eng, char *key, int klen, 
+                              char *nkey, int nklen)
+{
+  int                   ret = -1;
+  uint32_t              hash   = tengine_mem_hash(key, klen);
+  uint32_t              nhash  = tengine_mem_hash(nkey, nklen);
+  tengine_mem_shard_t  *shard  = tengine_mem_shard(eng, hash);
+  tengine_mem_shard_t  *nshard = tengine_mem_shard(eng, nhash);
+  tengine_mem_obj_t   **pobj;
+  tengine_mem_obj_t    *obj;
+  char                 *nbuf;
+
+  if (shard < nshard)                                /* fixed lock order */
+  {
+    pthread_mutex_lock(&shard->lock);
+    pthread_mutex_lock(&nshard->lock);
+  }
+  else
+  {
+    pthread_mutex_lock(&nshard->lock);
+
+    if (shard != nshard)
+      pthread_mutex_lock(&shard->lock);
+  }
+
+  pobj = tengine_mem_slot(shard, key, klen, hash);
+
+  if ((obj = *pobj) != NULL && (nbuf = malloc(nklen)) != NULL)
+  {
+    *pobj = obj->next;                            /* take it out of shard */
+    shard->count--;
+
+    tengine_mem_remove(nshard, nkey, nklen, nhash);
+
+    memcpy(nbuf, nkey, nklen);
+    free(obj->key);
+
+    obj->key  = nbuf;
+    obj->klen = nklen;
+    obj->hash = nhash;
+
+    tengine_mem_insert(nshard, obj);
+
+    ret = 0;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  if (shard != nshard)
+    pthread_mutex_unlock(&nshard->lock);
+
+  return ret;
+}
+
+/*
+ * Keys are collected a shard at a time and handed to cb without the lock
+ * held, so cb may use the engine.
+ */
+static int tengine_mem_scan(tengine_t *eng, char *pat, int plen, 
+                            tengine_scan_cb_t cb, void *arg)
+{
+  int                  ind;
+  int                  stop = 0;
+  size_t               ind2;
+  size_t               cnt;
+  size_t               cap  = 0;
+  char               **keys = NULL;
+  char               **nkeys;
+  char                *patz = NULL;
+  tengine_mem_t       *mem  = eng->priv;
+  tengine_mem_shard_t *shard;
+  tengine_mem_obj_t   *obj;
+
+  if (pat && (patz = strndup(pat, plen)) == NULL)
+    return -1;
+
+  for (ind = 0; ind < TENGINE_MEM_SHARDS && !stop; ind++)
+  {
+    shard = &mem->shards[ind];
+    cnt   = 0;
+
+    pthread_mutex_lock(&shard->lock);
+
+    for (ind2 = 0; ind2 < shard->nbuckets && stop == 0; ind2++)
+    {
+      for (obj = shard->buckets[ind2]; obj && stop == 0; obj = obj->next)
+      {
+        if (cnt == cap)
+        {
+          cap = cap ? cap * 2 : 1024;
+
+          if ((nkeys = realloc(keys, cap * sizeof(*keys))) == NULL)
+          {
+            stop = -1;
+            continue;
+          }
+
+          keys = nkeys;
+        }
+
+        if ((keys[cnt] = strndup(obj->key, obj->klen)) == NULL)
+        {
+          stop = -1;
+          continue;
+        }
+
+        if (patz && fnmatch(patz, keys[cnt], 0) != 0)
+          free(keys[cnt]);
+        else
+          cnt++;
+      }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    for (ind2 = 0; ind2 < cnt; ind2++)
+    {
+      if (stop == 0 && cb(keys[ind2], strlen(keys[ind2]), arg))
+        stop = 1;
+
+      free(keys[ind2]);
+    }
+  }
+
+  free(keys);
+  free(patz);
+
+  return stop < 0 ? -1 : 0;
+}
+
+tengine_ops_t tengine_mem_ops = 
+{
+  "mem",
+  tengine_mem_open,
+  tengine_mem_close,
+  NULL,
+  tengine_mem_get,
+  tengine_mem_set,
+  tengine_mem_del,
+  tengine_mem_mget,
+  tengine_mem_mput,
+  tengine_mem_getrange,
+  tengine_mem_unlink,
+  tengine_mem_lindex,
+  tengine_mem_lrem,
+  tengine_mem_incrby,
+  tengine_mem_rename,
+  tengine_mem_scan
+};
@@ -0,0 +1,178 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <redislib.h>
+#include <tengine.h>
+
+/*
+ * The redis engine, a connection pool with one context per worker thread.
+ */
+
+#if TENGINE_PUT_SET != REDIS_PUT_SET || \
+    TENGINE_PUT_APPEND != REDIS_PUT_APPEND || \
+    TENGINE_PUT_RPUSH != REDIS_PUT_RPUSH
+#error "tengine_mput voffs are passed to redis_mput as they are"
+#endif
+
+#define tengine_redis_ctx(eng) redis_pool_get((redis_pool_t *)(eng)->priv)
+
+static int tengine_redis_open(tengine_t *eng, tengine_conf_t *conf)
+{
+  redis_pool_t *pool;
+
+  if ((pool = calloc(1, sizeof(*pool))) == NULL)
+    return -1;
+
+  redis_tune.nodelay   = conf->nodelay;
+  redis_tune.keepalive = conf->keepalive;
+  redis_tune.sndbuf    = conf->sndbuf;
+  redis_tune.rcvbuf    = conf->rcvbuf;
+
+  if (redis_pool_init(pool, conf->host, conf->port, conf->pool_size) < 0)
+  {
+    free(pool);
+    return -1;
+  }
+
+  eng->priv = pool;
+
+  return 0;
+}
+
+static void tengine_redis_close(tengine_t *eng)
+{
+  redis_pool_close((redis_pool_t *)eng->priv);
+
+  free(eng->priv);
+}
+
+static int tengine_redis_get(tengine_t *eng, char *key, int klen, 
+                             void *val, int vlen)
+{
+  return redis_get(tengine_redis_ctx(eng), key, klen, val, vlen);
+}
+
+static int tengine_redis_set(tengine_t *eng, char *key, int klen, 
+                             void *val, int vlen)
+{
+  return redis_set(tengine_redis_ctx(eng), key, klen, val, vlen);
+}
+
+static int tengine_redis_del(tengine_t *eng, char *key, int klen)
+{
+  return redis_del(tengine_redis_ctx(eng), key, klen);
+}
+
+static int tengine_redis_mget(tengine_t *eng, char *keys[], int klens[], 
+                              void *vals[], int vlens[], int n)
+{
+  return redis_mget(tengine_redis_ctx(eng), keys, klens, vals, vlens, n);
+}
+
+static int tengine_redis_mput(tengine_t *eng, char *keys[], int klens[], 
+                              void *vals[], int vlens[], long voffs[], int n,
+                              char *bkeys[], int bklens[], size_t boffs[], 
+                              int bvals[], int nb)
+{
+  return redis_mput(tengine_redis_ctx(eng), keys, klens, vals, vlens, voffs,
+                    n, bkeys, bklens, boffs, bvals, nb);
+}
+
+static int tengine_redis_getrange(tengine_t *eng, char *key, int klen, 
+                                  long start, void *val, int *vlen)
+{
+  return redis_getrange(tengine_redis_ctx(eng), key, klen, start, val, vlen);
+}
+
+static int tengine_redis_unlink(tengine_t *eng, char *keys[], int klens[], 
+                                int n)
+{
+  return redis_unlink(tengine_redis_ctx(eng), keys, klens, n);
+}
+
+static int tengine_redis_lindex(tengine_t *eng, char *key, int klen, 
+                                long index, void *val, int *vlen)
+{
+  return redis_lindex(tengine_redis_ctx(eng), key, klen, index, val, vlen);
+}
+
+static int tengine_redis_lrem(tengine_t *eng, char *key, int klen, 
+                              void *val, int vlen)
+{
+  return redis_lrem(tengine_redis_ctx(eng), key, klen, val, vlen);
+}
+
+static int tengine_redis_incrby(tengine_t *eng, char *key, int klen, 
+                                long long incr, long long *val)
+{
+  return redis_incrby(tengine_redis_ctx(eng), key, klen, incr, val);
+}
+
+static int tengine_redis_rename(tengine_t *eng, char *key, int klen, 
+                                char *nkey, int nklen)
+{
+  return redis_rename(tengine_redis_ctx(eng), key, klen, nkey, nklen);
+}
+
+static int tengine_redis_scan(tengine_t *eng, char *pat, int plen, 
+                              tengine_scan_cb_t cb, void *arg)
+{
+  int           rc;
+  int           len;
+  char         *key;
+  redis_scan_t  scan;
+  redis_ctx_t  *ctx = tengine_redis_ctx(eng);
+
+  redis_scan_init(&scan, REDIS_SCAN, NULL, 0, pat, plen, 0);
+
+  while ((rc = redis_scan_next(ctx, &scan, &key, &len)) > 0)
+  {
+    if (cb(key, len, arg))
+    {
+      rc = 0;
+      break;
+    }
+  }
+
+  redis_scan_free(&scan);
+
+  return rc;
+}
+
+tengine_ops_t tengine_redis_ops = 
+{
+  "redis",
+  tengine_redis_open,
+  tengine_redis_close,
+  NULL,
+  tengine_redis_get,
+  tengine_redis_set,
+  tengine_redis_del,
+  tengine_redis_mget,
+  tengine_redis_mput,
+  tengine_redis_getrange,
+  tengine_redis_unlink,
+  tengine_redis_lindex,
+  tengine_redis_lrem,
+  tengine_redis_incrby,
+  tengine_redis_rename,
+  tengine_redis_scan
+};
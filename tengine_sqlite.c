@@ -0,0 +1,914 @@
+/*
+ *  Tanto - Object based file system
+ *  Copyright (C) 2017  Tanto 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include <ytrace.h>
+#include <tengine.h>
+
+/*
+ * The sqlite engine keeps the whole filesystem in one database file.
+ * Strings live in table kv, list items in table list, one row per item.
+ * Each thread is bound to one of pool_size handles, every handle with its
+ * own connection and prepared statements. The database runs in WAL mode
+ * so readers never wait for the writer; writers take the engine's write
+ * lock and every call that changes something, an mput batch included, is
+ * one IMMEDIATE transaction. sync_ms 0 syncs the WAL at every commit, any
+ * other value only at checkpoints (synchronous NORMAL), which keeps the
+ * database consistent but may lose the last commits on power loss.
+ */
+
+#define TENGINE_SQLITE_BUSY_MS     (5000)     /* other processes on the file */
+#define TENGINE_SQLITE_SCAN_COUNT  (512)                  /* keys per query */
+#define TENGINE_SQLITE_KEY_MAX     (4096)
+
+static const char *tengine_sqlite_schema =
+  "PRAGMA journal_mode = WAL;"
+  "CREATE TABLE IF NOT EXISTS kv (k BLOB PRIMARY KEY, v BLOB NOT NULL) "
+  "WITHOUT ROWID;"
+  "CREATE TABLE IF NOT EXISTS list (k BLOB, seq INTEGER, v BLOB NOT NULL, "
+  "PRIMARY KEY (k, seq)) WITHOUT ROWID;";
+
+enum
+{
+  TENGINE_SQLITE_GET,
+  TENGINE_SQLITE_PUT,
+  TENGINE_SQLITE_DEL,
+  TENGINE_SQLITE_LDEL,
+  TENGINE_SQLITE_RANGE,
+  TENGINE_SQLITE_RPUSH,
+  TENGINE_SQLITE_LINDEX,
+  TENGINE_SQLITE_RINDEX,
+  TENGINE_SQLITE_LREM,
+  TENGINE_SQLITE_EXISTS,
+  TENGINE_SQLITE_RENAME,
+  TENGINE_SQLITE_LRENAME,
+  TENGINE_SQLITE_SCAN,
+  TENGINE_SQLITE_BEGIN,
+  TENGINE_SQLITE_COMMIT,
+  TENGINE_SQLITE_ROLLBACK,
+  TENGINE_SQLITE_NSTMT
+};
+
+static const char *tengine_sqlite_sql[TENGINE_SQLITE_NSTMT] =
+{
+  "SELECT v FROM kv WHERE k = ?1", 
+  "INSERT OR REPLACE INTO kv (k, v) VALUES (?1, ?2)", 
+  "DELETE FROM kv WHERE k = ?1", 
+  "DELETE FROM list WHERE k = ?1", 
+  "SELECT substr(v, ?2, ?3), length(v) FROM kv WHERE k = ?1", 
+  "INSERT INTO list (k, seq, v) "
+  "SELECT ?1, coalesce(max(seq) + 1, 0), ?2 FROM list WHERE k = ?1", 
+  "SELECT v FROM list WHERE k = ?1 ORDER BY seq LIMIT 1 OFFSET ?2", 
+  "SELECT v FROM list WHERE k = ?1 ORDER BY seq DESC LIMIT 1 OFFSET ?2", 
+  "DELETE FROM list WHERE k = ?1 AND seq = "
+  "(SELECT seq FROM list WHERE k = ?1 AND v = ?2 ORDER BY seq LIMIT 1)", 
+  "SELECT 1 FROM kv WHERE k = ?1 UNION ALL "
+  "SELECT 1 FROM list WHERE k = ?1 LIMIT 1", 
+  "UPDATE kv SET k = ?2 WHERE k = ?1", 
+  "UPDATE list SET k = ?2 WHERE k = ?1", 
+  "SELECT k FROM kv WHERE k >= ?1 UNION "
+  "SELECT k FROM list WHERE k >= ?1 ORDER BY 1 LIMIT ?2", 
+  "BEGIN IMMEDIATE", 
+  "COMMIT", 
+  "ROLLBACK"
+};
+
+struct tengine_sqlite_db_t
+{
+  pthread_mutex_t             lock;          /* threads sharing the handle */
+  sqlite3                    *db;
+  sqlite3_stmt               *stmt[TENGINE_SQLITE_NSTMT];
+};
+typedef struct tengine_sqlite_db_t tengine_sqlite_db_t;
+
+struct tengine_sqlite_t
+{
+  pthread_mutex_t             wlock;                 /* one writer at a time */
+  int                         gen;                 /* binds threads, below */
+  int                         size;
+  int                         next;
+  tengine_sqlite_db_t        *dbs;
+};
+typedef struct tengine_sqlite_t tengine_sqlite_t;
+
+static int                           tengine_sqlite_gen;
+static __thread int                  tengine_sqlite_tgen;
+static __thread tengine_sqlite_db_t *tengine_sqlite_tdb;
+
+/*
+ * Lock the handle of the calling thread, bound round robin on first use.
+ * The binding is by open generation, a reopened engine may get the same 
+ * address.
+ */
+static tengine_sqlite_db_t *tengine_sqlite_enter(tengine_t *eng)
+{
+  tengine_sqlite_t *sq = eng->priv;
+
+  if (tengine_sqlite_tgen != sq->gen)
+  {
+    tengine_sqlite_tdb  = &sq->dbs[__sync_fetch_and_add(&sq->next, 1) % 
+                                   sq->size];
+    tengine_sqlite_tgen = sq->gen;
+  }
+
+  pthread_mutex_lock(&tengine_sqlite_tdb->lock);
+
+  return tengine_sqlite_tdb;
+}
+
+#define tengine_sqlite_leave(db) pthread_mutex_unlock(&(db)->lock)
+
+/* sqlite binds a NULL pointer as NULL, empty values are "" */
+static void tengine_sqlite_bind(sqlite3_stmt *stmt, int col, 
+                                const void *val, int len)
+{
+  sqlite3_bind_blob(stmt, col, len ? val : "", len, SQLITE_STATIC);
+}
+
+static sqlite3_stmt *tengine_sqlite_stmt(tengine_sqlite_db_t *db, int id, 
+                                         char *key, int klen)
+{
+  sqlite3_stmt *stmt = db->stmt[id];
+
+  if (key)
+    tengine_sqlite_bind(stmt, 1, key, klen);
+
+  return stmt;
+}
+
+static void tengine_sqlite_done(sqlite3_stmt *stmt)
+{
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+}
+
+/* Step stmt to the end, for the statements that return no rows */
+static int tengine_sqlite_exec(tengine_sqlite_db_t *db, sqlite3_stmt *stmt)
+{
+  int rc = sqlite3_step(stmt);
+
+  tengine_sqlite_done(stmt);
+
+  if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+  {
+    ytrace_msg(YTRACE_ERROR, "sqlite %s : %s\n", sqlite3_sql(stmt), 
+               sqlite3_errmsg(db->db));
+    return -1;
+  }
+
+  return 0;
+}
+
+/* 1 if stmt returned a row, 0 if none, -1 on error */
+static int tengine_sqlite_row(tengine_sqlite_db_t *db, sqlite3_stmt *stmt)
+{
+  int rc = sqlite3_step(stmt);
+
+  if (rc == SQLITE_ROW)
+    return 1;
+
+  if (rc == SQLITE_DONE)
+    return 0;
+
+  ytrace_msg(YTRACE_ERROR, "sqlite %s : %s\n", sqlite3_sql(stmt), 
+             sqlite3_errmsg(db->db));
+
+  return -1;
+}
+
+/* Copy up to vlen bytes of column col, returns the length copied */
+static int tengine_sqlite_copy(sqlite3_stmt *stmt, int col, 
+                               void *val, int vlen)
+{
+  int len = sqlite3_column_bytes(stmt, col);
+
+  if (len > vlen)
+    len = vlen;
+
+  if (len > 0)
+    memcpy(val, sqlite3_column_blob(stmt, col), len);
+
+  return len;
+}
+
+static int tengine_sqlite_begin(tengine_t *eng, tengine_sqlite_db_t *db)
+{
+  tengine_sqlite_t *sq = eng->priv;
+
+  pthread_mutex_lock(&sq->wlock);
+
+  if (tengine_sqlite_exec(db, db->stmt[TENGINE_SQLITE_BEGIN]) < 0)
+  {
+    pthread_mutex_unlock(&sq->wlock);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Commit if ret is 0, else roll everything since begin back */
+static int tengine_sqlite_end(tengine_t *eng, tengine_sqlite_db_t *db, 
+                              int ret)
+{
+  tengine_sqlite_t *sq = eng->priv;
+
+  if (ret == 0)
+    ret = tengine_sqlite_exec(db, db->stmt[TENGINE_SQLITE_COMMIT]);
+
+  if (ret < 0 && sqlite3_get_autocommit(db->db) == 0)
+    tengine_sqlite_exec(db, db->stmt[TENGINE_SQLITE_ROLLBACK]);
+
+  pthread_mutex_unlock(&sq->wlock);
+
+  return ret;
+}
+
+static void tengine_sqlite_close_db(tengine_sqlite_db_t *db)
+{
+  int ind;
+
+  for (ind = 0; ind < TENGINE_SQLITE_NSTMT; ind++)
+    sqlite3_finalize(db->stmt[ind]);
+
+  sqlite3_close(db->db);
+
+  pthread_mutex_destroy(&db->lock);
+}
+
+static int tengine_sqlite_open_db(tengine_sqlite_db_t *db, 
+                                  tengine_conf_t *conf)
+{
+  int   ind;
+  char *err = NULL;
+
+  pthread_mutex_init(&db->lock, NULL);
+
+  if (sqlite3_open_v2(conf->path, &db->db, SQLITE_OPEN_READWRITE |
+                      SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, 
+                      NULL) != SQLITE_OK)
+  {
+    ytrace_msg(YTRACE_ERROR, "sqlite open %s : %s\n", conf->path, 
+               db->db ? sqlite3_errmsg(db->db) : "no memory");
+    return -1;
+  }
+
+  sqlite3_busy_timeout(db->db, TENGINE_SQLITE_BUSY_MS);
+
+  if (sqlite3_exec(db->db, tengine_sqlite_schema, NULL, NULL, &err) !=
+      SQLITE_OK ||
+      sqlite3_exec(db->db, conf->sync_ms ? "PRAGMA synchronous = NORMAL" :
+                   "PRAGMA synchronous = FULL", NULL, NULL, &err) !=
+      SQLITE_OK)
+  {
+    ytrace_msg(YTRACE_ERROR, "sqlite %s : %s\n", conf->path, err);
+    sqlite3_free(err);
+    return -1;
+  }
+
+  for (ind = 0; ind < TENGINE_SQLITE_NSTMT; ind++)
+  {
+    if (sqlite3_prepare_v3(db->db, tengine_sqlite_sql[ind], -1, 
+                           SQLITE_PREPARE_PERSISTENT, &db->stmt[ind], 
+                           NULL) != SQLITE_OK)
+    {
+      ytrace_msg(YTRACE_ERROR, "sqlite prepare %s : %s\n", 
+                 tengine_sqlite_sql[ind], sqlite3_errmsg(db->db));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void tengine_sqlite_close(tengine_t *eng)
+{
+  int               ind;
+  tengine_sqlite_t *sq = eng->priv;
+
+  for (ind = 0; ind < sq->size; ind++)
+    tengine_sqlite_close_db(&sq->dbs[ind]);
+
+  pthread_mutex_destroy(&sq->wlock);
+
+  free(sq->dbs);
+  free(sq);
+}
+
+static int tengine_sqlite_open(tengine_t *eng, tengine_conf_t *conf)
+{
+  int               ind;
+  tengine_sqlite_t *sq;
+
+  if (conf->path == NULL)
+  {
+    ytrace_msg(YTRACE_ERROR, "the sqlite engine needs a path\n");
+    return -1;
+  }
+
+  if ((sq = calloc(1, sizeof(*sq))) == NULL)
+    return -1;
+
+  sq->size = conf->pool_size > 0 ? conf->pool_size : 1;
+
+  if ((sq->dbs = calloc(sq->size, sizeof(*sq->dbs))) == NULL)
+  {
+    free(sq);
+    return -1;
+  }
+
+  pthread_mutex_init(&sq->wlock, NULL);
+
+  sq->gen   = __sync_add_and_fetch(&tengine_sqlite_gen, 1);
+  eng->priv = sq;
+
+  for (ind = 0; ind < sq->size; ind++)
+  {
+    if (tengine_sqlite_open_db(&sq->dbs[ind], conf) < 0)
+    {
+      sq->size = ind + 1;
+      tengine_sqlite_close(eng);
+      eng->priv = NULL;
+      return -1;
+    }
+  }
+
+  ytrace_msg(YTRACE_LEVEL1, "sqlite engine %s : %d handles\n", conf->path, 
+             sq->size);
+
+  return 0;
+}
+
+static int tengine_sqlite_get(tengine_t *eng, char *key, int klen, 
+                              void *val, int vlen)
+{
+  int                  ret;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+  sqlite3_stmt        *stmt;
+
+  stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_GET, key, klen);
+
+  if ((ret = tengine_sqlite_row(db, stmt)) > 0)
+    ret = tengine_sqlite_copy(stmt, 0, val, vlen);
+  else
+    ret = -1;
+
+  tengine_sqlite_done(stmt);
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+static int tengine_sqlite_put(tengine_sqlite_db_t *db, char *key, int klen, 
+                              void *val, int vlen)
+{
+  sqlite3_stmt *stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_PUT, key, klen);
+
+  tengine_sqlite_bind(stmt, 2, val, vlen);
+
+  return tengine_sqlite_exec(db, stmt);
+}
+
+/* Drop key, whichever table it is in */
+static int tengine_sqlite_remove(tengine_sqlite_db_t *db, char *key, 
+                                 int klen)
+{
+  if (tengine_sqlite_exec(db, tengine_sqlite_stmt(db, TENGINE_SQLITE_DEL, 
+                                                  key, klen)) < 0 ||
+      tengine_sqlite_exec(db, tengine_sqlite_stmt(db, TENGINE_SQLITE_LDEL, 
+                                                  key, klen)) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int tengine_sqlite_set(tengine_t *eng, char *key, int klen, 
+                              void *val, int vlen)
+{
+  int                  ret;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) == 0)
+  {
+    ret = tengine_sqlite_put(db, key, klen, val, vlen);
+    ret = tengine_sqlite_end(eng, db, ret);
+  }
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+static int tengine_sqlite_del(tengine_t *eng, char *key, int klen)
+{
+  int                  ret;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) == 0)
+  {
+    ret = tengine_sqlite_remove(db, key, klen);
+    ret = tengine_sqlite_end(eng, db, ret);
+  }
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+static int tengine_sqlite_mget(tengine_t *eng, char *keys[], int klens[], 
+                               void *vals[], int vlens[], int n)
+{
+  int                  ind;
+  int                  rc;
+  int                  ret = 0;
+  tengine_sqlite_db_t *db  = tengine_sqlite_enter(eng);
+  sqlite3_stmt        *stmt;
+
+  for (ind = 0; ind < n; ind++)
+  {
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_GET, keys[ind], 
+                               klens[ind]);
+
+    if ((rc = tengine_sqlite_row(db, stmt)) > 0)
+      vlens[ind] = tengine_sqlite_copy(stmt, 0, vals[ind], vlens[ind]);
+    else
+      vlens[ind] = -1;
+
+    if (rc < 0)
+      ret = -1;
+
+    tengine_sqlite_done(stmt);
+  }
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+/*
+ * Read the string at key into a buffer of at least cap bytes, zero filled
+ * past the value. *len is 0 if there is no key.
+ */
+static char *tengine_sqlite_load(tengine_sqlite_db_t *db, char *key, 
+                                 int klen, size_t cap, size_t *len)
+{
+  int           rc;
+  char         *buf = NULL;
+  sqlite3_stmt *stmt;
+
+  stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_GET, key, klen);
+
+  *len = 0;
+
+  if ((rc = tengine_sqlite_row(db, stmt)) > 0)
+    *len = sqlite3_column_bytes(stmt, 0);
+
+  if (rc >= 0 && (buf = calloc(1, *len > cap ? *len : cap ? cap : 1)))
+    memcpy(buf, sqlite3_column_blob(stmt, 0), *len);
+
+  tengine_sqlite_done(stmt);
+
+  return buf;
+}
+
+/* SETRANGE or APPEND val to the string at key */
+static int tengine_sqlite_patch(tengine_sqlite_db_t *db, char *key, int klen, 
+                                void *val, int vlen, long voff)
+{
+  int     ret;
+  char   *buf;
+  char   *nbuf;
+  size_t  len;
+  size_t  off = voff;
+
+  if (voff >= 0 && vlen == 0)                    /* SETRANGE of nothing */
+    return 0;
+
+  if ((buf = tengine_sqlite_load(db, key, klen, 
+                                 voff >= 0 ? off + vlen : 0, &len)) == NULL)
+    return -1;
+
+  if (voff == TENGINE_PUT_APPEND)
+  {
+    off = len;
+
+    if ((nbuf = realloc(buf, len + vlen + 1)) == NULL)
+    {
+      free(buf);
+      return -1;
+    }
+
+    buf = nbuf;
+  }
+
+  memcpy(&buf[off], val, vlen);
+
+  ret = tengine_sqlite_put(db, key, klen, buf, 
+                           off + vlen > len ? off + vlen : len);
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_sqlite_setbit(tengine_sqlite_db_t *db, char *key, 
+                                 int klen, size_t bit, int on)
+{
+  int     ret;
+  char   *buf;
+  size_t  len;
+
+  if ((buf = tengine_sqlite_load(db, key, klen, bit / 8 + 1, &len)) == NULL)
+    return -1;
+
+  if (on)
+    buf[bit / 8] |= 0x80 >> (bit % 8);
+  else
+    buf[bit / 8] &= ~(0x80 >> (bit % 8));
+
+  ret = tengine_sqlite_put(db, key, klen, buf, 
+                           len > bit / 8 ? len : bit / 8 + 1);
+
+  free(buf);
+
+  return ret;
+}
+
+static int tengine_sqlite_rpush(tengine_sqlite_db_t *db, char *key, int klen, 
+                                void *val, int vlen)
+{
+  sqlite3_stmt *stmt;
+
+  stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_RPUSH, key, klen);
+
+  tengine_sqlite_bind(stmt, 2, val, vlen);
+
+  return tengine_sqlite_exec(db, stmt);
+}
+
+/* The whole batch is one transaction, nothing of it stays if a part fails */
+static int tengine_sqlite_mput(tengine_t *eng, char *keys[], int klens[], 
+                               void *vals[], int vlens[], long voffs[], 
+                               int n, char *bkeys[], int bklens[], 
+                               size_t boffs[], int bvals[], int nb)
+{
+  int                  ind;
+  int                  ret;
+  long                 voff;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) < 0)
+  {
+    tengine_sqlite_leave(db);
+    return -1;
+  }
+
+  for (ind = 0; ret == 0 && ind < n; ind++)
+  {
+    voff = voffs ? voffs[ind] : TENGINE_PUT_SET;
+
+    if (vals[ind] == NULL)
+      ret = tengine_sqlite_remove(db, keys[ind], klens[ind]);
+    else if (voff == TENGINE_PUT_SET)
+      ret = tengine_sqlite_put(db, keys[ind], klens[ind], 
+                               vals[ind], vlens[ind]);
+    else if (voff == TENGINE_PUT_RPUSH)
+      ret = tengine_sqlite_rpush(db, keys[ind], klens[ind], 
+                                 vals[ind], vlens[ind]);
+    else
+      ret = tengine_sqlite_patch(db, keys[ind], klens[ind], 
+                                 vals[ind], vlens[ind], voff);
+  }
+
+  for (ind = 0; ret == 0 && ind < nb; ind++)
+    ret = tengine_sqlite_setbit(db, bkeys[ind], bklens[ind], 
+                                boffs[ind], bvals[ind]);
+
+  ret = tengine_sqlite_end(eng, db, ret);
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+static int tengine_sqlite_getrange(tengine_t *eng, char *key, int klen, 
+                                   long start, void *val, int *vlen)
+{
+  int                  ret;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+  sqlite3_stmt        *stmt;
+
+  stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_RANGE, key, klen);
+
+  sqlite3_bind_int64(stmt, 2, start + 1);                       /* 1 based */
+  sqlite3_bind_int(stmt, 3, *vlen);
+
+  if ((ret = tengine_sqlite_row(db, stmt)) > 0 && start >= 0)
+    *vlen = tengine_sqlite_copy(stmt, 0, val, *vlen);
+  else
+    *vlen = 0;
+
+  tengine_sqlite_done(stmt);
+  tengine_sqlite_leave(db);
+
+  return ret < 0 ? -1 : 0;
+}
+
+static int tengine_sqlite_unlink(tengine_t *eng, char *keys[], int klens[], 
+                                 int n)
+{
+  int                  ind;
+  int                  ret;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) == 0)
+  {
+    for (ind = 0; ret == 0 && ind < n; ind++)
+      ret = tengine_sqlite_remove(db, keys[ind], klens[ind]);
+
+    ret = tengine_sqlite_end(eng, db, ret);
+  }
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+static int tengine_sqlite_lindex(tengine_t *eng, char *key, int klen, 
+                                 long index, void *val, int *vlen)
+{
+  int                  ret;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+  sqlite3_stmt        *stmt;
+
+  if (index >= 0)
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_LINDEX, key, klen);
+  else                                               /* from the end */
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_RINDEX, key, klen);
+
+  sqlite3_bind_int64(stmt, 2, index >= 0 ? index : -index - 1);
+
+  if ((ret = tengine_sqlite_row(db, stmt)) > 0)
+    *vlen = tengine_sqlite_copy(stmt, 0, val, *vlen);
+  else
+    *vlen = -1;
+
+  tengine_sqlite_done(stmt);
+  tengine_sqlite_leave(db);
+
+  return ret < 0 ? -1 : 0;
+}
+
+static int tengine_sqlite_lrem(tengine_t *eng, char *key, int klen, 
+                               void *val, int vlen)
+{
+  int                  ret;
+  sqlite3_stmt        *stmt;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) == 0)
+  {
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_LREM, key, klen);
+
+    tengine_sqlite_bind(stmt, 2, val, vlen);
+
+    ret = tengine_sqlite_exec(db, stmt);
+    ret = tengine_sqlite_end(eng, db, ret);
+  }
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+static int tengine_sqlite_incrby(tengine_t *eng, char *key, int klen, 
+                                 long long incr, long long *val)
+{
+  int                  ret;
+  long long            num = 0;
+  char                 num_buf[32];
+  char                *buf;
+  char                *ep;
+  size_t               len;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) < 0)
+  {
+    tengine_sqlite_leave(db);
+    return -1;
+  }
+
+  if ((buf = tengine_sqlite_load(db, key, klen, 32, &len)) == NULL ||
+      len >= 32)
+    ret = -1;
+  else if (len)
+  {
+    errno = 0;
+    num   = strtoll(buf, &ep, 10);
+
+    if (errno || *ep)                                  /* not an integer */
+      ret = -1;
+  }
+
+  if (ret == 0)
+  {
+    num += incr;
+
+    sprintf(num_buf, "%lld", num);
+
+    ret = tengine_sqlite_put(db, key, klen, num_buf, strlen(num_buf));
+  }
+
+  if ((ret = tengine_sqlite_end(eng, db, ret)) == 0)
+    *val = num;
+
+  tengine_sqlite_leave(db);
+
+  free(buf);
+
+  return ret;
+}
+
+/* Rename key to nkey, overwriting nkey, -1 if there is no key */
+static int tengine_sqlite_rename(tengine_t *eng, char *key, int klen, 
+                                 char *nkey, int nklen)
+{
+  int                  ret;
+  sqlite3_stmt        *stmt;
+  tengine_sqlite_db_t *db = tengine_sqlite_enter(eng);
+
+  if ((ret = tengine_sqlite_begin(eng, db)) < 0)
+  {
+    tengine_sqlite_leave(db);
+    return -1;
+  }
+
+  stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_EXISTS, key, klen);
+  ret  = tengine_sqlite_row(db, stmt) > 0 ? 0 : -1;
+
+  tengine_sqlite_done(stmt);
+
+  if (ret == 0 && (klen != nklen || memcmp(key, nkey, klen) != 0))
+  {
+    ret = tengine_sqlite_remove(db, nkey, nklen);
+
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_RENAME, key, klen);
+    tengine_sqlite_bind(stmt, 2, nkey, nklen);
+
+    if (ret == 0)
+      ret = tengine_sqlite_exec(db, stmt);
+    else
+      tengine_sqlite_done(stmt);
+
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_LRENAME, key, klen);
+    tengine_sqlite_bind(stmt, 2, nkey, nklen);
+
+    if (ret == 0)
+      ret = tengine_sqlite_exec(db, stmt);
+    else
+      tengine_sqlite_done(stmt);
+  }
+
+  ret = tengine_sqlite_end(eng, db, ret);
+
+  tengine_sqlite_leave(db);
+
+  return ret;
+}
+
+/*
+ * Keys come in sorted batches from the literal prefix of pat on, so a scan
+ * of "d:12:*" only walks that range. The handle is not held while cb runs.
+ */
+static int tengine_sqlite_scan(tengine_t *eng, char *pat, int plen, 
+                               tengine_scan_cb_t cb, void *arg)
+{
+  int                  ind;
+  int                  cnt;
+  int                  rc   = 1;
+  int                  ret  = 0;
+  int                  stop = 0;
+  int                  clen = 0;
+  int                  pre  = 0;
+  int                  klens[TENGINE_SQLITE_SCAN_COUNT];
+  char                *keys[TENGINE_SQLITE_SCAN_COUNT];
+  char                 cur[TENGINE_SQLITE_KEY_MAX + 1];
+  char                *patz = NULL;
+  tengine_sqlite_db_t *db;
+  sqlite3_stmt        *stmt;
+
+  if (pat && (patz = strndup(pat, plen)) == NULL)
+    return -1;
+
+  while (pre < plen && pre < TENGINE_SQLITE_KEY_MAX &&
+         strchr("*?[\\", pat[pre]) == NULL)
+    pre++;
+
+  if (pre)                                 /* start at the literal prefix */
+    memcpy(cur, pat, pre);
+
+  clen = pre;
+
+  while (stop == 0)
+  {
+    db   = tengine_sqlite_enter(eng);
+    stmt = tengine_sqlite_stmt(db, TENGINE_SQLITE_SCAN, cur, clen);
+    cnt  = 0;
+
+    sqlite3_bind_int(stmt, 2, TENGINE_SQLITE_SCAN_COUNT);
+
+    while (cnt < TENGINE_SQLITE_SCAN_COUNT &&
+           (rc = tengine_sqlite_row(db, stmt)) > 0)
+    {
+      klens[cnt] = sqlite3_column_bytes(stmt, 0);
+
+      if (klens[cnt] < pre || memcmp(sqlite3_column_blob(stmt, 0), pat, 
+                                     pre) != 0)
+      {
+        rc = 0;                                      /* past the prefix */
+        break;
+      }
+
+      if ((keys[cnt] = strndup(sqlite3_column_blob(stmt, 0), 
+                               klens[cnt])) == NULL)
+      {
+        rc = -1;
+        break;
+      }
+
+      cnt++;
+    }
+
+    tengine_sqlite_done(stmt);
+    tengine_sqlite_leave(db);
+
+    if (rc < 0)
+      ret = -1;
+
+    if (rc <= 0 || cnt < TENGINE_SQLITE_SCAN_COUNT)
+      stop = 1;
+
+    for (ind = 0; ind < cnt; ind++)
+    {
+      if (ret == 0 && (patz == NULL || fnmatch(patz, keys[ind], 0) == 0) &&
+          cb(keys[ind], klens[ind], arg))
+        stop = 1;
+
+      if (ind == cnt - 1 && klens[ind] < TENGINE_SQLITE_KEY_MAX)
+      {
+        memcpy(cur, keys[ind], klens[ind]);       /* next key after this */
+        cur[klens[ind]] = 0;
+        clen = klens[ind] + 1;
+      }
+      else if (ind == cnt - 1)
+        stop = 1;
+
+      free(keys[ind]);
+    }
+  }
+
+  free(patz);
+
+  return ret;
+}
+
+tengine_ops_t tengine_sqlite_ops = 
+{
+  "sqlite", 
+  tengine_sqlite_open,
+  tengine_sqlite_close,
+  NULL,
+  tengine_sqlite_get,
+  tengine_sqlite_set,
+  tengine_sqlite_del,
+  tengine_sqlite_mget,
+  tengine_sqlite_mput,
+  tengine_sqlite_getrange,
+  tengine_sqlite_unlink,
+  tengine_sqlite_lindex,
+  tengine_sqlite_lrem,
+  tengine_sqlite_incrby,
+  tengine_sqlite_rename,
+  tengine_sqlite_scan
+};